@@ -24,43 +24,88 @@ typedef ImmutableMap<ObjectKey, ObjectStatePtr> MemoryMap;
 
 class AddressSpace {
 
+    ///
+    /// Direct-mapped cache of the objects containing recently looked up
+    /// addresses, indexed by 1KB granule. Slots hold objects that may span
+    /// several granules, so lookups check that the object contains the
+    /// address. The slots are allocated on first use.
+    ///
     class Cache {
-        static const unsigned CACHE_SIZE = 256;
+        static const unsigned GRANULE_BITS = 10;
+
         std::vector<ObjectStatePtr> m_cache;
+        unsigned m_bits;
 
-        static inline uint8_t hash(uint64_t address) {
-            uint8_t result = 0;
-            int q = 33149;
-            for (unsigned i = 0; i < 8; ++i) {
-                result ^= (uint8_t)((address & 0xFF) * q);
-                address >>= 8;
-            }
-            return address;
+        inline unsigned index(uint64_t granule) const {
+            return (unsigned) ((granule * 0x9e3779b97f4a7c15ull) >> (64 - m_bits));
+        }
+
+        static inline bool overlaps(const ObjectStatePtr &os, uint64_t address, uint64_t size) {
+            return os->getAddress() < address + size && address < os->getAddress() + os->getSize();
         }
 
+        /// Size of new caches, from -address-space-cache-bits
+        static unsigned getDefaultBits();
+
     public:
-        Cache() {
-            m_cache.resize(CACHE_SIZE);
+        Cache() : m_bits(0) {
         }
 
-        Cache(const Cache &b) {
-            m_cache.clear();
+        /// Forked address spaces have the same objects
+        Cache(const Cache &b) : m_cache(b.m_cache), m_bits(b.m_bits) {
         }
 
         inline ObjectStatePtr get(uint64_t address) const {
-            auto ret = m_cache[hash(address)];
-            if (ret && ret->getAddress() == address) {
+            if (m_cache.empty()) {
+                return nullptr;
+            }
+
+            auto &ret = m_cache[index(address >> GRANULE_BITS)];
+            if (ret && address - ret->getAddress() < ret->getSize()) {
                 return ret;
             }
             return nullptr;
         }
 
+        /// Remember that \a os contains \a address
+        inline void put(uint64_t address, const ObjectStatePtr &os) {
+            if (m_cache.empty()) {
+                m_bits = getDefaultBits();
+                m_cache.resize(1 << m_bits);
+            }
+
+            m_cache[index(address >> GRANULE_BITS)] = os;
+        }
+
+        /// Bind \a os, replacing the objects it overlaps
         inline void add(const ObjectStatePtr &os) {
-            m_cache[hash(os->getAddress())] = os;
+            invalidate(os->getAddress(), os->getSize());
+            put(os->getAddress(), os);
         }
 
-        inline void invalidate(uint64_t address) {
-            m_cache[hash(address)] = nullptr;
+        /// Drop the objects that overlap the given range
+        void invalidate(uint64_t address, uint64_t size) {
+            if (m_cache.empty()) {
+                return;
+            }
+
+            uint64_t first = address >> GRANULE_BITS;
+            uint64_t last = (address + size - 1) >> GRANULE_BITS;
+            if (last - first >= m_cache.size()) {
+                for (auto &os : m_cache) {
+                    if (os && overlaps(os, address, size)) {
+                        os = nullptr;
+                    }
+                }
+                return;
+            }
+
+            for (uint64_t granule = first; granule <= last; ++granule) {
+                auto &os = m_cache[index(granule)];
+                if (os && overlaps(os, address, size)) {
+                    os = nullptr;
+                }
+            }
         }
     };
 
@@ -136,6 +181,12 @@ public:
     /// \param os The current binding of the MemoryObject.
     /// \return A writeable ObjectState (\a os or a copy).
     ObjectStatePtr getWriteable(const ObjectStateConstPtr &os);
+
+    /// \brief Bind an equivalent object in place of another one.
+    ///
+    /// Unlike getWriteable, this does not take ownership of \a nos,
+    /// which may be shared with other address spaces.
+    void replaceObject(const ObjectStateConstPtr &os, const ObjectStatePtr &nos);
 };
 
 } // namespace klee
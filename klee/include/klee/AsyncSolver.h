@@ -0,0 +1,72 @@
+//===-- AsyncSolver.h -------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_ASYNCSOLVER_H
+#define KLEE_ASYNCSOLVER_H
+
+#include "klee/Expr.h"
+
+#include <memory>
+#include <vector>
+
+namespace klee {
+
+struct Query;
+
+/// AsyncSolver - Computes initial values on a background thread.
+///
+/// Expressions are not thread-safe, so submit() serializes the query on the
+/// calling thread and the background thread only works on the serialized
+/// form. All methods must be called from the same thread.
+class AsyncSolver {
+public:
+    typedef uint64_t Ticket;
+
+    struct Result {
+        Ticket ticket;
+
+        /// False if the solver could not answer, in which case the query
+        /// has to be solved again synchronously.
+        bool success;
+
+        bool hasSolution;
+        std::vector<std::vector<unsigned char>> values;
+    };
+
+    virtual ~AsyncSolver() {
+    }
+
+    /// submit - Queue the computation of values of objects that satisfy the
+    /// constraints of the query. The query expression is ignored.
+    virtual Ticket submit(const Query &query, const ArrayVec &objects) = 0;
+
+    /// getResult - Retrieve the result of a completed query.
+    ///
+    /// \param wait Block until a query completes if none did yet.
+    /// \return False if no query completed, or none is pending when waiting.
+    virtual bool getResult(Result &result, bool wait) = 0;
+
+    /// pending - Number of queries submitted whose result was not retrieved.
+    virtual unsigned pending() const = 0;
+
+    /// stop - Stop the background thread, which restarts on the next
+    /// submission. No query may be pending. The thread would not survive a
+    /// fork of the process.
+    virtual void stop() = 0;
+};
+
+using AsyncSolverPtr = std::shared_ptr<AsyncSolver>;
+
+/// createZ3AsyncSolver - Create an asynchronous solver backed by a Z3
+/// context owned by the background thread.
+AsyncSolverPtr createZ3AsyncSolver();
+
+} // namespace klee
+
+#endif
@@ -32,7 +32,7 @@
 
 #include <inttypes.h>
 #include "klee/Expr.h"
-#include "klee/util/ExprHashMap.h"
+#include "klee/util/BoundedExprHashMap.h"
 
 namespace klee {
 
@@ -89,10 +89,13 @@ protected:
     };
     typedef std::pair<ref<Expr>, BitsInfo> ExprBitsInfo;
 
-    /// XXX: this cache will probably grow too large with time
-    ExprHashMap<BitsInfo> m_bitsInfoCache;
+    /// Both caches are bounded by -expr-simplifier-cache-mb, which is
+    /// applied on first use as a simplifier may be a static object.
+    BoundedExprHashMap<BitsInfo> m_bitsInfoCache;
+    BoundedExprHashMap<ExprBitsInfo> m_simplifiedExpressions;
+    bool m_cachesConfigured;
 
-    ExprHashMap<ExprBitsInfo> m_simplifiedExpressions;
+    void configureCaches();
 
     ref<Expr> replaceWithConstant(const ref<Expr> &e, const llvm::APInt &value);
 
@@ -101,6 +104,10 @@ protected:
 public:
     uint64_t m_cacheHits, m_cacheMisses;
 
+    uint64_t getCacheEvictions() const {
+        return m_bitsInfoCache.getEvictions() + m_simplifiedExpressions.getEvictions();
+    }
+
     ref<Expr> simplify(const ref<Expr> &e, llvm::APInt *knownZeroBits = nullptr);
 
     // If e = base + offset, where base is concrete and offset is
@@ -111,6 +118,7 @@ public:
     bool getBaseOffsetFast(const ref<Expr> &e, uint64_t &base, ref<Expr> &offset, unsigned &offsetSize);
 
     BitfieldSimplifier() {
+        m_cachesConfigured = false;
         m_cacheHits = 0;
         m_cacheMisses = 0;
     }
@@ -64,6 +64,95 @@ using boost::weak_ptr;
 class ConditionNode;
 typedef shared_ptr<ConditionNode> ConditionNodeRef;
 
+/// A byte of a symbolic array, or all of its bytes when offset is WHOLE.
+struct IndependenceKey {
+    static const uint32_t WHOLE = ~0u;
+
+    const Array *array;
+    uint32_t offset;
+
+    bool operator<(const IndependenceKey &b) const {
+        return array < b.array || (array == b.array && offset < b.offset);
+    }
+
+    bool operator==(const IndependenceKey &b) const {
+        return array == b.array && offset == b.offset;
+    }
+
+    bool operator!=(const IndependenceKey &b) const {
+        return !(*this == b);
+    }
+};
+
+/// Union-find of the array bytes read by a set of constraints. Two bytes are in
+/// the same class iff they are transitively related by the constraints. Reading
+/// an array at a symbolic offset relates all of its bytes.
+///
+/// The index is persistent: adding a constraint to a copy leaves the original
+/// untouched and shares most of its storage, so that each node of the condition
+/// tree can keep the index of its path. There is no path compression, union by
+/// size bounds the depth of the classes to O(log n).
+class IndependenceIndex {
+    struct Entry {
+        IndependenceKey parent;
+        unsigned size;
+    };
+
+    typedef ImmutableMap<IndependenceKey, Entry> entries_ty;
+    entries_ty m_entries;
+
+    IndependenceKey unite(const IndependenceKey &a, const IndependenceKey &b);
+    IndependenceKey insert(const IndependenceKey &key);
+
+public:
+    /// Add the bytes read by the expression to the index, in a single class.
+    ///
+    /// \param [out] root - The class of the expression.
+    ///
+    /// \return False if the expression does not read any symbolic byte.
+    bool add(const ref<Expr> &e, IndependenceKey &root);
+
+    /// Return the representative of the class of a byte previously added.
+    IndependenceKey find(IndependenceKey key) const;
+
+    size_t size() const {
+        return m_entries.size();
+    }
+};
+
+/// Equalities and unsigned ranges implied by the constraints of a path, used
+/// to rewrite expressions without calling the solver. Like IndependenceIndex,
+/// the facts are persistent and each node of the condition tree keeps the ones
+/// of its path.
+class PathFacts {
+    struct Range {
+        uint64_t min, max;
+    };
+
+    typedef ImmutableMap<ref<Expr>, ref<Expr>> equalities_ty;
+    typedef ImmutableMap<ref<Expr>, Range> ranges_ty;
+
+    equalities_ty m_equalities;
+    ranges_ty m_ranges;
+
+    void addRange(const ref<Expr> &e, uint64_t min, uint64_t max);
+
+public:
+    void add(const ref<Expr> &constraint);
+
+    /// Return the value of e forced by the facts, null if there is none.
+    ref<Expr> getEquality(const ref<Expr> &e) const;
+
+    /// Return the range of values of e allowed by the facts.
+    bool getRange(const ref<Expr> &e, uint64_t &min, uint64_t &max) const;
+
+    ref<Expr> simplify(const ref<Expr> &e) const;
+
+    bool empty() const {
+        return m_equalities.empty() && m_ranges.empty();
+    }
+};
+
 class ConditionNode : public enable_shared_from_this<ConditionNode> {
 public:
     const ConditionNodeRef parent() const {
@@ -76,15 +165,41 @@ public:
         return depth_;
     }
 
+    /// Hash of the constraints of the path from the root to this node.
+    unsigned hash() const {
+        return hash_;
+    }
+
+    /// Facts implied by the path from the root to this node.
+    const PathFacts &facts() const {
+        return facts_;
+    }
+
+    /// Index of the bytes read by the path from the root to this node.
+    const IndependenceIndex &independence() const {
+        return index_;
+    }
+
+    /// Return one of the bytes read by the condition of this node, false if it
+    /// does not read symbolic data.
+    bool getIndependenceKey(IndependenceKey &key) const {
+        key = key_;
+        return hasKey_;
+    }
+
 protected:
     // Use weak_ptr here to enable automatic deallocation of nodes when they're
     // no longer referenced from a ConstraintManager.
     typedef std::map<ref<Expr>, weak_ptr<ConditionNode>> AdjancencyMap;
 
-    ConditionNode() : depth_(0) {
+    ConditionNode() : depth_(0), hash_(0), key_(), hasKey_(false) {
     }
     ConditionNode(const ConditionNodeRef parent, const ref<Expr> expr)
-        : parent_(parent), expr_(expr), depth_(parent->depth_ + 1) {
+        : parent_(parent), expr_(expr), depth_(parent->depth_ + 1),
+          hash_(parent->hash_ * Expr::MAGIC_HASH_CONSTANT + expr->hash()), facts_(parent->facts_),
+          index_(parent->index_), key_() {
+        facts_.add(expr);
+        hasKey_ = index_.add(expr, key_);
     }
 
     ConditionNodeRef getOrCreate(const ref<Expr> expr) {
@@ -102,6 +217,11 @@ private:
     const ConditionNodeRef parent_;
     const ref<Expr> expr_;
     size_t depth_;
+    unsigned hash_;
+    PathFacts facts_;
+    IndependenceIndex index_;
+    IndependenceKey key_;
+    bool hasKey_;
 
     friend class ConstraintManager;
 
@@ -193,9 +313,8 @@ public:
         return e;
     }
 
-    ref<Expr> simplifyExpr(const ref<Expr> e) const {
-        return e;
-    }
+    /// Rewrite e using the equalities and ranges implied by the constraints.
+    ref<Expr> simplifyExpr(const ref<Expr> e) const;
 
     bool empty() const {
         return head_ == root_;
@@ -16,6 +16,14 @@ namespace klee {
 namespace stats {
 
 extern Statistic allocations;
+
+/// Object lookups answered by the cache of the address space, and the
+/// ones that went through the object map.
+extern Statistic addressSpaceCacheHits;
+extern Statistic addressSpaceCacheMisses;
+
+/// Concrete memory pages whose buffer was merged with an identical one.
+extern Statistic deduplicatedPages;
 extern Statistic resolveTime;
 extern Statistic instructions;
 extern Statistic instructionTime;
@@ -30,6 +38,12 @@ extern Statistic solverTime;
 /// The number of process forks.
 extern Statistic forks;
 
+/// Lookups and evictions of the caches of the expression simplifier
+/// shared by all the states.
+extern Statistic simplifierCacheHits;
+extern Statistic simplifierCacheMisses;
+extern Statistic simplifierCacheEvictions;
+
 /// Number of states, this is a "fake" statistic used by istats, it
 /// isn't normally up-to-date.
 extern Statistic states;
@@ -137,6 +137,16 @@ public:
     ///
     virtual bool addConstraint(const ref<Expr> &e, bool recomputeConcolics = false) __attribute__((warn_unused_result));
 
+    ///
+    /// \brief Add a constraint without checking it against the concolic values
+    ///
+    /// The caller must compute new concolic values before the state runs.
+    ///
+    /// \param e the constraint to add
+    /// \return false if the constraint is trivially false
+    ///
+    bool addUncheckedConstraint(const ref<Expr> &e) __attribute__((warn_unused_result));
+
     ///
     /// \brief Compute a set of concrete inputs for the given constraints
     /// \param mgr the constraints
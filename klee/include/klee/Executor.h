@@ -21,6 +21,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include "klee/AsyncSolver.h"
 #include "klee/ExecutionState.h"
 #include "klee/Internal/Module/Cell.h"
 #include "klee/Internal/Module/KInstruction.h"
@@ -107,6 +108,22 @@ protected:
     /// \invariant \ref addedStates and \ref removedStates are disjoint.
     StateSet removedStates;
 
+    /// Solves the feasibility of the states forked asynchronously.
+    AsyncSolverPtr asyncSolver;
+
+    struct PendingState {
+        /// Null once the state is terminated, the result of its query is then ignored
+        ExecutionState *state;
+        ArrayVec objects;
+
+        /// Constraints of the submitted query
+        ConditionNodeRef head;
+    };
+
+    /// States forked asynchronously whose feasibility is not known yet.
+    /// They are neither in \ref states nor in \ref addedStates.
+    std::unordered_map<AsyncSolver::Ticket, PendingState> pendingStates;
+
     /// Map of predefined global values
     std::map<std::string, void *> predefinedSymbols;
 
@@ -130,6 +147,21 @@ protected:
     void initializeGlobals(ExecutionState &state);
 
     virtual void updateStates(ExecutionState *current);
+
+    /// Move the pending states that were proven feasible to \ref addedStates
+    /// and discard the others.
+    ///
+    /// \param wait Block until a state is admitted or none is pending.
+    void processPendingStates(bool wait);
+
+    /// Wait for all the pending states and stop the solver thread.
+    /// \return true if states were admitted.
+    bool resolvePendingStates();
+
+    /// Called for the pending states that turned out to be infeasible.
+    /// Plugins were not notified of their fork.
+    virtual void discardPendingState(ExecutionState &state);
+
     void transferToBasicBlock(llvm::BasicBlock *dst, llvm::BasicBlock *src, ExecutionState &state);
 
     void callExternalFunction(ExecutionState &state, KInstruction *target, llvm::Function *function,
@@ -213,6 +245,10 @@ public:
     Executor(InterpreterHandler *ie, llvm::LLVMContext &context);
     virtual ~Executor();
 
+    void setAsyncSolver(const AsyncSolverPtr &solver) {
+        asyncSolver = solver;
+    }
+
     // Fork current and return states in which condition holds / does
     // not hold, respectively. One of the states is necessarily the
     // current state, and one of the states may be null.
@@ -185,12 +185,20 @@ public:
 protected:
     unsigned hashValue;
 
-    Expr() : refCount(0), hashValue(0) {
+    /// Set if this node is the only one with its structure, in which case
+    /// it can be told apart from other interned nodes by its address.
+    bool interned;
+
+    Expr() : refCount(0), hashValue(0), interned(false) {
     }
 
+    /// intern - Return the node structurally equal to \a e if hash-consing
+    /// is enabled and one exists, deleting \a e. Otherwise \a e is returned,
+    /// after being added to the intern table if all its kids are interned.
+    static Expr *intern(Expr *e);
+
 public:
-    virtual ~Expr() {
-    }
+    virtual ~Expr();
 
     virtual Kind getKind() const = 0;
     virtual Width getWidth() const = 0;
@@ -222,6 +230,18 @@ public:
     ///
     /// `<` and `>` are binary relations that express the total order.
     int compare(const Expr &b) const;
+
+    /// Structural equality, which is a pointer comparison for interned nodes.
+    bool equals(const Expr &b) const {
+        if (this == &b) {
+            return true;
+        }
+        if (interned && b.interned) {
+            return false;
+        }
+        return compare(b) == 0;
+    }
+
     virtual int compareContents(const Expr &b) const {
         return 0;
     }
@@ -275,10 +295,14 @@ public:
     }
 };
 
+template <> inline bool ref<Expr>::operator==(const ref<Expr> &rhs) const {
+    return get()->equals(*rhs.get());
+}
+
 // Comparison operators
 
 inline bool operator==(const Expr &lhs, const Expr &rhs) {
-    return lhs.compare(rhs) == 0;
+    return lhs.equals(rhs);
 }
 
 inline bool operator<(const Expr &lhs, const Expr &rhs) {
@@ -362,6 +386,8 @@ private:
 
                 for (uint64_t j = 0; j < max; ++j) {
                     ref<ConstantExpr> r(new ConstantExpr(llvm::APInt(i, j)));
+                    // Unique by construction, no need to look them up
+                    r->interned = true;
                     _const_table[i][j] = r;
                 }
             }
@@ -377,7 +403,7 @@ private:
                 }
             }
 
-            ref<ConstantExpr> r(new ConstantExpr(v));
+            ref<ConstantExpr> r(static_cast<ConstantExpr *>(intern(new ConstantExpr(v))));
             return r;
         }
 
@@ -885,7 +911,7 @@ public:
     }
 
     static ref<ReadExpr> alloc(const UpdateListPtr &updates, const ref<Expr> &index) {
-        return ref<ReadExpr>(new ReadExpr(updates, index));
+        return ref<ReadExpr>(static_cast<ReadExpr *>(intern(new ReadExpr(updates, index))));
     }
 
     static ref<Expr> create(const UpdateListPtr &updates, ref<Expr> i);
@@ -944,7 +970,7 @@ public:
     }
 
     static ref<Expr> alloc(const ref<Expr> &c, const ref<Expr> &t, const ref<Expr> &f) {
-        return ref<Expr>(new SelectExpr(c, t, f));
+        return ref<Expr>(intern(new SelectExpr(c, t, f)));
     }
 
     static ref<Expr> create(const ref<Expr> &c, const ref<Expr> &t, const ref<Expr> &f);
@@ -1051,7 +1077,7 @@ public:
     }
 
     static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) {
-        return ref<Expr>(new ConcatExpr(l, r));
+        return ref<Expr>(intern(new ConcatExpr(l, r)));
     }
 
     static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r);
@@ -1127,7 +1153,7 @@ public:
     }
 
     static ref<Expr> alloc(const ref<Expr> &e, unsigned o, Width w) {
-        return ref<Expr>(new ExtractExpr(e, o, w));
+        return ref<Expr>(intern(new ExtractExpr(e, o, w)));
     }
 
     /// Creates an ExtractExpr with the given bit offset and width
@@ -1200,7 +1226,7 @@ public:
     }
 
     static ref<Expr> alloc(const ref<Expr> &e) {
-        return ref<Expr>(new NotExpr(e));
+        return ref<Expr>(intern(new NotExpr(e)));
     }
 
     static ref<Expr> create(const ref<Expr> &e);
@@ -1315,7 +1341,7 @@ public:
         virtual ~_class_kind##Expr() {                                    \
         }                                                                 \
         static ref<Expr> alloc(const ref<Expr> &e, Width w) {             \
-            return ref<Expr>(new _class_kind##Expr(e, w));                \
+            return ref<Expr>(intern(new _class_kind##Expr(e, w)));        \
         }                                                                 \
         static ref<Expr> create(const ref<Expr> &e, Width w);             \
         Kind getKind() const {                                            \
@@ -1354,7 +1380,7 @@ CAST_EXPR_CLASS(ZExt)
         }                                                                              \
                                                                                        \
         static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) {               \
-            return ref<Expr>(new _class_kind##Expr(l, r));                             \
+            return ref<Expr>(intern(new _class_kind##Expr(l, r)));                     \
         }                                                                              \
         static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r);               \
         Width getWidth() const {                                                       \
@@ -1407,7 +1433,7 @@ ARITHMETIC_EXPR_CLASS(AShr)
         virtual ~_class_kind##Expr() {                                              \
         }                                                                           \
         static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) {            \
-            return ref<Expr>(new _class_kind##Expr(l, r));                          \
+            return ref<Expr>(intern(new _class_kind##Expr(l, r)));                  \
         }                                                                           \
         static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r);            \
         Kind getKind() const {                                                      \
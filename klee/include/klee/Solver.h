@@ -184,6 +184,10 @@ public:
     static Z3SolverPtr createStackSolver();
     static Z3SolverPtr createAssumptionSolver();
 
+    /// Create a solver that races several Z3 configurations on a thread pool
+    /// and keeps the first answer
+    static Z3SolverPtr createPortfolioSolver();
+
 private:
     Z3Solver(SolverImplPtr &impl);
 
@@ -210,6 +214,15 @@ SolverPtr createValidatingSolver(SolverPtr &s, SolverPtr &oracle);
 /// \param s - The underlying solver to use.
 SolverPtr createCachingSolver(SolverPtr &s);
 
+/// createPersistentCachingSolver - Create a solver which will cache the
+/// results of the queries in a file shared by all the processes that use it,
+/// across runs.
+///
+/// \param s - The underlying solver to use.
+/// \param path - The cache file, created if needed. Returns s if the file
+/// cannot be used.
+SolverPtr createPersistentCachingSolver(SolverPtr &s, const std::string &path);
+
 /// createCexCachingSolver - Create a counterexample caching solver. This is a
 /// more sophisticated cache which records counterexamples for a constraint
 /// set and uses subset/superset relations among constraints to try and
@@ -233,6 +246,27 @@ SolverPtr createFastCexSolver(SolverPtr &s);
 SolverPtr createIndependentSolver(SolverPtr &s);
 void getIndependentConstraintsForQuery(const Query &query, std::vector<ref<Expr>> &required);
 
+/// getIndependentInitialValues - Update an assignment of objects that satisfies
+/// constraints so that it also satisfies condition. Only the constraints that
+/// transitively share array bytes with condition are sent to the solver, the
+/// other bytes keep their value.
+///
+/// \param [in,out] values - The current value of each object (same order and
+/// size as objects), updated on success.
+///
+/// \return True on success, false if there is no satisfying assignment.
+bool getIndependentInitialValues(Solver &solver, const ConstraintManager &constraints, const ref<Expr> &condition,
+                                 const ArrayVec &objects, std::vector<std::vector<unsigned char>> &values);
+
+/// repairInitialValues - Try to make an assignment of objects that satisfies
+/// constraints also satisfy condition by mutating a single byte read by the
+/// condition (bit flips and small deltas), without calling a solver.
+///
+/// \return True if values was updated, false if no mutation worked, in which
+/// case values is left untouched.
+bool repairInitialValues(const ConstraintManager &constraints, const ref<Expr> &condition, const ArrayVec &objects,
+                         std::vector<std::vector<unsigned char>> &values);
+
 /// createKQueryLoggingSolver - Create a solver which will forward all queries
 /// after writing them to the given path in .kquery format.
 SolverPtr createKQueryLoggingSolver(SolverPtr &s, std::string path, int minQueryTimeToLog);
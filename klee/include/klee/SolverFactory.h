@@ -32,6 +32,7 @@
 
 #include <filesystem>
 #include <string>
+#include "AsyncSolver.h"
 #include "Solver.h"
 
 namespace klee {
@@ -49,6 +50,11 @@ public:
     }
     virtual SolverPtr createEndSolver() = 0;
     virtual SolverPtr decorateSolver(SolverPtr &end_solver) = 0;
+
+    /// Return null if the end solver cannot run in the background
+    virtual AsyncSolverPtr createAsyncSolver() {
+        return nullptr;
+    }
 };
 
 using SolverFactoryPtr = std::shared_ptr<SolverFactory>;
@@ -63,6 +69,7 @@ private:
 public:
     virtual SolverPtr createEndSolver();
     virtual SolverPtr decorateSolver(SolverPtr &end_solver);
+    virtual AsyncSolverPtr createAsyncSolver();
 
     static SolverFactoryPtr create(const std::filesystem::path &outputDir) {
         return SolverFactoryPtr(new DefaultSolverFactory(outputDir));
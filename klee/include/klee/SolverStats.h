@@ -21,9 +21,19 @@ extern Statistic queriesInvalid;
 extern Statistic queriesValid;
 extern Statistic queryCacheHits;
 extern Statistic queryCacheMisses;
+extern Statistic queryPersistentCacheHits;
+extern Statistic queryPersistentCacheMisses;
 extern Statistic queryConstructTime;
 extern Statistic queryConstructs;
 extern Statistic queryCounterexamples;
+extern Statistic queryModelRepairs;
+extern Statistic queryPortfolioCancels;
+extern Statistic queryPortfolioWinsResetAsserts;
+extern Statistic queryPortfolioWinsResetIte;
+extern Statistic queryPortfolioWinsResetStores;
+extern Statistic queryPortfolioWinsStackAsserts;
+extern Statistic queryPortfolioWinsAssumptionsAsserts;
+extern Statistic queryPortfolioWinsBitblastIte;
 extern Statistic queryTime;
 } // namespace stats
 } // namespace klee
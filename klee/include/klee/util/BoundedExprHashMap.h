@@ -0,0 +1,156 @@
+//===-- BoundedExprHashMap.h ------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_BOUNDEDEXPRHASHMAP_H
+#define KLEE_BOUNDEDEXPRHASHMAP_H
+
+#include "klee/util/ExprHashMap.h"
+
+#include <vector>
+
+namespace klee {
+
+///
+/// \brief Expression map that holds at most a given number of entries.
+///
+/// Entries are evicted with the CLOCK algorithm: each entry occupies a slot
+/// of a ring and has a reference bit that is set by lookups. When the map is
+/// full, the hand sweeps the ring, clearing the bits it meets, and evicts the
+/// first entry whose bit was already clear. Entries that are used between two
+/// sweeps survive, stale ones release their expressions.
+///
+template <class T> class BoundedExprHashMap {
+private:
+    struct Entry {
+        T value;
+        unsigned slot;
+        bool referenced;
+    };
+
+    typedef ExprHashMap<Entry> map_t;
+
+    map_t m_map;
+
+    /// Key of the entry in each slot, null for free slots
+    std::vector<ref<Expr>> m_slots;
+    unsigned m_hand;
+
+    size_t m_capacity;
+    uint64_t m_evictions;
+
+    unsigned evict() {
+        while (true) {
+            if (m_hand >= m_slots.size()) {
+                m_hand = 0;
+            }
+
+            unsigned slot = m_hand++;
+            auto &key = m_slots[slot];
+            if (key.isNull()) {
+                return slot;
+            }
+
+            auto it = m_map.find(key);
+            if (it->second.referenced) {
+                it->second.referenced = false;
+                continue;
+            }
+
+            m_map.erase(it);
+            key = ref<Expr>();
+            ++m_evictions;
+            return slot;
+        }
+    }
+
+public:
+    /// Approximate memory used by an entry, not counting the expressions
+    /// and the heap storage of the value.
+    static const size_t EntrySize = sizeof(typename map_t::value_type) + 2 * sizeof(void *) + sizeof(ref<Expr>);
+
+    BoundedExprHashMap(size_t capacity = 0) : m_hand(0), m_capacity(capacity), m_evictions(0) {
+    }
+
+    /// Return the value of \a e, or null if it is not in the map.
+    /// The pointer is valid until the next insertion.
+    const T *find(const ref<Expr> &e) {
+        auto it = m_map.find(e);
+        if (it == m_map.end()) {
+            return nullptr;
+        }
+
+        it->second.referenced = true;
+        return &it->second.value;
+    }
+
+    /// Insert or replace the value of \a e, evicting an entry if the map
+    /// is full.
+    void insert(const ref<Expr> &e, const T &value) {
+        auto it = m_map.find(e);
+        if (it != m_map.end()) {
+            it->second.value = value;
+            it->second.referenced = true;
+            return;
+        }
+
+        unsigned slot = 0;
+        if (!m_capacity) {
+            // Nothing to evict, no need for the ring
+        } else if (m_slots.size() < m_capacity) {
+            slot = m_slots.size();
+            m_slots.push_back(e);
+        } else {
+            slot = evict();
+            m_slots[slot] = e;
+        }
+
+        m_map.insert(std::make_pair(e, Entry{value, slot, false}));
+    }
+
+    void erase(const ref<Expr> &e) {
+        auto it = m_map.find(e);
+        if (it == m_map.end()) {
+            return;
+        }
+
+        if (m_capacity) {
+            m_slots[it->second.slot] = ref<Expr>();
+        }
+        m_map.erase(it);
+    }
+
+    void clear() {
+        m_map.clear();
+        m_slots.clear();
+        m_hand = 0;
+    }
+
+    /// Change the maximum number of entries, 0 for no limit. Existing
+    /// entries are dropped.
+    void setCapacity(size_t capacity) {
+        clear();
+        m_capacity = capacity;
+    }
+
+    size_t getCapacity() const {
+        return m_capacity;
+    }
+
+    size_t size() const {
+        return m_map.size();
+    }
+
+    uint64_t getEvictions() const {
+        return m_evictions;
+    }
+};
+
+} // namespace klee
+
+#endif
@@ -28,6 +28,7 @@
 #include <map>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <klee/util/BitArray.h>
 #include <klee/util/PtrUtils.h>
@@ -43,6 +44,13 @@ class Pages {
     BitArrayPtr m_pageStatus;
     uint8_t *m_buffer;
     size_t m_size;
+    unsigned m_numPages;
+
+    // Indices of the free pages, the last one is allocated first
+    std::vector<unsigned> m_freeList;
+
+    // Backed by explicit hugepages, which are not released by madvise
+    bool m_hugetlb;
 
 private:
     Pages(unsigned numPages);
@@ -57,20 +65,28 @@ public:
         return m_buffer;
     }
 
+    inline size_t getSize() const {
+        return m_size;
+    }
+
     uint8_t *alloc();
 
     void free(uint8_t *addr);
 
+    /// Give the memory of an empty chunk back to the OS, keeping the mapping.
+    /// \return false if the chunk has to be unmapped instead.
+    bool release();
+
     inline bool empty() const {
-        return m_pageStatus->isAllOnes();
+        return m_freeList.size() == m_numPages;
     }
 
     inline bool full() const {
-        return m_pageStatus->isAllZeros();
+        return m_freeList.empty();
     }
 
     inline unsigned getFreePagesCount() const {
-        return m_pageStatus->getSetBitCount();
+        return m_freeList.size();
     }
 
     INTRUSIVE_PTR_FRIENDS(Pages)
@@ -109,9 +125,15 @@ class PagePool {
     std::unordered_map<uintptr_t, PagesPtr> m_freePages;
     PagesPtr m_cachedPages;
 
+    // Empty chunks whose memory was released, reused before mapping new ones
+    std::vector<PagesPtr> m_releasedPages;
+
+    uint64_t m_allocations;
+    uint64_t m_frees;
+
     static PagePoolPtr s_pool;
 
-    PagePool() : m_refCount(0) {
+    PagePool() : m_refCount(0), m_allocations(0), m_frees(0) {
     }
 
     PagesPtr allocatePages();
@@ -135,6 +157,21 @@ public:
 
     unsigned getFreePages() const;
 
+    /// Number of pages allocated and freed since the creation of the pool
+    uint64_t getAllocations() const {
+        return m_allocations;
+    }
+
+    uint64_t getFrees() const {
+        return m_frees;
+    }
+
+    /// Bytes of the chunks that hold allocated pages. Released chunks are
+    /// not counted, the OS reclaims their memory.
+    uint64_t getResidentBytes() const {
+        return m_map.size() * PagePoolDesc::POOL_PAGE_SIZE;
+    }
+
     INTRUSIVE_PTR_FRIENDS(PagePool)
 };
 
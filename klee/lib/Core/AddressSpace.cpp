@@ -8,11 +8,30 @@
 //===----------------------------------------------------------------------===//
 
 #include "klee/AddressSpace.h"
+#include "klee/CoreStats.h"
 #include "klee/ExecutionState.h"
 #include "klee/Memory.h"
 
+#include <llvm/Support/CommandLine.h>
+
+namespace {
+llvm::cl::opt<unsigned>
+    AddressSpaceCacheBits("address-space-cache-bits", llvm::cl::init(10),
+                          llvm::cl::desc("Log2 of the number of slots of the object cache of each state (default=10)"));
+}
+
 namespace klee {
 
+unsigned AddressSpace::Cache::getDefaultBits() {
+    if (AddressSpaceCacheBits < 1) {
+        return 1;
+    }
+    if (AddressSpaceCacheBits > 20) {
+        return 20;
+    }
+    return AddressSpaceCacheBits;
+}
+
 void AddressSpace::bindObject(const ObjectStatePtr &os) {
     assert(os->getAddress() && os->getSize());
 
@@ -44,22 +63,25 @@ void AddressSpace::unbindObject(const ObjectKey &key) {
     }
 
     objects = objects.remove(key);
-    m_cache.invalidate(os->getAddress());
+    m_cache.invalidate(key.address, key.size);
 }
 
 const ObjectStateConstPtr AddressSpace::findObject(uint64_t address) const {
     auto ret = m_cache.get(address);
     if (ret) {
+        ++stats::addressSpaceCacheHits;
         return ret;
     }
 
+    ++stats::addressSpaceCacheMisses;
+
     ObjectKey key;
     key.address = address;
     key.size = 1;
     auto res = objects.lookup(key);
     ret = res ? res->second : 0;
     if (ret) {
-        m_cache.add(ret);
+        m_cache.put(address, ret);
     }
     return ret;
 }
@@ -98,15 +120,18 @@ ObjectStatePtr AddressSpace::getWriteableInternal(const ObjectStateConstPtr &os)
 
 void AddressSpace::updateWritable(const ObjectStateConstPtr &os, const ObjectStatePtr &wos) {
     wos->setOwnerId(cowKey);
+    replaceObject(os, wos);
+}
 
+void AddressSpace::replaceObject(const ObjectStateConstPtr &os, const ObjectStatePtr &nos) {
     // XXX: should this come at the end?
-    addressSpaceChange(os->getKey(), os, wos);
+    addressSpaceChange(os->getKey(), os, nos);
 
     ObjectKey key;
     key.address = os->getAddress();
     key.size = os->getSize();
-    objects = objects.replace(std::make_pair(key, wos));
-    m_cache.add(wos);
+    objects = objects.replace(std::make_pair(key, nos));
+    m_cache.add(nos);
 }
 
 void AddressSpace::addressSpaceChange(const klee::ObjectKey &key, const ObjectStateConstPtr &oldState,
@@ -11,8 +11,11 @@
 
 using namespace klee;
 
+Statistic stats::addressSpaceCacheHits("AddressSpaceCacheHits", "AScacheHits");
+Statistic stats::addressSpaceCacheMisses("AddressSpaceCacheMisses", "AScacheMisses");
 Statistic stats::allocations("Allocations", "Alloc");
 Statistic stats::coveredInstructions("CoveredInstructions", "Icov");
+Statistic stats::deduplicatedPages("DeduplicatedPages", "DedupPages");
 Statistic stats::falseBranches("FalseBranches", "Bf");
 Statistic stats::forkTime("ForkTime", "Ftime");
 Statistic stats::forks("Forks", "Forks");
@@ -23,6 +26,9 @@ Statistic stats::minDistToReturn("MinDistToReturn", "Rdist");
 Statistic stats::minDistToUncovered("MinDistToUncovered", "UCdist");
 Statistic stats::reachableUncovered("ReachableUncovered", "IuncovReach");
 Statistic stats::resolveTime("ResolveTime", "Rtime");
+Statistic stats::simplifierCacheEvictions("SimplifierCacheEvictions", "SCevict");
+Statistic stats::simplifierCacheHits("SimplifierCacheHits", "SChits");
+Statistic stats::simplifierCacheMisses("SimplifierCacheMisses", "SCmisses");
 Statistic stats::solverTime("SolverTime", "Stime");
 Statistic stats::states("States", "States");
 Statistic stats::trueBranches("TrueBranches", "Bt");
@@ -384,8 +384,16 @@ ref<Expr> ExecutionState::simplifyExpr(const ref<Expr> &e) const {
         return e;
     }
 
+    uint64_t hits = s_simplifier.m_cacheHits;
+    uint64_t misses = s_simplifier.m_cacheMisses;
+    uint64_t evictions = s_simplifier.getCacheEvictions();
+
     ref<Expr> simplified = s_simplifier.simplify(e);
 
+    stats::simplifierCacheHits += s_simplifier.m_cacheHits - hits;
+    stats::simplifierCacheMisses += s_simplifier.m_cacheMisses - misses;
+    stats::simplifierCacheEvictions += s_simplifier.getCacheEvictions() - evictions;
+
     if (ValidateSimplifier) {
         bool isEqual;
 
@@ -460,6 +468,7 @@ ref<ConstantExpr> ExecutionState::toConstantSilent(ref<Expr> e) {
 
 ref<Expr> ExecutionState::toUnique(ref<Expr> &e) {
     e = simplifyExpr(e);
+    e = m_constraints.simplifyExpr(e);
     ref<Expr> result = e;
 
     if (isa<ConstantExpr>(e)) {
@@ -503,7 +512,7 @@ bool ExecutionState::solve(const ConstraintManager &mgr, Assignment &assignment)
 }
 
 bool ExecutionState::addConstraint(const ref<Expr> &constraint, bool recomputeConcolics) {
-    auto simplified = simplifyExpr(constraint);
+    auto simplified = m_constraints.simplifyExpr(simplifyExpr(constraint));
     auto se = dyn_cast<ConstantExpr>(simplified);
     if (se && !se->isTrue()) {
         *klee_warning_stream << "Attempt to add invalid constraint:" << simplified << "\n";
@@ -537,6 +546,17 @@ bool ExecutionState::addConstraint(const ref<Expr> &constraint, bool recomputeCo
     return true;
 }
 
+bool ExecutionState::addUncheckedConstraint(const ref<Expr> &constraint) {
+    auto simplified = m_constraints.simplifyExpr(simplifyExpr(constraint));
+    auto se = dyn_cast<ConstantExpr>(simplified);
+    if (se && !se->isTrue()) {
+        return false;
+    }
+
+    m_constraints.addConstraint(simplified);
+    return true;
+}
+
 /// \brief Print query to solve state constraints
 /// Will print query in format understandable by kleaver.
 ///
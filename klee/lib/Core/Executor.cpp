@@ -79,10 +79,28 @@ cl::opt<bool> SimplifySymIndices("simplify-sym-indices", cl::init(true));
 cl::opt<bool> SuppressExternalWarnings("suppress-external-warnings", cl::init(true));
 
 cl::opt<bool> NoExternals("no-externals", cl::desc("Do not allow external functin calls"));
+
+cl::opt<bool> ForkIndependentSlicing("fork-independent-slicing", cl::init(true),
+                                     cl::desc("When forking, only solve the constraints that depend on the branch "
+                                              "condition and keep the concrete values of the other symbolic bytes"));
+
+cl::opt<bool> ForkModelRepair("fork-model-repair", cl::init(true),
+                              cl::desc("When forking, try small mutations of the current concrete values before "
+                                       "calling the solver"));
+
+cl::opt<unsigned> ForkAsyncMaxPending("fork-async-max-pending", cl::init(64),
+                                      cl::desc("Fork synchronously while this many forked states are waiting "
+                                               "for the solver (default=64)"));
 } // namespace
 
 namespace klee {
 extern cl::opt<bool> UseExprSimplifier;
+
+cl::opt<bool> ForkAsync("fork-async", cl::init(false),
+                        cl::desc("Keep running the current state while the feasibility of the forked state is "
+                                 "checked in the background. Forked states are scheduled once proven feasible, "
+                                 "their concrete values are not valid until then. Plugins are not notified of "
+                                 "such forks, S2E refuses the option if one handles onStateFork."));
 } // namespace klee
 
 Executor::Executor(InterpreterHandler *ih, LLVMContext &context)
@@ -121,6 +139,10 @@ const Module *Executor::setModule(llvm::Module *module, const ModuleOptions &opt
 }
 
 Executor::~Executor() {
+    for (auto &it : pendingStates) {
+        delete it.second.state;
+    }
+
     delete externalDispatcher;
     if (specialFunctionHandler)
         delete specialFunctionHandler;
@@ -329,9 +351,54 @@ void Executor::notifyBranch(ExecutionState &state) {
     pabort("Must go through S2E");
 }
 
+/// Get the current concolic values of the given objects, return false if
+/// some are missing.
+static bool getConcolicValues(ExecutionState &state, const ArrayVec &symbObjects,
+                              std::vector<std::vector<unsigned char>> &concreteObjects) {
+    concreteObjects.clear();
+    for (const auto &array : symbObjects) {
+        auto it = state.concolics->bindings.find(array);
+        if (it == state.concolics->bindings.end()) {
+            return false;
+        }
+        concreteObjects.push_back(it->second);
+    }
+
+    return true;
+}
+
+/// Compute values of the symbolic objects of the state that satisfy its
+/// constraints and the given condition.
+static bool solveForCondition(ExecutionState &state, const ref<Expr> &condition, const ArrayVec &symbObjects,
+                              std::vector<std::vector<unsigned char>> &concreteObjects) {
+    auto solver = state.solver();
+
+    if (ForkIndependentSlicing || ForkModelRepair) {
+        // The current concolic values satisfy the path constraints, only the
+        // ones that depend on the condition must be solved again.
+        if (getConcolicValues(state, symbObjects, concreteObjects)) {
+            if (ForkModelRepair && repairInitialValues(state.constraints(), condition, symbObjects, concreteObjects)) {
+                return true;
+            }
+
+            if (ForkIndependentSlicing) {
+                return getIndependentInitialValues(*solver, state.constraints(), condition, symbObjects,
+                                                   concreteObjects);
+            }
+        }
+    }
+
+    ConstraintManager tmpConstraints = state.constraints();
+    tmpConstraints.addConstraint(condition);
+
+    concreteObjects.clear();
+    Query q(tmpConstraints, klee::ConstantExpr::alloc(0, Expr::Bool));
+    return solver->getInitialValues(q, symbObjects, concreteObjects);
+}
+
 Executor::StatePair Executor::fork(ExecutionState &current, const ref<Expr> &condition_,
                                    bool keepConditionTrueInCurrentState) {
-    auto condition = current.simplifyExpr(condition_);
+    auto condition = current.constraints().simplifyExpr(current.simplifyExpr(condition_));
 
     // If we are passed a constant, no need to do anything
     if (auto ce = dyn_cast<ConstantExpr>(condition)) {
@@ -367,15 +434,8 @@ Executor::StatePair Executor::fork(ExecutionState &current, const ref<Expr> &con
 
     if (keepConditionTrueInCurrentState && !conditionIsTrue) {
         // Recompute concrete values to keep condition true in current state
-
-        // Build constraints where condition must be true
-        ConstraintManager tmpConstraints = current.constraints();
-        tmpConstraints.addConstraint(condition);
-
         std::vector<std::vector<unsigned char>> concreteObjects;
-        auto solver = current.solver();
-        Query q(tmpConstraints, ConstantExpr::alloc(0, Expr::Bool));
-        if (!solver->getInitialValues(q, symbObjects, concreteObjects)) {
+        if (!solveForCondition(current, condition, symbObjects, concreteObjects)) {
             // Condition is always false in the current state
             return StatePair(0, &current);
         }
@@ -389,18 +449,17 @@ Executor::StatePair Executor::fork(ExecutionState &current, const ref<Expr> &con
         conditionIsTrue = true;
     }
 
-    // Build constraints for branched state
-    ConstraintManager tmpConstraints = current.constraints();
-    if (conditionIsTrue) {
-        tmpConstraints.addConstraint(Expr::createIsZero(condition));
-    } else {
-        tmpConstraints.addConstraint(condition);
+    // Compute concrete values for the branched state, unless the solver can
+    // do it in the background
+    auto branchCondition = conditionIsTrue ? Expr::createIsZero(condition) : condition;
+    std::vector<std::vector<unsigned char>> concreteObjects;
+    bool pending = false;
+    if (ForkAsync && asyncSolver && pendingStates.size() < ForkAsyncMaxPending) {
+        pending = !(ForkModelRepair && getConcolicValues(current, symbObjects, concreteObjects) &&
+                    repairInitialValues(current.constraints(), branchCondition, symbObjects, concreteObjects));
     }
 
-    std::vector<std::vector<unsigned char>> concreteObjects;
-    Query q(tmpConstraints, ConstantExpr::alloc(0, Expr::Bool));
-    auto solver = current.solver();
-    if (!solver->getInitialValues(q, symbObjects, concreteObjects)) {
+    if (!pending && !solveForCondition(current, branchCondition, symbObjects, concreteObjects)) {
         if (conditionIsTrue) {
             return StatePair(&current, 0);
         } else {
@@ -412,31 +471,35 @@ Executor::StatePair Executor::fork(ExecutionState &current, const ref<Expr> &con
     ExecutionState *branchedState;
     notifyBranch(current);
     branchedState = current.clone();
-    addedStates.insert(branchedState);
-
-    // Update concrete values for the branched state
-    branchedState->concolics->clear();
-    for (unsigned i = 0; i < symbObjects.size(); ++i) {
-        branchedState->concolics->add(symbObjects[i], concreteObjects[i]);
-    }
 
-    // Add constraint to both states
-    if (conditionIsTrue) {
-        if (!current.addConstraint(condition)) {
-            abort();
-        }
-        if (!branchedState->addConstraint(Expr::createIsZero(condition))) {
-            abort();
+    if (pending) {
+        // The values will be computed along with the feasibility
+        if (!branchedState->addUncheckedConstraint(branchCondition)) {
+            delete branchedState;
+            return conditionIsTrue ? StatePair(&current, 0) : StatePair(0, &current);
         }
+
+        auto ticket = asyncSolver->submit(Query(branchedState->constraints(), branchCondition), symbObjects);
+        pendingStates[ticket] = {branchedState, symbObjects, branchedState->constraints().head()};
     } else {
-        if (!current.addConstraint(Expr::createIsZero(condition))) {
-            abort();
+        addedStates.insert(branchedState);
+
+        // Update concrete values for the branched state
+        branchedState->concolics->clear();
+        for (unsigned i = 0; i < symbObjects.size(); ++i) {
+            branchedState->concolics->add(symbObjects[i], concreteObjects[i]);
         }
-        if (!branchedState->addConstraint(condition)) {
+
+        if (!branchedState->addConstraint(branchCondition)) {
             abort();
         }
     }
 
+    // Add constraint to the current state
+    if (!current.addConstraint(conditionIsTrue ? condition : Expr::createIsZero(condition))) {
+        abort();
+    }
+
     // Classify states
     ExecutionState *trueState, *falseState;
     if (conditionIsTrue) {
@@ -1487,6 +1550,12 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
 }
 
 void Executor::updateStates(ExecutionState *current) {
+    if (!pendingStates.empty()) {
+        // Wait for the solver rather than running out of states
+        bool idle = addedStates.empty() && states.size() == removedStates.size();
+        processPendingStates(idle);
+    }
+
     if (searcher) {
         searcher->update(current, addedStates, removedStates);
     }
@@ -1508,7 +1577,80 @@ void Executor::deleteState(ExecutionState *state) {
     delete state;
 }
 
+void Executor::processPendingStates(bool wait) {
+    AsyncSolver::Result result;
+    while (asyncSolver->getResult(result, wait)) {
+        auto it = pendingStates.find(result.ticket);
+        assert(it != pendingStates.end());
+        auto pending = it->second;
+        pendingStates.erase(it);
+
+        auto state = pending.state;
+        if (!state) {
+            // Terminated while its query was running
+            continue;
+        }
+
+        bool feasible = result.success && result.hasSolution;
+
+        // Solve again if the solver failed or if plugins changed the state
+        // after it was forked
+        if (!result.success || state->constraints().head() != pending.head ||
+            state->symbolics.size() != pending.objects.size()) {
+            pending.objects = state->symbolics;
+            result.values.clear();
+            Query query(state->constraints(), ConstantExpr::alloc(0, Expr::Bool));
+            feasible = state->solver()->getInitialValues(query, pending.objects, result.values);
+        }
+
+        if (!feasible) {
+            discardPendingState(*state);
+            continue;
+        }
+
+        state->concolics->clear();
+        for (unsigned i = 0; i < pending.objects.size(); ++i) {
+            state->concolics->add(pending.objects[i], result.values[i]);
+        }
+
+        addedStates.insert(state);
+        wait = false;
+    }
+}
+
+bool Executor::resolvePendingStates() {
+    if (!asyncSolver) {
+        return false;
+    }
+
+    bool ret = !pendingStates.empty();
+    while (!pendingStates.empty()) {
+        processPendingStates(true);
+    }
+
+    asyncSolver->stop();
+    return ret;
+}
+
+void Executor::discardPendingState(ExecutionState &state) {
+    deleteState(&state);
+}
+
 void Executor::terminateState(ExecutionState &state) {
+    bool pending = false;
+    for (auto &it : pendingStates) {
+        if (it.second.state == &state) {
+            // Not in the state set yet, keep the ticket until the solver returns it
+            it.second.state = nullptr;
+            pending = true;
+        }
+    }
+
+    if (pending) {
+        deleteState(&state);
+        return;
+    }
+
     StateSet::iterator it = addedStates.find(&state);
     if (it == addedStates.end()) {
         // XXX: the following line makes delayed state termination impossible
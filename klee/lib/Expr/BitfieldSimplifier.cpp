@@ -76,8 +76,20 @@ bool maskToBits(uint64_t mask, unsigned &bits) {
 cl::opt<bool> DebugSimplifier("debug-expr-simplifier", cl::init(false));
 
 cl::opt<bool> PrintSimplifier("print-expr-simplifier", cl::init(false));
+
+cl::opt<unsigned> SimplifierCacheSize("expr-simplifier-cache-mb", cl::init(128),
+                                      cl::desc("Memory used by the caches of the expression simplifier, in MiB. "
+                                               "0 for no limit (default=128)"));
 } // namespace
 
+void BitfieldSimplifier::configureCaches() {
+    // The simplified expressions are the results, give them the larger share
+    size_t bytes = (size_t) SimplifierCacheSize * 1024 * 1024;
+    m_bitsInfoCache.setCapacity(bytes / 3 / BoundedExprHashMap<BitsInfo>::EntrySize);
+    m_simplifiedExpressions.setCapacity(bytes * 2 / 3 / BoundedExprHashMap<ExprBitsInfo>::EntrySize);
+    m_cachesConfigured = true;
+}
+
 ref<Expr> BitfieldSimplifier::replaceWithConstant(const ref<Expr> &e, const llvm::APInt &value) {
     ConstantExpr *ce = dyn_cast<ConstantExpr>(e);
     if (ce && ce->getAPValue() == value) {
@@ -107,9 +119,8 @@ BitfieldSimplifier::ExprBitsInfo BitfieldSimplifier::doSimplifyBits(const ref<Ex
         return std::make_pair(e, rbits);
     }
 
-    ExprHashMap<BitsInfo>::iterator it = m_bitsInfoCache.find(e);
-    if (it != m_bitsInfoCache.end()) {
-        return *it;
+    if (auto cached = m_bitsInfoCache.find(e)) {
+        return std::make_pair(e, *cached);
     }
 
     ref<Expr> kids[8];
@@ -391,7 +402,7 @@ BitfieldSimplifier::ExprBitsInfo BitfieldSimplifier::doSimplifyBits(const ref<Ex
 
     /* Cache knownBits information, but only for complex expressions */
     if (rebuilt->getNumKids() > 1) {
-        m_bitsInfoCache.insert(std::make_pair(rebuilt, rbits));
+        m_bitsInfoCache.insert(rebuilt, rbits);
     }
 
     return std::make_pair(rebuilt, rbits);
@@ -406,20 +417,23 @@ ref<Expr> BitfieldSimplifier::simplify(const ref<Expr> &e, APInt *knownZeroBits)
         return e;
     }
 
-    ExprHashMap<ExprBitsInfo>::iterator it = m_simplifiedExpressions.find(e);
-    if (it != m_simplifiedExpressions.end()) {
+    if (!m_cachesConfigured) {
+        configureCaches();
+    }
+
+    if (auto cached = m_simplifiedExpressions.find(e)) {
         ++m_cacheHits;
         if (knownZeroBits) {
-            *knownZeroBits = (*it).second.second.knownZeroBits;
+            *knownZeroBits = cached->second.knownZeroBits;
         }
-        return (*it).second.first;
+        return cached->first;
     }
 
     ++m_cacheMisses;
 
     ExprBitsInfo ret = doSimplifyBits(e, APInt::getNullValue(e->getWidth()));
 
-    m_simplifiedExpressions[e] = ret;
+    m_simplifiedExpressions.insert(e, ret);
 
     if (PrintSimplifier && !cste && klee_message_stream) {
         if (ret.first != e) {
@@ -10,11 +10,21 @@
 #include "klee/Constraints.h"
 
 #include "klee/util/ExprPPrinter.h"
+#include "klee/util/ExprUtil.h"
 #include "klee/util/ExprVisitor.h"
 
+#include <llvm/Support/CommandLine.h>
+
 #include <iostream>
 #include <map>
 
+namespace {
+llvm::cl::opt<bool>
+    SimplifyWithConstraints("simplify-with-constraints",
+                            llvm::cl::desc("Rewrite expressions using the equalities and ranges implied by the path"),
+                            llvm::cl::init(true));
+}
+
 namespace klee {
 
 void ConstraintManager::addConstraint(const ref<Expr> e) {
@@ -32,4 +42,309 @@ void ConstraintManager::addConstraint(const ref<Expr> e) {
             head_ = head_->getOrCreate(e);
     }
 }
+
+ref<Expr> ConstraintManager::simplifyExpr(const ref<Expr> e) const {
+    if (!SimplifyWithConstraints) {
+        return e;
+    }
+
+    return head_->facts().simplify(e);
+}
+
+static uint64_t getMaxValue(Expr::Width width) {
+    return width >= 64 ? ~0ULL : (1ULL << width) - 1;
+}
+
+void PathFacts::addRange(const ref<Expr> &e, uint64_t min, uint64_t max) {
+    auto it = m_ranges.lookup(e);
+    if (it) {
+        min = std::max(min, it->second.min);
+        max = std::min(max, it->second.max);
+    }
+
+    // Contradictory facts, the path is infeasible
+    if (min > max) {
+        return;
+    }
+
+    m_ranges = m_ranges.replace(std::make_pair(e, Range{min, max}));
+    if (min == max) {
+        m_equalities = m_equalities.replace(std::make_pair(e, ConstantExpr::create(min, e->getWidth())));
+    }
+}
+
+void PathFacts::add(const ref<Expr> &constraint) {
+    if (isa<ConstantExpr>(constraint)) {
+        return;
+    }
+
+    ref<Expr> cmp = constraint;
+    bool holds = true;
+
+    if (auto ee = dyn_cast<EqExpr>(constraint)) {
+        if (auto ce = dyn_cast<ConstantExpr>(ee->getLeft())) {
+            auto e = ee->getRight();
+            m_equalities = m_equalities.replace(std::make_pair(e, ref<Expr>(ce)));
+            if (ce->getWidth() != Expr::Bool) {
+                if (ce->getWidth() <= 64) {
+                    addRange(e, ce->getZExtValue(), ce->getZExtValue());
+                }
+                return;
+            }
+
+            if (ce->isTrue()) {
+                return;
+            }
+
+            // Negation of a comparison
+            cmp = e;
+            holds = false;
+        }
+    }
+
+    if (holds) {
+        m_equalities = m_equalities.replace(std::make_pair(constraint, ConstantExpr::create(1, Expr::Bool)));
+    }
+
+    if (cmp->getKind() != Expr::Ult && cmp->getKind() != Expr::Ule) {
+        return;
+    }
+
+    auto be = cast<BinaryExpr>(cmp);
+    auto cl = dyn_cast<ConstantExpr>(be->getLeft());
+    auto cr = dyn_cast<ConstantExpr>(be->getRight());
+    if ((cl != nullptr) == (cr != nullptr)) {
+        return;
+    }
+
+    auto e = cl ? be->getRight() : be->getLeft();
+    if (e->getWidth() > 64) {
+        return;
+    }
+
+    uint64_t c = cl ? cl->getZExtValue() : cr->getZExtValue();
+    uint64_t min = 0, max = getMaxValue(e->getWidth());
+    bool strict = cmp->getKind() == Expr::Ult;
+
+    if (cl) {
+        // c < e, c <= e, or their negations e <= c, e < c
+        if (holds) {
+            if (strict && c == max) {
+                return;
+            }
+            min = strict ? c + 1 : c;
+        } else {
+            if (!strict && c == 0) {
+                return;
+            }
+            max = strict ? c : c - 1;
+        }
+    } else {
+        // e < c, e <= c, or their negations c <= e, c < e
+        if (holds) {
+            if (strict && c == 0) {
+                return;
+            }
+            max = strict ? c - 1 : c;
+        } else {
+            if (!strict && c == max) {
+                return;
+            }
+            min = strict ? c : c + 1;
+        }
+    }
+
+    addRange(e, min, max);
+}
+
+ref<Expr> PathFacts::getEquality(const ref<Expr> &e) const {
+    auto it = m_equalities.lookup(e);
+    return it ? it->second : ref<Expr>();
+}
+
+bool PathFacts::getRange(const ref<Expr> &e, uint64_t &min, uint64_t &max) const {
+    auto it = m_ranges.lookup(e);
+    if (!it) {
+        return false;
+    }
+
+    min = it->second.min;
+    max = it->second.max;
+    return true;
+}
+
+namespace {
+class PathFactsVisitor : public ExprVisitor {
+    const PathFacts &m_facts;
+
+    // Decide comparisons between a constant and an expression of known range
+    ref<Expr> simplifyComparison(const Expr &e) const {
+        auto kind = e.getKind();
+        if (kind != Expr::Eq && kind != Expr::Ult && kind != Expr::Ule) {
+            return nullptr;
+        }
+
+        auto &be = static_cast<const BinaryExpr &>(e);
+        auto cl = dyn_cast<ConstantExpr>(be.getLeft());
+        auto cr = dyn_cast<ConstantExpr>(be.getRight());
+        if ((cl != nullptr) == (cr != nullptr)) {
+            return nullptr;
+        }
+
+        auto x = cl ? be.getRight() : be.getLeft();
+        uint64_t min, max;
+        if (x->getWidth() > 64 || x->getWidth() == Expr::Bool || !m_facts.getRange(x, min, max)) {
+            return nullptr;
+        }
+
+        uint64_t c = cl ? cl->getZExtValue() : cr->getZExtValue();
+        int result = -1;
+        switch (kind) {
+            case Expr::Eq:
+                if (c < min || c > max) {
+                    result = 0;
+                }
+                break;
+            case Expr::Ult:
+                if (cl) {
+                    result = min > c ? 1 : max <= c ? 0 : -1;
+                } else {
+                    result = max < c ? 1 : min >= c ? 0 : -1;
+                }
+                break;
+            case Expr::Ule:
+                if (cl) {
+                    result = min >= c ? 1 : max < c ? 0 : -1;
+                } else {
+                    result = max <= c ? 1 : min > c ? 0 : -1;
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (result < 0) {
+            return nullptr;
+        }
+        return ConstantExpr::create(result, Expr::Bool);
+    }
+
+protected:
+    Action visitExpr(const Expr &e) {
+        auto value = m_facts.getEquality(ref<Expr>(const_cast<Expr *>(&e)));
+        if (!value.isNull()) {
+            return Action::changeTo(value);
+        }
+        return Action::doChildren();
+    }
+
+    Action visitExprPost(const Expr &e) {
+        auto value = m_facts.getEquality(ref<Expr>(const_cast<Expr *>(&e)));
+        if (value.isNull()) {
+            value = simplifyComparison(e);
+        }
+        if (!value.isNull()) {
+            return Action::changeTo(value);
+        }
+        return Action::skipChildren();
+    }
+
+public:
+    PathFactsVisitor(const PathFacts &facts) : ExprVisitor(true), m_facts(facts) {
+    }
+};
+} // namespace
+
+ref<Expr> PathFacts::simplify(const ref<Expr> &e) const {
+    if (isa<ConstantExpr>(e) || empty()) {
+        return e;
+    }
+
+    return PathFactsVisitor(*this).visit(e);
+}
+
+IndependenceKey IndependenceIndex::find(IndependenceKey key) const {
+    while (true) {
+        auto entry = m_entries.lookup(key);
+        assert(entry && "key not in index");
+        if (entry->second.parent == key) {
+            return key;
+        }
+        key = entry->second.parent;
+    }
+}
+
+IndependenceKey IndependenceIndex::unite(const IndependenceKey &a, const IndependenceKey &b) {
+    auto ra = find(a);
+    auto rb = find(b);
+    if (ra == rb) {
+        return ra;
+    }
+
+    unsigned sa = m_entries.lookup(ra)->second.size;
+    unsigned sb = m_entries.lookup(rb)->second.size;
+    if (sa < sb) {
+        std::swap(ra, rb);
+    }
+
+    m_entries = m_entries.replace(std::make_pair(rb, Entry{ra, 0}));
+    m_entries = m_entries.replace(std::make_pair(ra, Entry{ra, sa + sb}));
+    return ra;
+}
+
+IndependenceKey IndependenceIndex::insert(const IndependenceKey &key) {
+    if (m_entries.count(key)) {
+        return find(key);
+    }
+
+    m_entries = m_entries.insert(std::make_pair(key, Entry{key, 1}));
+
+    if (key.offset == IndependenceKey::WHOLE) {
+        // All the bytes of the array seen so far now depend on each other
+        std::vector<IndependenceKey> bytes;
+        for (auto it = m_entries.lower_bound(IndependenceKey{key.array, 0}), ie = m_entries.end();
+             it != ie && (*it).first.array == key.array && (*it).first.offset != IndependenceKey::WHOLE; ++it) {
+            bytes.push_back((*it).first);
+        }
+
+        auto root = key;
+        for (const auto &byte : bytes) {
+            root = unite(root, byte);
+        }
+        return root;
+    }
+
+    IndependenceKey whole = {key.array, IndependenceKey::WHOLE};
+    if (m_entries.count(whole)) {
+        return unite(whole, key);
+    }
+
+    return key;
+}
+
+bool IndependenceIndex::add(const ref<Expr> &e, IndependenceKey &root) {
+    std::vector<ref<ReadExpr>> reads;
+    findReads(e, /* visitUpdates= */ true, reads);
+
+    bool found = false;
+    for (const auto &re : reads) {
+        auto &array = re->getUpdates()->getRoot();
+
+        // Reads of a constant array don't alias.
+        if (array->isConstantArray() && !re->getUpdates()->getHead()) {
+            continue;
+        }
+
+        IndependenceKey key = {array.get(), IndependenceKey::WHOLE};
+        if (auto ce = dyn_cast<ConstantExpr>(re->getIndex())) {
+            key.offset = (uint32_t) ce->getZExtValue(32);
+        }
+
+        auto k = insert(key);
+        root = found ? unite(root, k) : k;
+        found = true;
+    }
+
+    return found;
+}
 } // namespace klee
@@ -19,6 +19,8 @@
 #include <llvm/Support/raw_os_ostream.h>
 #include "klee/util/ExprPPrinter.h"
 
+#include <unordered_map>
+
 #include <iostream>
 #include <sstream>
 
@@ -28,6 +30,9 @@ using namespace llvm;
 namespace {
 cl::opt<bool> ConstArrayOpt("const-array-opt", cl::init(true),
                             cl::desc("Enable various optimizations involving all-constant arrays."));
+
+cl::opt<bool> HashConsExprs("hash-cons-exprs", cl::init(false),
+                            cl::desc("Share a single node between structurally equal expressions (default=false)."));
 }
 
 /***/
@@ -228,6 +233,73 @@ int Expr::compare(const Expr &b) const {
     return 0;
 }
 
+///
+/// Interned nodes by hash value.
+///
+/// The table does not hold references, a node removes itself when it is
+/// destroyed. Expressions are not thread-safe, so neither is the table.
+/// It is never freed, nodes may outlive static destructors.
+///
+typedef std::unordered_multimap<unsigned, Expr *> ExprInternTable;
+
+static ExprInternTable &getInternTable() {
+    static ExprInternTable *table = new ExprInternTable();
+    return *table;
+}
+
+Expr *Expr::intern(Expr *e) {
+    if (!HashConsExprs) {
+        return e;
+    }
+
+    // Nodes with kids that are not shared can't be found in constant time
+    unsigned numKids = e->getNumKids();
+    for (unsigned i = 0; i < numKids; ++i) {
+        if (!e->getKid(i)->interned) {
+            return e;
+        }
+    }
+
+    auto &table = getInternTable();
+    auto range = table.equal_range(e->hashValue);
+    for (auto it = range.first; it != range.second; ++it) {
+        Expr *c = it->second;
+        if (c->getKind() != e->getKind() || c->getWidth() != e->getWidth() || c->compareContents(*e)) {
+            continue;
+        }
+
+        bool sameKids = true;
+        for (unsigned i = 0; i < numKids && sameKids; ++i) {
+            sameKids = c->getKid(i).get() == e->getKid(i).get();
+        }
+
+        if (sameKids) {
+            delete e;
+            return c;
+        }
+    }
+
+    e->interned = true;
+    table.insert(std::make_pair(e->hashValue, e));
+    return e;
+}
+
+Expr::~Expr() {
+    if (!interned) {
+        return;
+    }
+
+    // Small constants are marked as interned without being in the table
+    auto &table = getInternTable();
+    auto range = table.equal_range(hashValue);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == this) {
+            table.erase(it);
+            return;
+        }
+    }
+}
+
 void Expr::printKind(llvm::raw_ostream &os, Kind k) {
     switch (k) {
 #define X(C)      \
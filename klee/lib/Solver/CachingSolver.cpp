@@ -17,9 +17,20 @@
 
 #include "klee/SolverStats.h"
 
+#include <llvm/Support/CommandLine.h>
+
+#include <list>
 #include <unordered_map>
 
 using namespace klee;
+using namespace llvm;
+
+namespace {
+cl::opt<unsigned> MaxCachedQueries("max-cached-queries",
+                                   cl::desc("Maximum number of validity results kept by the caching solver, least "
+                                            "recently used ones are evicted first (0: no limit)"),
+                                   cl::init(0));
+} // namespace
 
 class CachingSolver : public SolverImpl {
 private:
@@ -44,20 +55,22 @@ private:
         }
     };
 
+    // The constraints compare by identity, so their hash is the one computed
+    // once by the head of the condition tree rather than a walk over the path.
     struct CacheEntryHash {
         unsigned operator()(const CacheEntry &ce) const {
-            unsigned result = ce.query->hash();
-
-            for (ConstraintManager::const_iterator it = ce.constraints.begin(); it != ce.constraints.end(); ++it)
-                result ^= ce.constraints.toExpr((*it))->hash();
-
-            return result;
+            return ce.constraints.head()->hash() * Expr::MAGIC_HASH_CONSTANT + ce.query->hash();
         }
     };
 
-    typedef std::unordered_map<CacheEntry, IncompleteSolver::PartialValidity, CacheEntryHash> cache_map;
+    typedef std::pair<CacheEntry, IncompleteSolver::PartialValidity> lru_entry;
+    typedef std::list<lru_entry> lru_list;
+    typedef std::unordered_map<CacheEntry, lru_list::iterator, CacheEntryHash> cache_map;
 
     SolverPtr solver;
+
+    // Most recently used entries first
+    lru_list entries;
     cache_map cache;
 
 private:
@@ -67,6 +80,7 @@ private:
 public:
     ~CachingSolver() {
         cache.clear();
+        entries.clear();
     }
 
     bool computeValidity(const Query &, Validity &result);
@@ -110,7 +124,9 @@ bool CachingSolver::cacheLookup(const Query &query, IncompleteSolver::PartialVal
     cache_map::iterator it = cache.find(ce);
 
     if (it != cache.end()) {
-        result = (negationUsed ? IncompleteSolver::negatePartialValidity(it->second) : it->second);
+        entries.splice(entries.begin(), entries, it->second);
+        auto cachedResult = it->second->second;
+        result = (negationUsed ? IncompleteSolver::negatePartialValidity(cachedResult) : cachedResult);
         return true;
     }
 
@@ -126,7 +142,20 @@ void CachingSolver::cacheInsert(const Query &query, IncompleteSolver::PartialVal
     IncompleteSolver::PartialValidity cachedResult =
         (negationUsed ? IncompleteSolver::negatePartialValidity(result) : result);
 
-    cache.insert(std::make_pair(ce, cachedResult));
+    cache_map::iterator it = cache.find(ce);
+    if (it != cache.end()) {
+        it->second->second = cachedResult;
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+
+    entries.push_front(std::make_pair(ce, cachedResult));
+    cache.insert(std::make_pair(ce, entries.begin()));
+
+    if (MaxCachedQueries && cache.size() > MaxCachedQueries) {
+        cache.erase(entries.back().first);
+        entries.pop_back();
+    }
 }
 
 bool CachingSolver::computeValidity(const Query &query, Validity &result) {
@@ -28,9 +28,18 @@ template <class T> class DenseSet {
     set_ty s;
 
 public:
+    typedef typename set_ty::const_iterator const_iterator;
+
     DenseSet() {
     }
 
+    const_iterator begin() const {
+        return s.begin();
+    }
+    const_iterator end() const {
+        return s.end();
+    }
+
     void add(T x) {
         s.insert(x);
     }
@@ -183,7 +192,7 @@ public:
                 }
             }
         }
-        for (auto it : elements) {
+        for (auto it : b.elements) {
             auto &array = it.first;
             if (!wholeObjects.count(array)) {
                 auto it2 = elements.find(array);
@@ -198,6 +207,16 @@ public:
         }
         return modified;
     }
+
+    bool isWholeObject(const ArrayPtr &array) const {
+        return wholeObjects.count(array) != 0;
+    }
+
+    // Returns the bytes of the given array in the set, null if the whole array or none of it is in the set
+    const DenseSet<unsigned> *getElements(const ArrayPtr &array) const {
+        auto it = elements.find(array);
+        return it != elements.end() ? &it->second : nullptr;
+    }
 };
 
 inline llvm::raw_ostream &operator<<(llvm::raw_ostream &os, const IndependentElementSet &ies) {
@@ -205,52 +224,49 @@ inline llvm::raw_ostream &operator<<(llvm::raw_ostream &os, const IndependentEle
     return os;
 }
 
-static IndependentElementSet getIndependentConstraints(const Query &query, std::vector<ref<Expr>> &result) {
-    IndependentElementSet eltsClosure(query.expr);
-    std::vector<std::pair<ref<Expr>, IndependentElementSet>> worklist;
+// Collects the constraints that transitively share array bytes with the query
+// expression, newest first. The union-find index maintained by the condition
+// tree gives the class of each constraint, so this is linear in the number of
+// constraints.
+static void getIndependentConstraints(const Query &query, std::vector<ref<Expr>> &result,
+                                      IndependentElementSet *eltsClosure = nullptr) {
+    if (eltsClosure) {
+        *eltsClosure = IndependentElementSet(query.expr);
+    }
 
-    for (ConstraintManager::const_iterator it = query.constraints.begin(), ie = query.constraints.end(); it != ie;
-         ++it) {
-        ref<Expr> e = query.constraints.toExpr(*it);
-        worklist.push_back(std::make_pair(e, IndependentElementSet(e)));
+    IndependenceIndex index = query.constraints.head()->independence();
+    IndependenceKey root;
+    if (!index.add(query.expr, root)) {
+        return;
     }
 
-    // XXX This should be more efficient (in terms of low level copy stuff).
-    bool done = false;
-    do {
-        done = true;
-        std::vector<std::pair<ref<Expr>, IndependentElementSet>> newWorklist;
-        for (std::vector<std::pair<ref<Expr>, IndependentElementSet>>::iterator it = worklist.begin(),
-                                                                                ie = worklist.end();
-             it != ie; ++it) {
-            if (it->second.intersects(eltsClosure)) {
-                if (eltsClosure.add(it->second))
-                    done = false;
-                result.push_back(it->first);
-            } else {
-                newWorklist.push_back(*it);
+    for (auto node = query.constraints.head(), ie = query.constraints.root(); node != ie; node = node->parent()) {
+        IndependenceKey key;
+        if (node->getIndependenceKey(key) && index.find(key) == root) {
+            result.push_back(node->expr());
+            if (eltsClosure) {
+                eltsClosure->add(IndependentElementSet(node->expr()));
             }
         }
-        worklist.swap(newWorklist);
-    } while (!done);
-
-    if (0) {
-        std::set<ref<Expr>> reqset(result.begin(), result.end());
-        llvm::errs() << "--\n";
-        llvm::errs() << "Q: " << query.expr << "\n";
-        llvm::errs() << "\telts: " << IndependentElementSet(query.expr) << "\n";
-        int i = 0;
-        for (ConstraintManager::const_iterator it = query.constraints.begin(), ie = query.constraints.end(); it != ie;
-             ++it) {
-            ref<Expr> e = query.constraints.toExpr(*it);
-            llvm::errs() << "C" << i++ << ": " << e;
-            llvm::errs() << " " << (reqset.count(e) ? "(required)" : "(independent)") << "\n";
-            llvm::errs() << "\telts: " << IndependentElementSet(e) << "\n";
-        }
-        llvm::errs() << "elts closure: " << eltsClosure << "\n";
     }
+}
+
+// Slices are chained under a common root so that consecutive slices share their
+// prefix in the stack solver, and so that identical slices end up on the same
+// node, which is what the caching solver compares. Only the executor thread
+// solves through this solver, the asynchronous fork solver does not slice.
+static ConstraintManager getSliceRoot() {
+    static ConstraintManager root;
+    return root;
+}
 
-    return eltsClosure;
+// Build a slice from constraints listed newest first, as getIndependentConstraints returns them
+static ConstraintManager getSlice(const std::vector<ref<Expr>> &required) {
+    ConstraintManager sliced = getSliceRoot();
+    for (auto it = required.rbegin(), ie = required.rend(); it != ie; ++it) {
+        sliced.addConstraint(*it);
+    }
+    return sliced;
 }
 
 class IndependentSolver : public SolverImpl {
@@ -279,22 +295,22 @@ public:
 
 bool IndependentSolver::computeValidity(const Query &query, Validity &result) {
     std::vector<ref<Expr>> required;
-    IndependentElementSet eltsClosure = getIndependentConstraints(query, required);
-    ConstraintManager tmp(required);
+    getIndependentConstraints(query, required);
+    ConstraintManager tmp = getSlice(required);
     return solver->impl->computeValidity(Query(tmp, query.expr), result);
 }
 
 bool IndependentSolver::computeTruth(const Query &query, bool &isValid) {
     std::vector<ref<Expr>> required;
-    IndependentElementSet eltsClosure = getIndependentConstraints(query, required);
-    ConstraintManager tmp(required);
+    getIndependentConstraints(query, required);
+    ConstraintManager tmp = getSlice(required);
     return solver->impl->computeTruth(Query(tmp, query.expr), isValid);
 }
 
 bool IndependentSolver::computeValue(const Query &query, ref<Expr> &result) {
     std::vector<ref<Expr>> required;
-    IndependentElementSet eltsClosure = getIndependentConstraints(query, required);
-    ConstraintManager tmp(required);
+    getIndependentConstraints(query, required);
+    ConstraintManager tmp = getSlice(required);
     return solver->impl->computeValue(Query(tmp, query.expr), result);
 }
 
@@ -303,5 +319,51 @@ SolverPtr klee::createIndependentSolver(SolverPtr &s) {
 }
 
 void klee::getIndependentConstraintsForQuery(const Query &query, std::vector<ref<Expr>> &required) {
-    IndependentElementSet eltsClosure = getIndependentConstraints(query, required);
+    getIndependentConstraints(query, required);
+}
+
+bool klee::getIndependentInitialValues(Solver &solver, const ConstraintManager &constraints,
+                                       const ref<Expr> &condition, const ArrayVec &objects,
+                                       std::vector<std::vector<unsigned char>> &values) {
+    assert(objects.size() == values.size());
+
+    std::vector<ref<Expr>> required;
+    IndependentElementSet eltsClosure;
+    getIndependentConstraints(Query(constraints, condition), required, &eltsClosure);
+
+    ConstraintManager sliced = getSlice(required);
+    sliced.addConstraint(condition);
+
+    ArrayVec clusterObjects;
+    std::vector<unsigned> clusterIndices;
+    for (unsigned i = 0; i < objects.size(); ++i) {
+        if (eltsClosure.isWholeObject(objects[i]) || eltsClosure.getElements(objects[i])) {
+            clusterObjects.push_back(objects[i]);
+            clusterIndices.push_back(i);
+        }
+    }
+
+    std::vector<std::vector<unsigned char>> clusterValues;
+    if (!solver.getInitialValues(Query(sliced, ConstantExpr::alloc(0, Expr::Bool)), clusterObjects, clusterValues)) {
+        return false;
+    }
+
+    // Bytes outside of the closure are not constrained by the slice, they keep
+    // the value they had, which satisfies the remaining constraints.
+    for (unsigned i = 0; i < clusterObjects.size(); ++i) {
+        auto &value = values[clusterIndices[i]];
+        const auto &newValue = clusterValues[i];
+        if (eltsClosure.isWholeObject(clusterObjects[i])) {
+            value = newValue;
+            continue;
+        }
+
+        for (auto offset : *eltsClosure.getElements(clusterObjects[i])) {
+            if (offset < value.size() && offset < newValue.size()) {
+                value[offset] = newValue[offset];
+            }
+        }
+    }
+
+    return true;
 }
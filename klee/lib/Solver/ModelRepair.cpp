@@ -0,0 +1,143 @@
+//===-- ModelRepair.cpp ---------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/SolverStats.h"
+#include "klee/util/Assignment.h"
+#include "klee/util/ExprUtil.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+using namespace klee;
+
+namespace {
+// Conditions over more bytes than this are left to the solver
+const unsigned MAX_REPAIR_BYTES = 16;
+
+const unsigned MAX_REPAIR_DELTA = 4;
+
+struct RepairByte {
+    unsigned object;
+    unsigned offset;
+
+    bool operator==(const RepairByte &b) const {
+        return object == b.object && offset == b.offset;
+    }
+};
+
+// Mutations tried on each byte, cheapest to explain first
+std::vector<uint8_t> getCandidates(uint8_t value) {
+    std::vector<uint8_t> ret;
+    for (unsigned bit = 0; bit < 8; ++bit) {
+        ret.push_back(value ^ (1 << bit));
+    }
+    for (unsigned delta = 1; delta <= MAX_REPAIR_DELTA; ++delta) {
+        ret.push_back(value + delta);
+        ret.push_back(value - delta);
+    }
+    ret.push_back(0);
+    ret.push_back(0xff);
+    return ret;
+}
+} // namespace
+
+bool klee::repairInitialValues(const ConstraintManager &constraints, const ref<Expr> &condition,
+                               const ArrayVec &objects, std::vector<std::vector<unsigned char>> &values) {
+    assert(objects.size() == values.size());
+
+    std::unordered_map<const Array *, unsigned> objectIndex;
+    for (unsigned i = 0; i < objects.size(); ++i) {
+        objectIndex[objects[i].get()] = i;
+    }
+
+    // Bytes the condition depends on
+    std::vector<ref<ReadExpr>> reads;
+    findReads(condition, /* visitUpdates= */ true, reads);
+
+    std::vector<RepairByte> bytes;
+    for (const auto &re : reads) {
+        auto &array = re->getUpdates()->getRoot();
+        if (array->isConstantArray() && !re->getUpdates()->getHead()) {
+            continue;
+        }
+
+        // Symbolic offsets may depend on any byte
+        auto ce = dyn_cast<ConstantExpr>(re->getIndex());
+        auto it = objectIndex.find(array.get());
+        if (!ce || it == objectIndex.end()) {
+            return false;
+        }
+
+        RepairByte byte = {it->second, (unsigned) ce->getZExtValue(32)};
+        if (byte.offset >= values[byte.object].size()) {
+            return false;
+        }
+
+        if (std::find(bytes.begin(), bytes.end(), byte) == bytes.end()) {
+            bytes.push_back(byte);
+        }
+    }
+
+    if (bytes.empty() || bytes.size() > MAX_REPAIR_BYTES) {
+        return false;
+    }
+
+    // Only the constraints that share bytes with the condition can be
+    // affected by the mutations, the others still hold.
+    std::vector<ref<Expr>> required;
+    getIndependentConstraintsForQuery(Query(constraints, condition), required);
+
+    auto assignment = Assignment::create();
+    for (unsigned i = 0; i < objects.size(); ++i) {
+        assignment->add(objects[i], values[i]);
+    }
+
+    auto satisfies = [&]() {
+        assignment->expressionCache.clear();
+        assignment->updateListCache.clear();
+
+        CachedAssignmentEvaluator evaluator(*assignment);
+        auto ce = dyn_cast<ConstantExpr>(evaluator.visit(condition));
+        if (!ce || !ce->isTrue()) {
+            return false;
+        }
+
+        for (const auto &e : required) {
+            ce = dyn_cast<ConstantExpr>(evaluator.visit(e));
+            if (!ce || !ce->isTrue()) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    for (const auto &byte : bytes) {
+        auto &value = assignment->bindings[objects[byte.object]][byte.offset];
+        uint8_t original = value;
+
+        for (auto candidate : getCandidates(original)) {
+            value = candidate;
+            if (satisfies()) {
+                values[byte.object][byte.offset] = candidate;
+                ++stats::queryModelRepairs;
+                return true;
+            }
+        }
+
+        value = original;
+    }
+
+    return false;
+}
@@ -0,0 +1,464 @@
+//===-- PersistentCachingSolver.cpp ---------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include <klee/Common.h>
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
+#include "klee/util/BoundedExprHashMap.h"
+#include "klee/util/ExprPPrinter.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include <array>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace klee;
+
+///
+/// Query cache stored in a file shared by all the instances running on the host.
+///
+/// The file is a header followed by records. Each record is the digest of a
+/// query, the kind of query, its result and a checksum of all of them. Writers
+/// append records under an exclusive flock, one write per record, and index
+/// their own records without mapping them. Readers map the file and index the
+/// records of the other instances whenever a lookup misses. The first
+/// incomplete or corrupted record ends the scan, and the next writer truncates
+/// the file there before appending.
+///
+/// The digest of a query is the SHA1 of the digests of its constraints and of
+/// its expression, each being the SHA1 of the kquery serialization of that
+/// expression. Constraints are shared by many queries, so their digests are
+/// cached rather than serializing the whole query every time. Array names are
+/// part of the serialization, so results are only reused for queries over the
+/// same symbolic variables, as when re-running a target.
+///
+
+namespace {
+
+const uint32_t PQC_MAGIC = 0x43515053;        /* "SPQC" */
+const uint32_t PQC_RECORD_MAGIC = 0x44524351; /* "QCRD" */
+const uint32_t PQC_VERSION = 3;
+
+enum PersistentQueryKind : uint32_t { PQC_VALIDITY, PQC_TRUTH, PQC_VALUE, PQC_INITIAL_VALUES };
+
+typedef std::array<uint8_t, 20> QueryDigest;
+
+struct PersistentCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct PersistentCacheRecord {
+    uint32_t magic;
+    uint32_t kind;
+    QueryDigest digest;
+    uint32_t size;     // of the result that follows
+    uint32_t checksum; // of the record with this field set to 0 and of the result
+};
+
+static uint32_t getRecordChecksum(PersistentCacheRecord rec, const uint8_t *result) {
+    rec.checksum = 0;
+    uint64_t hash = llvm::xxHash64(llvm::ArrayRef<uint8_t>((const uint8_t *) &rec, sizeof(rec)));
+    hash ^= llvm::xxHash64(llvm::ArrayRef<uint8_t>(result, rec.size)) * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+struct QueryDigestHash {
+    size_t operator()(const QueryDigest &d) const {
+        size_t ret;
+        memcpy(&ret, d.data(), sizeof(ret));
+        return ret;
+    }
+};
+
+class PersistentQueryCache {
+    int m_fd;
+    const uint8_t *m_base;
+    size_t m_mapped;
+    size_t m_indexed;
+
+    // Offset of the result of each known query
+    typedef std::unordered_map<QueryDigest, size_t, QueryDigestHash> index_t;
+    index_t m_index[PQC_INITIAL_VALUES + 1];
+
+    // Results of the records appended by this instance past the mapped part of the file
+    std::unordered_map<size_t, std::vector<uint8_t>> m_appended;
+
+    void update() {
+        struct stat st;
+        if (fstat(m_fd, &st) < 0 || (size_t) st.st_size <= m_indexed) {
+            return;
+        }
+
+        if ((size_t) st.st_size != m_mapped) {
+            if (m_base) {
+                munmap(const_cast<uint8_t *>(m_base), m_mapped);
+            }
+
+            void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+            if (base == MAP_FAILED) {
+                m_base = nullptr;
+                m_mapped = 0;
+                m_indexed = sizeof(PersistentCacheHeader);
+                for (auto &index : m_index) {
+                    index.clear();
+                }
+                m_appended.clear();
+                return;
+            }
+
+            m_base = static_cast<const uint8_t *>(base);
+            m_mapped = st.st_size;
+
+            // The records appended by this instance are mapped now
+            m_appended.clear();
+        }
+
+        while (m_mapped > m_indexed && m_mapped - m_indexed >= sizeof(PersistentCacheRecord)) {
+            PersistentCacheRecord rec;
+            memcpy(&rec, m_base + m_indexed, sizeof(rec));
+            size_t size = sizeof(rec) + rec.size;
+            if (rec.magic != PQC_RECORD_MAGIC || rec.kind > PQC_INITIAL_VALUES || m_mapped - m_indexed < size ||
+                rec.checksum != getRecordChecksum(rec, m_base + m_indexed + sizeof(rec))) {
+                break;
+            }
+
+            m_index[rec.kind][rec.digest] = m_indexed + sizeof(rec);
+            m_indexed += size;
+        }
+    }
+
+public:
+    PersistentQueryCache() : m_fd(-1), m_base(nullptr), m_mapped(0), m_indexed(sizeof(PersistentCacheHeader)) {
+    }
+
+    ~PersistentQueryCache() {
+        if (m_base) {
+            munmap(const_cast<uint8_t *>(m_base), m_mapped);
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    bool open(const std::string &path) {
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (m_fd < 0) {
+            return false;
+        }
+
+        PersistentCacheHeader hdr = {PQC_MAGIC, PQC_VERSION};
+
+        flock(m_fd, LOCK_EX);
+        struct stat st;
+        bool ok = fstat(m_fd, &st) == 0;
+        if (ok && st.st_size == 0) {
+            ok = write(m_fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+        } else if (ok) {
+            PersistentCacheHeader cur;
+            ok = pread(m_fd, &cur, sizeof(cur), 0) == sizeof(cur) && cur.magic == hdr.magic &&
+                 cur.version == hdr.version;
+        }
+        flock(m_fd, LOCK_UN);
+
+        if (!ok) {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+
+        update();
+        return true;
+    }
+
+    bool lookup(PersistentQueryKind kind, const QueryDigest &digest, const uint8_t *&result, size_t &size) {
+        auto it = m_index[kind].find(digest);
+        if (it == m_index[kind].end()) {
+            update();
+            it = m_index[kind].find(digest);
+            if (it == m_index[kind].end()) {
+                return false;
+            }
+        }
+
+        auto ait = m_appended.find(it->second);
+        if (ait != m_appended.end()) {
+            result = ait->second.data();
+            size = ait->second.size();
+            return true;
+        }
+
+        PersistentCacheRecord rec;
+        memcpy(&rec, m_base + it->second - sizeof(rec), sizeof(rec));
+        result = m_base + it->second;
+        size = rec.size;
+        return true;
+    }
+
+    void insert(PersistentQueryKind kind, const QueryDigest &digest, const std::vector<uint8_t> &result) {
+        PersistentCacheRecord rec;
+        rec.magic = PQC_RECORD_MAGIC;
+        rec.kind = kind;
+        rec.digest = digest;
+        rec.size = result.size();
+        rec.checksum = getRecordChecksum(rec, result.data());
+
+        std::vector<uint8_t> buffer(sizeof(rec) + result.size());
+        memcpy(buffer.data(), &rec, sizeof(rec));
+        if (!result.empty()) {
+            memcpy(buffer.data() + sizeof(rec), result.data(), result.size());
+        }
+
+        flock(m_fd, LOCK_EX);
+
+        // Records past the last valid one were torn by a writer that crashed,
+        // they would hide the new record from the readers
+        update();
+        struct stat st;
+        if (fstat(m_fd, &st) < 0 || ((size_t) st.st_size > m_indexed && ftruncate(m_fd, m_indexed) < 0)) {
+            flock(m_fd, LOCK_UN);
+            return;
+        }
+
+        const uint8_t *ptr = buffer.data();
+        size_t left = buffer.size();
+        while (left > 0) {
+            ssize_t ret = write(m_fd, ptr, left);
+            if (ret <= 0) {
+                break;
+            }
+            ptr += ret;
+            left -= ret;
+        }
+
+        // Do not leave a partial record behind
+        if (left > 0) {
+            if (ftruncate(m_fd, m_indexed) < 0) {
+                *klee_warning_stream << "Could not truncate the persistent solver cache\n";
+            }
+        } else {
+            // The file now ends with this record, the next update maps it only
+            // if other instances appended records after it
+            m_index[kind][digest] = m_indexed + sizeof(rec);
+            m_appended[m_indexed + sizeof(rec)] = result;
+            m_indexed += buffer.size();
+        }
+
+        flock(m_fd, LOCK_UN);
+    }
+};
+
+class PersistentCachingSolver : public SolverImpl {
+private:
+    static const size_t EXPR_DIGEST_CACHE_SIZE = 1 << 16;
+
+    SolverPtr solver;
+    PersistentQueryCache cache;
+
+    // Digests of the constraints of the recent queries
+    BoundedExprHashMap<QueryDigest> exprDigests;
+
+    PersistentCachingSolver(SolverPtr _solver) : solver(_solver), exprDigests(EXPR_DIGEST_CACHE_SIZE) {
+    }
+
+    // The serialization has the declarations of the arrays that e reads
+    QueryDigest getExprDigest(const ref<Expr> &e) {
+        if (auto digest = exprDigests.find(e)) {
+            return *digest;
+        }
+
+        std::string str;
+        llvm::raw_string_ostream os(str);
+        ConstraintManager empty;
+        std::vector<ref<Expr>> evalExprs;
+        ArrayVec evalArrays;
+        ExprPPrinter::printQuery(os, empty, e, evalExprs.begin(), evalExprs.end(), evalArrays.begin(),
+                                 evalArrays.end(), true);
+        os.flush();
+
+        auto digest = llvm::SHA1::hash(llvm::ArrayRef<uint8_t>((const uint8_t *) str.data(), str.size()));
+        exprDigests.insert(e, digest);
+        return digest;
+    }
+
+    QueryDigest getDigest(const Query &query, const ArrayVec &objects = ArrayVec()) {
+        llvm::SHA1 sha1;
+        for (auto it = query.constraints.begin(), ie = query.constraints.end(); it != ie; ++it) {
+            sha1.update(getExprDigest(*it));
+        }
+        sha1.update(getExprDigest(query.expr));
+
+        for (const auto &array : objects) {
+            uint32_t sizes[2] = {(uint32_t) array->getName().size(), array->getSize()};
+            sha1.update(llvm::ArrayRef<uint8_t>((const uint8_t *) sizes, sizeof(sizes)));
+            sha1.update(array->getName());
+        }
+
+        QueryDigest digest;
+        auto result = sha1.final();
+        memcpy(digest.data(), result.data(), digest.size());
+        return digest;
+    }
+
+    bool lookup(PersistentQueryKind kind, const QueryDigest &digest, const uint8_t *&result, size_t &size) {
+        if (cache.lookup(kind, digest, result, size)) {
+            ++stats::queryPersistentCacheHits;
+            return true;
+        }
+        ++stats::queryPersistentCacheMisses;
+        return false;
+    }
+
+public:
+    bool computeValidity(const Query &query, Validity &result) {
+        auto digest = getDigest(query);
+        const uint8_t *data;
+        size_t size;
+        if (lookup(PQC_VALIDITY, digest, data, size) && size == 1) {
+            int8_t validity = data[0];
+            if (validity == True || validity == False || validity == Unknown) {
+                result = (Validity) validity;
+                return true;
+            }
+        }
+
+        if (!solver->impl->computeValidity(query, result)) {
+            return false;
+        }
+
+        cache.insert(PQC_VALIDITY, digest, std::vector<uint8_t>(1, (uint8_t)(int8_t) result));
+        return true;
+    }
+
+    bool computeTruth(const Query &query, bool &isValid) {
+        auto digest = getDigest(query);
+        const uint8_t *data;
+        size_t size;
+        if (lookup(PQC_TRUTH, digest, data, size) && size == 1 && data[0] <= 1) {
+            isValid = data[0];
+            return true;
+        }
+
+        if (!solver->impl->computeTruth(query, isValid)) {
+            return false;
+        }
+
+        cache.insert(PQC_TRUTH, digest, std::vector<uint8_t>(1, isValid));
+        return true;
+    }
+
+    bool computeValue(const Query &query, ref<Expr> &result) {
+        // Values are stored as a 64-bit integer
+        if (query.expr->getWidth() > 64) {
+            return solver->impl->computeValue(query, result);
+        }
+
+        auto digest = getDigest(query);
+        const uint8_t *data;
+        size_t size;
+        if (lookup(PQC_VALUE, digest, data, size) && size == sizeof(uint64_t)) {
+            uint64_t value;
+            memcpy(&value, data, sizeof(value));
+            result = ConstantExpr::create(value, query.expr->getWidth());
+            return true;
+        }
+
+        if (!solver->impl->computeValue(query, result)) {
+            return false;
+        }
+
+        auto ce = dyn_cast<ConstantExpr>(result);
+        if (ce) {
+            uint64_t value = ce->getZExtValue();
+            std::vector<uint8_t> buffer(sizeof(value));
+            memcpy(buffer.data(), &value, sizeof(value));
+            cache.insert(PQC_VALUE, digest, buffer);
+        }
+        return true;
+    }
+
+    // The result is the solution flag followed by the values of each object,
+    // whose sizes are given by the declarations in the query.
+    bool computeInitialValues(const Query &query, const ArrayVec &objects,
+                              std::vector<std::vector<unsigned char>> &values, bool &hasSolution) {
+        auto digest = getDigest(query, objects);
+        const uint8_t *data;
+        size_t size;
+        if (lookup(PQC_INITIAL_VALUES, digest, data, size) && size >= 1 && data[0] <= 1) {
+            size_t expected = 1;
+            if (data[0]) {
+                for (const auto &array : objects) {
+                    expected += array->getSize();
+                }
+            }
+
+            if (size == expected) {
+                hasSolution = data[0];
+                values.clear();
+                if (hasSolution) {
+                    const uint8_t *ptr = data + 1;
+                    for (const auto &array : objects) {
+                        values.emplace_back(ptr, ptr + array->getSize());
+                        ptr += array->getSize();
+                    }
+                }
+                return true;
+            }
+        }
+
+        if (!solver->impl->computeInitialValues(query, objects, values, hasSolution)) {
+            return false;
+        }
+
+        std::vector<uint8_t> buffer(1, hasSolution);
+        if (hasSolution) {
+            for (unsigned i = 0; i < objects.size(); ++i) {
+                if (values[i].size() != objects[i]->getSize()) {
+                    return true;
+                }
+                buffer.insert(buffer.end(), values[i].begin(), values[i].end());
+            }
+        }
+
+        cache.insert(PQC_INITIAL_VALUES, digest, buffer);
+        return true;
+    }
+
+    static SolverImplPtr create(SolverPtr &s, const std::string &path) {
+        auto ret = new PersistentCachingSolver(s);
+        if (!ret->cache.open(path)) {
+            *klee_warning_stream << "Could not open persistent solver cache " << path << "\n";
+            delete ret;
+            return nullptr;
+        }
+        return SolverImplPtr(ret);
+    }
+};
+} // namespace
+
+SolverPtr klee::createPersistentCachingSolver(SolverPtr &s, const std::string &path) {
+    auto impl = PersistentCachingSolver::create(s, path);
+    if (!impl) {
+        return s;
+    }
+    return Solver::create(impl);
+}
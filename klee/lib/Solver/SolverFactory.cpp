@@ -53,6 +53,10 @@ cl::opt<SolverIncrementalityType> SolverIncrementality(
                clEnumValN(INCREMENTAL_ASSUMPTIONS, "assumptions", "Assumption-based incrementality")),
     cl::init(INCREMENTAL_NONE));
 
+cl::opt<bool> UseSolverPortfolio("end-solver-portfolio", cl::init(false),
+                                 cl::desc("Race several configurations of the end solver on each query "
+                                          "(see -z3-portfolio-configs)"));
+
 // The counter example cache may have bad interactions with
 // concolic mode. Disabled by default.
 cl::opt<bool> UseCexCache("use-cex-cache", cl::init(false), cl::desc("Use counterexample caching"));
@@ -93,6 +97,11 @@ cl::opt<bool> UseFastCexSolver("use-fast-cex-solver", cl::init(false));
 
 cl::opt<bool> UseCache("use-cache", cl::init(true), cl::desc("Use validity caching"));
 
+cl::opt<std::string> PersistentSolverCache("persistent-solver-cache",
+                                           cl::desc("File in which the results of solver queries are kept across "
+                                                    "runs and shared between instances (default: none)"),
+                                           cl::init(""));
+
 cl::opt<bool> UseIndependentSolver("use-independent-solver", cl::init(true), cl::desc("Use constraint independence"));
 
 cl::opt<bool> DebugValidateSolver("debug-validate-solver", cl::init(false));
@@ -113,6 +122,10 @@ std::filesystem::path DefaultSolverFactory::getOutputFileName(const std::string
 SolverPtr DefaultSolverFactory::createEndSolver() {
     if (EndSolver == SOLVER_Z3) {
 #ifdef ENABLE_Z3
+        if (UseSolverPortfolio) {
+            return Z3Solver::createPortfolioSolver();
+        }
+
         switch (SolverIncrementality) {
             case INCREMENTAL_NONE:
                 return Z3Solver::createResetSolver();
@@ -128,9 +141,22 @@ SolverPtr DefaultSolverFactory::createEndSolver() {
     return NULL;
 }
 
+AsyncSolverPtr DefaultSolverFactory::createAsyncSolver() {
+#ifdef ENABLE_Z3
+    if (EndSolver == SOLVER_Z3) {
+        return createZ3AsyncSolver();
+    }
+#endif
+    return nullptr;
+}
+
 SolverPtr DefaultSolverFactory::decorateSolver(SolverPtr &end_solver) {
     SolverPtr solver = end_solver;
 
+    if (!PersistentSolverCache.empty()) {
+        solver = createPersistentCachingSolver(solver, PersistentSolverCache);
+    }
+
     if (queryLoggingOptions.isSet(SOLVER_KQUERY)) {
         solver =
             createKQueryLoggingSolver(solver, getOutputFileName(SOLVER_QUERIES_KQUERY_FILE_NAME), MinQueryTimeToLog);
@@ -152,9 +178,9 @@ SolverPtr DefaultSolverFactory::decorateSolver(SolverPtr &end_solver) {
         solver = createCachingSolver(solver);
     }
 
-    // FIXME: The check should be more generic (e.g., enable only for
-    // non-incremental solvers)
-    if (UseIndependentSolver && (EndSolver != SOLVER_Z3)) {
+    // Slicing the constraints defeats the prefix sharing of the incremental
+    // solvers, the executor slices fork queries itself for them.
+    if (UseIndependentSolver && (EndSolver != SOLVER_Z3 || SolverIncrementality == INCREMENTAL_NONE)) {
         solver = createIndependentSolver(solver);
     }
 
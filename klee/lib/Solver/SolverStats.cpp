@@ -17,7 +17,17 @@ Statistic stats::queriesInvalid("QueriesInvalid", "Qiv");
 Statistic stats::queriesValid("QueriesValid", "Qv");
 Statistic stats::queryCacheHits("QueryCacheHits", "QChits");
 Statistic stats::queryCacheMisses("QueryCacheMisses", "QCmisses");
+Statistic stats::queryPersistentCacheHits("QueryPersistentCacheHits", "QPChits");
+Statistic stats::queryPersistentCacheMisses("QueryPersistentCacheMisses", "QPCmisses");
 Statistic stats::queryConstructTime("QueryConstructTime", "QBtime");
 Statistic stats::queryConstructs("QueriesConstructs", "QB");
 Statistic stats::queryCounterexamples("QueriesCEX", "Qcex");
+Statistic stats::queryModelRepairs("QueryModelRepairs", "Qrep");
+Statistic stats::queryPortfolioCancels("QueryPortfolioCancels", "QPcancels");
+Statistic stats::queryPortfolioWinsResetAsserts("QueryPortfolioWinsResetAsserts", "QPWra");
+Statistic stats::queryPortfolioWinsResetIte("QueryPortfolioWinsResetIte", "QPWri");
+Statistic stats::queryPortfolioWinsResetStores("QueryPortfolioWinsResetStores", "QPWrs");
+Statistic stats::queryPortfolioWinsStackAsserts("QueryPortfolioWinsStackAsserts", "QPWsa");
+Statistic stats::queryPortfolioWinsAssumptionsAsserts("QueryPortfolioWinsAssumptionsAsserts", "QPWaa");
+Statistic stats::queryPortfolioWinsBitblastIte("QueryPortfolioWinsBitblastIte", "QPWbi");
 Statistic stats::queryTime("QueryTime", "Qtime");
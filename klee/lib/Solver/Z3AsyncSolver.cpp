@@ -0,0 +1,217 @@
+//===-- Z3AsyncSolver.cpp -------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/AsyncSolver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Solver.h"
+#include "klee/util/ExprSMTLIBPrinter.h"
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <z3++.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace klee;
+
+namespace {
+
+class Z3AsyncSolver : public AsyncSolver {
+private:
+    struct Object {
+        std::string name;
+        unsigned size;
+        Expr::Width domain;
+        Expr::Width range;
+    };
+
+    struct Job {
+        Ticket ticket;
+        std::string query; // SMT-LIB
+        std::vector<Object> objects;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobsCv;
+    std::condition_variable m_resultsCv;
+    std::deque<Job> m_jobs;
+    std::deque<Result> m_results;
+    bool m_stop;
+
+    // Size of m_results, polled without the lock
+    std::atomic<unsigned> m_ready;
+
+    // Only used by the submitting thread
+    std::thread m_thread;
+    Ticket m_nextTicket;
+    unsigned m_pending;
+    ExprSMTLIBPrinter m_printer;
+
+    void work();
+    static void solve(z3::context &ctx, const Job &job, Result &result);
+
+public:
+    Z3AsyncSolver() : m_stop(false), m_ready(0), m_nextTicket(0), m_pending(0) {
+        m_printer.setHumanReadable(false);
+        m_printer.setAbbreviationMode(ExprSMTLIBPrinter::ABBR_LET);
+    }
+
+    ~Z3AsyncSolver() {
+        stop();
+    }
+
+    void stop() {
+        if (!m_thread.joinable()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_jobsCv.notify_all();
+        m_thread.join();
+
+        m_stop = false;
+    }
+
+    Ticket submit(const Query &query, const ArrayVec &objects) {
+        Job job;
+        job.ticket = m_nextTicket++;
+
+        Query q(query.constraints, ConstantExpr::alloc(0, Expr::Bool));
+        llvm::raw_string_ostream os(job.query);
+        m_printer.setOutput(os);
+        m_printer.setQuery(q);
+        m_printer.generateOutput();
+        os.flush();
+
+        for (const auto &array : objects) {
+            job.objects.push_back({array->getName(), array->getSize(), array->getDomain(), array->getRange()});
+        }
+
+        // Start the thread on first use, most runs never fork asynchronously
+        if (!m_thread.joinable()) {
+            m_thread = std::thread(&Z3AsyncSolver::work, this);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(std::move(job));
+        }
+        m_jobsCv.notify_one();
+
+        ++m_pending;
+        return m_nextTicket - 1;
+    }
+
+    bool getResult(Result &result, bool wait) {
+        if (!m_pending || (!wait && !m_ready)) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (wait) {
+            m_resultsCv.wait(lock, [this] { return !m_results.empty(); });
+        } else if (m_results.empty()) {
+            return false;
+        }
+
+        result = std::move(m_results.front());
+        m_results.pop_front();
+        --m_ready;
+        --m_pending;
+        return true;
+    }
+
+    unsigned pending() const {
+        return m_pending;
+    }
+};
+
+void Z3AsyncSolver::work() {
+    z3::context ctx;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_jobsCv.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+        if (m_stop) {
+            return;
+        }
+
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+
+        Result result;
+        solve(ctx, job, result);
+
+        lock.lock();
+        m_results.push_back(std::move(result));
+        ++m_ready;
+        m_resultsCv.notify_all();
+    }
+}
+
+void Z3AsyncSolver::solve(z3::context &ctx, const Job &job, Result &result) {
+    result.ticket = job.ticket;
+    result.success = false;
+    result.hasSolution = false;
+
+    try {
+        z3::solver solver(ctx, "QF_ABV");
+        solver.add(ctx.parse_string(job.query.c_str()));
+
+        switch (solver.check()) {
+            case z3::unknown:
+                return;
+            case z3::unsat:
+                result.success = true;
+                return;
+            case z3::sat:
+                break;
+        }
+
+        // Declarations are identified by name and sort, so this refers to the
+        // arrays of the query. Arrays absent from it get arbitrary values.
+        z3::model model = solver.get_model();
+        for (const auto &object : job.objects) {
+            auto sort = ctx.array_sort(ctx.bv_sort(object.domain), ctx.bv_sort(object.range));
+            auto array = ctx.constant(object.name.c_str(), sort);
+
+            std::vector<unsigned char> data;
+            data.reserve(object.size);
+            for (unsigned offset = 0; offset < object.size; ++offset) {
+                auto value = model.eval(z3::select(array, ctx.bv_val(offset, object.domain)), true);
+                unsigned num;
+                if (!Z3_get_numeral_uint(ctx, value, &num)) {
+                    return;
+                }
+                data.push_back((unsigned char) num);
+            }
+            result.values.push_back(std::move(data));
+        }
+
+        result.hasSolution = true;
+        result.success = true;
+    } catch (z3::exception &) {
+        // Let the caller solve the query itself
+        result.values.clear();
+    }
+}
+} // namespace
+
+AsyncSolverPtr klee::createZ3AsyncSolver() {
+    return AsyncSolverPtr(new Z3AsyncSolver());
+}
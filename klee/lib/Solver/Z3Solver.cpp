@@ -47,8 +47,13 @@
 
 #include <z3++.h>
 
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <list>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 using namespace llvm;
 using boost::scoped_ptr;
@@ -68,19 +73,62 @@ cl::opt<unsigned> AssumptionResetThreshold("z3-assum-reset-thrs",
 
 cl::opt<bool> DebugSolverStack("z3-debug-solver-stack", cl::desc("Print debug messages when solver stack is modified"),
                                cl::init(false));
+
+enum Z3PortfolioConfig {
+    Z3_PORTFOLIO_RESET_ASSERTS,
+    Z3_PORTFOLIO_RESET_ITE,
+    Z3_PORTFOLIO_RESET_STORES,
+    Z3_PORTFOLIO_STACK_ASSERTS,
+    Z3_PORTFOLIO_ASSUMPTIONS_ASSERTS,
+    Z3_PORTFOLIO_BITBLAST_ITE
+};
+
+cl::list<Z3PortfolioConfig> PortfolioConfigs(
+    "z3-portfolio-configs", cl::desc("Solver configurations raced by the portfolio solver (default: all)"),
+    cl::values(clEnumValN(Z3_PORTFOLIO_RESET_ASSERTS, "reset-asserts", "No incrementality, array assertions"),
+               clEnumValN(Z3_PORTFOLIO_RESET_ITE, "reset-ite", "No incrementality, if-then-else arrays"),
+               clEnumValN(Z3_PORTFOLIO_RESET_STORES, "reset-stores", "No incrementality, nested stores"),
+               clEnumValN(Z3_PORTFOLIO_STACK_ASSERTS, "stack-asserts", "Stack incrementality, array assertions"),
+               clEnumValN(Z3_PORTFOLIO_ASSUMPTIONS_ASSERTS, "assumptions-asserts",
+                          "Assumption incrementality, array assertions"),
+               clEnumValN(Z3_PORTFOLIO_BITBLAST_ITE, "bitblast-ite",
+                          "No incrementality, if-then-else arrays, bit-blasting tactic")),
+    cl::CommaSeparated);
+
+cl::opt<unsigned> PortfolioThreads("z3-portfolio-threads",
+                                   cl::desc("Number of threads of the portfolio solver (default: one per "
+                                            "configuration, up to the number of cores)"),
+                                   cl::init(0));
 } // namespace
 
 namespace klee {
 
-class Z3BaseSolverImpl : public SolverImpl {
+// Answers truth and value queries with counterexamples
+class Z3CexSolverImpl : public SolverImpl {
 public:
-    virtual ~Z3BaseSolverImpl();
-
     bool computeTruth(const Query &, bool &isValid);
     bool computeValue(const Query &, ref<Expr> &result);
+};
+
+class Z3BaseSolverImpl : public Z3CexSolverImpl {
+    friend class Z3PortfolioSolverImpl;
+
+public:
+    virtual ~Z3BaseSolverImpl();
+
     bool computeInitialValues(const Query &query, const ArrayVec &objects,
                               std::vector<std::vector<unsigned char>> &values, bool &hasSolution);
 
+    void setArrayConsMode(Z3ArrayConsMode mode) {
+        array_mode_ = mode;
+    }
+
+    /// Comma-separated list of tactics applied in sequence instead of the
+    /// default solver
+    void setTactics(const std::string &tactics) {
+        tactics_ = tactics;
+    }
+
     void initializeSolver();
 
 protected:
@@ -88,9 +136,21 @@ protected:
 
     virtual void createBuilderCache() = 0;
 
-    virtual z3::check_result check(const Query &) = 0;
+    // Constructs the query in the solver. This is the only step that
+    // touches the expressions of the query.
+    virtual void prepare(const Query &) = 0;
+
+    virtual z3::check_result solve() {
+        return solver_.check();
+    }
+
     virtual void postCheck(const Query &) = 0;
 
+    z3::check_result check(const Query &query) {
+        prepare(query);
+        return solve();
+    }
+
     void extractModel(const ArrayVec &objects, std::vector<std::vector<unsigned char>> &values);
 
     void push() {
@@ -114,6 +174,9 @@ protected:
     scoped_ptr<Z3BuilderCache> builder_cache_;
     scoped_ptr<Z3Builder> builder_;
 
+    Z3ArrayConsMode array_mode_;
+    std::string tactics_;
+
 private:
     void configureSolver();
     void createBuilder();
@@ -132,7 +195,7 @@ protected:
 
     virtual void createBuilderCache();
 
-    virtual z3::check_result check(const Query &);
+    virtual void prepare(const Query &);
     virtual void postCheck(const Query &);
 
     scoped_ptr<ConditionNodeList> last_constraints_;
@@ -152,7 +215,7 @@ public:
 protected:
     Z3ResetSolverImpl();
     virtual void createBuilderCache();
-    virtual z3::check_result check(const Query &);
+    virtual void prepare(const Query &);
     virtual void postCheck(const Query &);
 
 public:
@@ -170,7 +233,8 @@ public:
 protected:
     Z3AssumptionSolverImpl();
     virtual void createBuilderCache();
-    virtual z3::check_result check(const Query &);
+    virtual void prepare(const Query &);
+    virtual z3::check_result solve();
     virtual void postCheck(const Query &);
 
 private:
@@ -180,6 +244,7 @@ private:
 
     GuardMap guards_;
     uint64_t guard_counter_;
+    z3::expr_vector assumptions_;
 
 public:
     static Z3AssumptionSolverImplPtr create() {
@@ -187,6 +252,57 @@ public:
     }
 };
 
+///
+/// Races differently configured solvers on each query and keeps the first
+/// answer.
+///
+/// Expressions are not thread-safe, so the query is constructed in each
+/// solver on the calling thread. Only the checks run on the worker threads,
+/// each solver having its own context. The checks still running once a
+/// solver answered are interrupted.
+///
+class Z3PortfolioSolverImpl;
+using Z3PortfolioSolverImplPtr = std::shared_ptr<Z3PortfolioSolverImpl>;
+class Z3PortfolioSolverImpl : public Z3CexSolverImpl {
+public:
+    virtual ~Z3PortfolioSolverImpl();
+
+    bool computeInitialValues(const Query &query, const ArrayVec &objects,
+                              std::vector<std::vector<unsigned char>> &values, bool &hasSolution);
+
+private:
+    struct Member {
+        std::shared_ptr<Z3BaseSolverImpl> solver;
+        Statistic *wins;
+        z3::check_result result;
+        bool running;
+        bool interrupted;
+    };
+
+    Z3PortfolioSolverImpl();
+
+    void addMember(Z3PortfolioConfig config);
+    void work();
+
+    std::vector<Member> members_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+
+    // State of the current query, protected by mutex_
+    unsigned next_;
+    unsigned finished_;
+    int winner_;
+    bool stop_;
+
+public:
+    static Z3PortfolioSolverImplPtr create() {
+        return Z3PortfolioSolverImplPtr(new Z3PortfolioSolverImpl());
+    }
+};
+
 // Z3Solver ////////////////////////////////////////////////////////////////////
 
 Z3SolverPtr Z3Solver::createResetSolver() {
@@ -210,12 +326,16 @@ Z3SolverPtr Z3Solver::createAssumptionSolver() {
     return Z3Solver::create(impl);
 }
 
+Z3SolverPtr Z3Solver::createPortfolioSolver() {
+    return Z3Solver::create(Z3PortfolioSolverImpl::create());
+}
+
 Z3Solver::Z3Solver(SolverImplPtr &impl) : Solver(impl) {
 }
 
 // Z3BaseSolverImpl ////////////////////////////////////////////////////////////
 
-Z3BaseSolverImpl::Z3BaseSolverImpl() : solver_(context_, "QF_ABV") {
+Z3BaseSolverImpl::Z3BaseSolverImpl() : solver_(context_, "QF_ABV"), array_mode_(ArrayConsMode) {
 }
 
 Z3BaseSolverImpl::~Z3BaseSolverImpl() {
@@ -243,7 +363,7 @@ void Z3BaseSolverImpl::extractModel(const ArrayVec &objects, std::vector<std::ve
     }
 }
 
-bool Z3BaseSolverImpl::computeTruth(const Query &query, bool &isValid) {
+bool Z3CexSolverImpl::computeTruth(const Query &query, bool &isValid) {
     ArrayVec objects;
     std::vector<std::vector<unsigned char>> values;
     bool hasSolution;
@@ -256,7 +376,7 @@ bool Z3BaseSolverImpl::computeTruth(const Query &query, bool &isValid) {
 }
 
 // TODO: Use model evaluation in Z3
-bool Z3BaseSolverImpl::computeValue(const Query &query, ref<Expr> &result) {
+bool Z3CexSolverImpl::computeValue(const Query &query, ref<Expr> &result) {
     ArrayVec objects;
     std::vector<std::vector<unsigned char>> values;
     bool hasSolution;
@@ -302,6 +422,20 @@ bool Z3BaseSolverImpl::computeInitialValues(const Query &query, const ArrayVec &
 void Z3BaseSolverImpl::configureSolver() {
     (*klee_message_stream) << "[Z3] Initializing\n";
 
+    if (!tactics_.empty()) {
+        std::stringstream ss(tactics_);
+        std::string name;
+        std::unique_ptr<z3::tactic> tactic;
+        while (std::getline(ss, name, ',')) {
+            z3::tactic next(context_, name.c_str());
+            tactic.reset(tactic ? new z3::tactic(*tactic & next) : new z3::tactic(next));
+        }
+        if (tactic) {
+            solver_ = tactic->mk_solver();
+            return;
+        }
+    }
+
     Z3_param_descrs solver_params = Z3_solver_get_param_descrs(context_, solver_);
     Z3_param_descrs_inc_ref(context_, solver_params);
 
@@ -317,7 +451,7 @@ void Z3BaseSolverImpl::configureSolver() {
 void Z3BaseSolverImpl::createBuilder() {
     assert(builder_cache_ && "The cache needs to be created first");
 
-    switch (ArrayConsMode) {
+    switch (array_mode_) {
         case Z3_ARRAY_ITE:
             builder_.reset(new Z3IteBuilder(context_, (Z3IteBuilderCache *) builder_cache_.get()));
             break;
@@ -344,7 +478,7 @@ Z3StackSolverImpl::Z3StackSolverImpl() : Z3BaseSolverImpl(), last_constraints_(n
 Z3StackSolverImpl::~Z3StackSolverImpl() {
 }
 
-z3::check_result Z3StackSolverImpl::check(const Query &query) {
+void Z3StackSolverImpl::prepare(const Query &query) {
     if (DebugSolverStack) {
         *klee_message_stream << "[Z3] query size " << query.constraints.size() << '\n';
     }
@@ -395,8 +529,6 @@ z3::check_result Z3StackSolverImpl::check(const Query &query) {
     // Note the negation, since we're checking for validity
     // (i.e., a counterexample)
     solver_.add(!builder_->construct(query.expr));
-
-    return solver_.check();
 }
 
 void Z3StackSolverImpl::postCheck(const Query &) {
@@ -404,7 +536,7 @@ void Z3StackSolverImpl::postCheck(const Query &) {
 }
 
 void Z3StackSolverImpl::createBuilderCache() {
-    switch (ArrayConsMode) {
+    switch (array_mode_) {
         case Z3_ARRAY_ITE:
             builder_cache_.reset(new Z3IteBuilderCacheNoninc());
             break;
@@ -425,7 +557,7 @@ Z3ResetSolverImpl::Z3ResetSolverImpl() : Z3BaseSolverImpl() {
 Z3ResetSolverImpl::~Z3ResetSolverImpl() {
 }
 
-z3::check_result Z3ResetSolverImpl::check(const Query &query) {
+void Z3ResetSolverImpl::prepare(const Query &query) {
     std::list<ConditionNodeRef> cur_constraints;
 
     for (ConditionNodeRef node = query.constraints.head(), root = query.constraints.root(); node != root;
@@ -439,7 +571,6 @@ z3::check_result Z3ResetSolverImpl::check(const Query &query) {
     }
 
     solver_.add(!builder_->construct(query.expr));
-    return solver_.check();
 }
 
 void Z3ResetSolverImpl::postCheck(const Query &) {
@@ -447,7 +578,7 @@ void Z3ResetSolverImpl::postCheck(const Query &) {
 }
 
 void Z3ResetSolverImpl::createBuilderCache() {
-    switch (ArrayConsMode) {
+    switch (array_mode_) {
         case Z3_ARRAY_ITE:
             builder_cache_.reset(new Z3IteBuilderCacheNoninc());
             break;
@@ -462,27 +593,30 @@ void Z3ResetSolverImpl::createBuilderCache() {
 
 // Z3AssumptionSolverImpl //////////////////////////////////////////////////////
 
-Z3AssumptionSolverImpl::Z3AssumptionSolverImpl() : Z3BaseSolverImpl(), guard_counter_(0) {
+Z3AssumptionSolverImpl::Z3AssumptionSolverImpl() : Z3BaseSolverImpl(), guard_counter_(0), assumptions_(context_) {
 }
 
 Z3AssumptionSolverImpl::~Z3AssumptionSolverImpl() {
 }
 
-z3::check_result Z3AssumptionSolverImpl::check(const Query &query) {
+void Z3AssumptionSolverImpl::prepare(const Query &query) {
     std::list<ConditionNodeRef> cur_constraints;
     for (ConditionNodeRef node = query.constraints.head(), root = query.constraints.root(); node != root;
          node = node->parent()) {
         cur_constraints.push_front(node);
     }
 
-    z3::expr_vector assumptions(context_);
+    assumptions_ = z3::expr_vector(context_);
 
     for (std::list<ConditionNodeRef>::iterator it = cur_constraints.begin(), ie = cur_constraints.end(); it != ie;
          ++it) {
-        assumptions.push_back(getAssumption((*it)->expr()));
+        assumptions_.push_back(getAssumption((*it)->expr()));
     }
-    assumptions.push_back(getAssumption(Expr::createIsZero(query.expr)));
-    return solver_.check(assumptions);
+    assumptions_.push_back(getAssumption(Expr::createIsZero(query.expr)));
+}
+
+z3::check_result Z3AssumptionSolverImpl::solve() {
+    return solver_.check(assumptions_);
 }
 
 void Z3AssumptionSolverImpl::postCheck(const Query &) {
@@ -513,7 +647,7 @@ z3::expr Z3AssumptionSolverImpl::getAssumption(ref<Expr> assertion) {
 }
 
 void Z3AssumptionSolverImpl::createBuilderCache() {
-    switch (ArrayConsMode) {
+    switch (array_mode_) {
         case Z3_ARRAY_ITE:
             builder_cache_.reset(new Z3IteBuilderCacheNoninc());
             break;
@@ -525,4 +659,186 @@ void Z3AssumptionSolverImpl::createBuilderCache() {
             break;
     }
 }
+
+// Z3PortfolioSolverImpl ///////////////////////////////////////////////////////
+
+Z3PortfolioSolverImpl::Z3PortfolioSolverImpl() : next_(0), finished_(0), winner_(-1), stop_(false) {
+    if (PortfolioConfigs.empty()) {
+        for (auto config : {Z3_PORTFOLIO_RESET_ASSERTS, Z3_PORTFOLIO_RESET_ITE, Z3_PORTFOLIO_RESET_STORES,
+                            Z3_PORTFOLIO_STACK_ASSERTS, Z3_PORTFOLIO_ASSUMPTIONS_ASSERTS, Z3_PORTFOLIO_BITBLAST_ITE}) {
+            addMember(config);
+        }
+    } else {
+        for (auto config : PortfolioConfigs) {
+            addMember(config);
+        }
+    }
+
+    unsigned threads = PortfolioThreads;
+    if (!threads) {
+        threads = std::min<unsigned>(members_.size(), std::max(1u, std::thread::hardware_concurrency()));
+    }
+
+    // No point in having more threads than solvers
+    threads = std::min<unsigned>(threads, members_.size());
+
+    *klee_message_stream << "[Z3] Portfolio of " << members_.size() << " solvers on " << threads << " threads\n";
+
+    // No query in progress
+    next_ = members_.size();
+
+    for (unsigned i = 0; i < threads; ++i) {
+        workers_.emplace_back(&Z3PortfolioSolverImpl::work, this);
+    }
+}
+
+Z3PortfolioSolverImpl::~Z3PortfolioSolverImpl() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+
+    for (auto &worker : workers_) {
+        worker.join();
+    }
+}
+
+void Z3PortfolioSolverImpl::addMember(Z3PortfolioConfig config) {
+    Member member;
+    member.result = z3::unknown;
+    member.running = false;
+    member.interrupted = false;
+
+    switch (config) {
+        case Z3_PORTFOLIO_RESET_ASSERTS:
+            member.solver = Z3ResetSolverImpl::create();
+            member.solver->setArrayConsMode(Z3_ARRAY_ASSERTS);
+            member.wins = &stats::queryPortfolioWinsResetAsserts;
+            break;
+        case Z3_PORTFOLIO_RESET_ITE:
+            member.solver = Z3ResetSolverImpl::create();
+            member.solver->setArrayConsMode(Z3_ARRAY_ITE);
+            member.wins = &stats::queryPortfolioWinsResetIte;
+            break;
+        case Z3_PORTFOLIO_RESET_STORES:
+            member.solver = Z3ResetSolverImpl::create();
+            member.solver->setArrayConsMode(Z3_ARRAY_STORES);
+            member.wins = &stats::queryPortfolioWinsResetStores;
+            break;
+        case Z3_PORTFOLIO_STACK_ASSERTS:
+            member.solver = Z3StackSolverImpl::create();
+            member.solver->setArrayConsMode(Z3_ARRAY_ASSERTS);
+            member.wins = &stats::queryPortfolioWinsStackAsserts;
+            break;
+        case Z3_PORTFOLIO_ASSUMPTIONS_ASSERTS:
+            member.solver = Z3AssumptionSolverImpl::create();
+            member.solver->setArrayConsMode(Z3_ARRAY_ASSERTS);
+            member.wins = &stats::queryPortfolioWinsAssumptionsAsserts;
+            break;
+        case Z3_PORTFOLIO_BITBLAST_ITE:
+            // The ite arrays are plain bitvectors, which the tactic can blast
+            member.solver = Z3ResetSolverImpl::create();
+            member.solver->setArrayConsMode(Z3_ARRAY_ITE);
+            member.solver->setTactics("simplify,solve-eqs,bit-blast,sat");
+            member.wins = &stats::queryPortfolioWinsBitblastIte;
+            break;
+    }
+
+    member.solver->initializeSolver();
+    members_.push_back(member);
+}
+
+void Z3PortfolioSolverImpl::work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        work_cv_.wait(lock, [this] { return stop_ || next_ < members_.size(); });
+        if (stop_) {
+            return;
+        }
+
+        auto &member = members_[next_++];
+        member.result = z3::unknown;
+
+        // Skip the solvers that did not start before the query was answered
+        if (winner_ < 0) {
+            member.running = true;
+            lock.unlock();
+            auto result = member.solver->solve();
+            lock.lock();
+            member.running = false;
+            member.result = result;
+
+            if (result != z3::unknown && winner_ < 0) {
+                winner_ = &member - &members_[0];
+            }
+        }
+
+        ++finished_;
+        done_cv_.notify_all();
+    }
+}
+
+bool Z3PortfolioSolverImpl::computeInitialValues(const Query &query, const ArrayVec &objects,
+                                                 std::vector<std::vector<unsigned char>> &values,
+                                                 bool &hasSolution) {
+    ++stats::queries;
+    ++stats::queryCounterexamples;
+
+    for (auto &member : members_) {
+        member.solver->prepare(query);
+        member.interrupted = false;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    next_ = 0;
+    finished_ = 0;
+    winner_ = -1;
+    work_cv_.notify_all();
+
+    while (finished_ < members_.size()) {
+        if (winner_ < 0) {
+            done_cv_.wait(lock, [this] { return winner_ >= 0 || finished_ == members_.size(); });
+            continue;
+        }
+
+        // A check may be about to start when it is interrupted, which would
+        // then be lost, so keep interrupting until the losers are done.
+        for (auto &member : members_) {
+            if (member.running) {
+                member.solver->context_.interrupt();
+                if (!member.interrupted) {
+                    member.interrupted = true;
+                    ++stats::queryPortfolioCancels;
+                }
+            }
+        }
+
+        done_cv_.wait_for(lock, std::chrono::milliseconds(1));
+    }
+
+    int winner = winner_;
+    lock.unlock();
+
+    bool ret = winner >= 0;
+    if (ret) {
+        auto &member = members_[winner];
+        ++*member.wins;
+
+        hasSolution = member.result == z3::sat;
+        if (hasSolution) {
+            member.solver->extractModel(objects, values);
+            ++stats::queriesInvalid;
+        } else {
+            ++stats::queriesValid;
+        }
+    }
+
+    for (auto &member : members_) {
+        member.solver->postCheck(query);
+    }
+
+    return ret;
+}
 } // namespace klee
@@ -20,13 +20,85 @@
 /// SOFTWARE.
 ///
 
+#include <linux/mempolicy.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <llvm/Support/CommandLine.h>
+
 #include <klee/util/PagePool.h>
 
+using namespace llvm;
+
+namespace {
+enum PagePoolBackend { PAGE_POOL_DEFAULT, PAGE_POOL_THP, PAGE_POOL_HUGETLB };
+
+cl::opt<PagePoolBackend>
+    Backend("page-pool-backend", cl::desc("Memory backing the pages of concrete buffers"),
+            cl::values(clEnumValN(PAGE_POOL_DEFAULT, "default", "Regular pages"),
+                       clEnumValN(PAGE_POOL_THP, "thp", "Transparent hugepages"),
+                       clEnumValN(PAGE_POOL_HUGETLB, "hugetlb",
+                                  "Explicit hugepages, transparent ones when none are reserved")),
+            cl::init(PAGE_POOL_DEFAULT));
+
+cl::opt<bool> BindToNode("page-pool-numa", cl::desc("Allocate pages on the NUMA node of the thread that maps them"),
+                         cl::init(false));
+
+cl::opt<unsigned> ReleasedChunks("page-pool-released-chunks",
+                                 cl::desc("Number of empty chunks kept mapped after their memory is released"),
+                                 cl::init(8));
+
+const size_t HUGEPAGE_SIZE = 2 * 1024 * 1024;
+
+uint8_t *mapChunk(size_t size, bool &hugetlb) {
+    hugetlb = false;
+
+    if (Backend == PAGE_POOL_HUGETLB) {
+        void *ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ret != MAP_FAILED) {
+            hugetlb = true;
+            return (uint8_t *) ret;
+        }
+    }
+
+    if (Backend == PAGE_POOL_DEFAULT) {
+        void *ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return ret == MAP_FAILED ? nullptr : (uint8_t *) ret;
+    }
+
+    // Transparent hugepages need an aligned mapping, trim a larger one
+    auto ret = (uint8_t *) mmap(NULL, size + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ret == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto aligned = (uint8_t *) (((uintptr_t) ret + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1));
+    if (aligned > ret) {
+        munmap(ret, aligned - ret);
+    }
+    munmap(aligned + size, HUGEPAGE_SIZE - (aligned - ret));
+
+    madvise(aligned, size, MADV_HUGEPAGE);
+    return aligned;
+}
+
+// This must be done before the memory is touched
+void bindToLocalNode(uint8_t *addr, size_t size) {
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0 || node >= sizeof(unsigned long) * 8) {
+        return;
+    }
+
+    // Preferred rather than strict, allocations spill over to other
+    // nodes instead of failing when the local one is full.
+    unsigned long mask = 1ul << node;
+    syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0);
+}
+} // namespace
+
 namespace klee {
 
 PagePoolPtr PagePool::s_pool = PagePool::create();
@@ -34,14 +106,25 @@ PagePoolPtr PagePool::s_pool = PagePool::create();
 const uint64_t PagePoolDesc::POOL_PAGE_COUNT = 2 * 1024 * 1024 / 4096;
 const uint64_t PagePoolDesc::POOL_PAGE_SIZE = PagePoolDesc::POOL_PAGE_COUNT * 4096;
 
-Pages::Pages(unsigned numPages) : m_refCount(0), m_buffer(nullptr), m_size(0) {
+Pages::Pages(unsigned numPages)
+    : m_refCount(0), m_buffer(nullptr), m_size(0), m_numPages(numPages), m_hugetlb(false) {
     assert(numPages > 0);
     m_size = numPages * PAGE_SIZE;
-    m_buffer = (uint8_t *) mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (m_buffer == MAP_FAILED) {
+    m_buffer = mapChunk(m_size, m_hugetlb);
+    if (!m_buffer) {
         throw std::bad_alloc();
     }
+
+    if (BindToNode) {
+        bindToLocalNode(m_buffer, m_size);
+    }
+
     m_pageStatus = BitArray::create(numPages, true);
+
+    m_freeList.reserve(numPages);
+    for (unsigned i = numPages; i > 0; --i) {
+        m_freeList.push_back(i - 1);
+    }
 }
 
 Pages::~Pages() {
@@ -49,11 +132,14 @@ Pages::~Pages() {
 }
 
 uint8_t *Pages::alloc() {
-    unsigned index;
-    if (!m_pageStatus->findFirstSet(index)) {
+    if (m_freeList.empty()) {
         return nullptr;
     }
 
+    auto index = m_freeList.back();
+    m_freeList.pop_back();
+
+    assert(m_pageStatus->get(index));
     m_pageStatus->unset(index);
     auto ret = getBuffer() + index * PAGE_SIZE;
     assert(ret >= getBuffer());
@@ -66,10 +152,34 @@ void Pages::free(uint8_t *addr) {
     auto page = offset / PAGE_SIZE;
     assert(!m_pageStatus->get(page));
     m_pageStatus->set(page);
+    m_freeList.push_back(page);
+}
+
+bool Pages::release() {
+    assert(empty());
+    if (m_hugetlb) {
+        return false;
+    }
+
+#ifdef MADV_FREE
+    if (!madvise(m_buffer, m_size, MADV_FREE)) {
+        return true;
+    }
+#endif
+
+    // Kernels older than 4.5
+    return !madvise(m_buffer, m_size, MADV_DONTNEED);
 }
 
 PagesPtr PagePool::allocatePages() {
-    auto pages = Pages::create(PagePoolDesc::POOL_PAGE_COUNT);
+    PagesPtr pages;
+    if (m_releasedPages.empty()) {
+        pages = Pages::create(PagePoolDesc::POOL_PAGE_COUNT);
+    } else {
+        pages = m_releasedPages.back();
+        m_releasedPages.pop_back();
+    }
+
     auto start = (uintptr_t) pages->getBuffer();
     m_map[start] = pages;
     m_freePages[start] = pages;
@@ -89,6 +199,8 @@ uint8_t *PagePool::alloc() {
     if (pages->full()) {
         m_freePages.erase((uintptr_t) pages->getBuffer());
     }
+
+    ++m_allocations;
     return ret;
 }
 
@@ -114,10 +226,20 @@ void PagePool::free(uint8_t *_ptr) {
 
     auto full = page->full();
     page->free(_ptr);
+    ++m_frees;
 
     if (page->empty()) {
         m_freePages.erase(start);
         m_map.erase(start);
+
+        // Keep a few chunks mapped to avoid remapping them when the number
+        // of pages oscillates, the OS may still reclaim their memory.
+        if (m_cachedPages == page) {
+            m_cachedPages = nullptr;
+        }
+        if (m_releasedPages.size() < ReleasedChunks && page->release()) {
+            m_releasedPages.push_back(page);
+        }
     } else {
         if (full) {
             m_freePages[start] = page;
@@ -24,6 +24,7 @@
 #include "gtest/gtest.h"
 
 #include <klee/BitfieldSimplifier.h>
+#include <klee/util/BoundedExprHashMap.h>
 
 using namespace klee;
 
@@ -241,4 +242,35 @@ TEST(BitfieldSimplifierTest, Test11) {
     EXPECT_EQ(c3, dyn_cast<ConstantExpr>(s1));
 }
 
+// Checks that the least recently used entries are evicted first
+TEST(BitfieldSimplifierTest, BoundedCache) {
+    BoundedExprHashMap<int> cache(2);
+
+    auto array = Array::create("x", 8);
+    auto rd = ReadExpr::createTempRead(array, Expr::Int8);
+    auto e1 = AddExpr::create(rd, ConstantExpr::create(1, Expr::Int8));
+    auto e2 = AddExpr::create(rd, ConstantExpr::create(2, Expr::Int8));
+    auto e3 = AddExpr::create(rd, ConstantExpr::create(3, Expr::Int8));
+
+    cache.insert(e1, 1);
+    cache.insert(e2, 2);
+    ASSERT_NE(nullptr, cache.find(e1));
+
+    cache.insert(e3, 3);
+    EXPECT_EQ(2U, cache.size());
+    EXPECT_EQ(1U, cache.getEvictions());
+    EXPECT_EQ(nullptr, cache.find(e2));
+    ASSERT_NE(nullptr, cache.find(e1));
+    EXPECT_EQ(1, *cache.find(e1));
+    ASSERT_NE(nullptr, cache.find(e3));
+    EXPECT_EQ(3, *cache.find(e3));
+
+    // Erased entries free their slot
+    cache.erase(e1);
+    cache.insert(e2, 2);
+    EXPECT_EQ(1U, cache.getEvictions());
+    EXPECT_EQ(2, *cache.find(e2));
+    EXPECT_EQ(3, *cache.find(e3));
+}
+
 } // namespace
@@ -0,0 +1,164 @@
+//===-- Constraints.cpp ---------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include <klee/Constraints.h>
+#include <klee/Expr.h>
+#include <klee/Solver.h>
+
+using namespace klee;
+
+namespace {
+
+ref<Expr> readByte(const ArrayPtr &array, unsigned offset) {
+    return ReadExpr::create(UpdateList::create(array, nullptr), ConstantExpr::alloc(offset, Expr::Int32));
+}
+
+ref<Expr> constant(uint64_t value, Expr::Width width) {
+    return ConstantExpr::alloc(value, width);
+}
+
+ref<Expr> isByte(const ref<Expr> &e, uint8_t value) {
+    return EqExpr::create(e, ConstantExpr::alloc(value, Expr::Int8));
+}
+
+std::vector<ref<Expr>> getRequired(const ConstraintManager &constraints, const ref<Expr> &e) {
+    std::vector<ref<Expr>> required;
+    getIndependentConstraintsForQuery(Query(constraints, e), required);
+    return required;
+}
+
+TEST(ConstraintsTest, IndependentArrays) {
+    auto a = Array::create("a", 4);
+    auto b = Array::create("b", 4);
+
+    ConstraintManager constraints;
+    constraints.addConstraint(isByte(readByte(a, 0), 1));
+    constraints.addConstraint(isByte(readByte(b, 0), 2));
+
+    auto required = getRequired(constraints, isByte(readByte(a, 0), 3));
+    ASSERT_EQ(1u, required.size());
+    EXPECT_EQ(isByte(readByte(a, 0), 1), required[0]);
+
+    EXPECT_TRUE(getRequired(constraints, ConstantExpr::alloc(0, Expr::Bool)).empty());
+}
+
+TEST(ConstraintsTest, IndependentBytes) {
+    auto a = Array::create("a", 4);
+
+    ConstraintManager constraints;
+    constraints.addConstraint(isByte(readByte(a, 0), 1));
+    constraints.addConstraint(isByte(readByte(a, 1), 2));
+    EXPECT_EQ(1u, getRequired(constraints, isByte(readByte(a, 1), 3)).size());
+
+    // Relating both bytes puts them in the same class
+    constraints.addConstraint(UltExpr::create(readByte(a, 0), readByte(a, 1)));
+    EXPECT_EQ(3u, getRequired(constraints, isByte(readByte(a, 1), 3)).size());
+    EXPECT_TRUE(getRequired(constraints, isByte(readByte(a, 2), 3)).empty());
+}
+
+TEST(ConstraintsTest, SymbolicIndex) {
+    auto a = Array::create("a", 4);
+    auto i = Array::create("i", 4);
+
+    ConstraintManager constraints;
+    constraints.addConstraint(isByte(readByte(a, 0), 1));
+    constraints.addConstraint(isByte(readByte(a, 1), 2));
+    constraints.addConstraint(isByte(readByte(i, 0), 0));
+
+    // A read at a symbolic offset depends on all the bytes of the array
+    auto symRead = ReadExpr::create(UpdateList::create(a, nullptr), ZExtExpr::create(readByte(i, 0), Expr::Int32));
+    EXPECT_EQ(3u, getRequired(constraints, isByte(symRead, 3)).size());
+
+    constraints.addConstraint(isByte(symRead, 3));
+    EXPECT_EQ(4u, getRequired(constraints, isByte(readByte(a, 3), 3)).size());
+}
+
+TEST(ConstraintsTest, Persistence) {
+    auto a = Array::create("a", 4);
+
+    ConstraintManager parent;
+    parent.addConstraint(isByte(readByte(a, 0), 1));
+    parent.addConstraint(isByte(readByte(a, 1), 2));
+
+    ConstraintManager child = parent;
+    child.addConstraint(UltExpr::create(readByte(a, 0), readByte(a, 1)));
+
+    EXPECT_EQ(3u, getRequired(child, isByte(readByte(a, 0), 3)).size());
+    EXPECT_EQ(1u, getRequired(parent, isByte(readByte(a, 0), 3)).size());
+}
+
+TEST(ConstraintsTest, SimplifyEqualities) {
+    auto a = Array::create("a", 4);
+    auto b = Array::create("b", 4);
+
+    ConstraintManager constraints;
+    constraints.addConstraint(isByte(readByte(a, 0), 5));
+    constraints.addConstraint(Expr::createIsZero(isByte(readByte(b, 0), 7)));
+
+    auto sum = AddExpr::create(readByte(a, 0), ConstantExpr::alloc(1, Expr::Int8));
+    EXPECT_EQ(constant(6, Expr::Int8), constraints.simplifyExpr(sum));
+
+    EXPECT_EQ(constant(0, Expr::Bool), constraints.simplifyExpr(isByte(readByte(b, 0), 7)));
+
+    auto other = isByte(readByte(b, 1), 7);
+    EXPECT_EQ(other, constraints.simplifyExpr(other));
+}
+
+TEST(ConstraintsTest, SimplifyRanges) {
+    auto a = Array::create("a", 4);
+    auto x = readByte(a, 0);
+
+    ConstraintManager constraints;
+    constraints.addConstraint(UltExpr::create(x, ConstantExpr::alloc(10, Expr::Int8)));
+    constraints.addConstraint(Expr::createIsZero(UltExpr::create(x, ConstantExpr::alloc(3, Expr::Int8))));
+
+    // 3 <= x < 10
+    EXPECT_EQ(constant(1, Expr::Bool),
+              constraints.simplifyExpr(UleExpr::create(x, ConstantExpr::alloc(9, Expr::Int8))));
+    EXPECT_EQ(constant(0, Expr::Bool), constraints.simplifyExpr(isByte(x, 12)));
+    EXPECT_EQ(constant(1, Expr::Bool),
+              constraints.simplifyExpr(UltExpr::create(ConstantExpr::alloc(2, Expr::Int8), x)));
+
+    auto undecided = UltExpr::create(x, ConstantExpr::alloc(5, Expr::Int8));
+    EXPECT_EQ(undecided, constraints.simplifyExpr(undecided));
+
+    // A range of a single value is an equality
+    constraints.addConstraint(UleExpr::create(x, ConstantExpr::alloc(3, Expr::Int8)));
+    EXPECT_EQ(constant(3, Expr::Int8), constraints.simplifyExpr(x));
+}
+
+TEST(ConstraintsTest, RepairInitialValues) {
+    auto a = Array::create("a", 4);
+    auto b = Array::create("b", 4);
+    ArrayVec objects = {a, b};
+
+    // The current values are on the a[0] != 1 side of the branch
+    ConstraintManager constraints;
+    constraints.addConstraint(UltExpr::create(readByte(a, 0), ConstantExpr::alloc(8, Expr::Int8)));
+    constraints.addConstraint(isByte(readByte(b, 0), 7));
+
+    std::vector<std::vector<unsigned char>> values = {{0, 0, 0, 0}, {7, 0, 0, 0}};
+    ASSERT_TRUE(repairInitialValues(constraints, isByte(readByte(a, 0), 1), objects, values));
+    EXPECT_EQ(1, values[0][0]);
+    EXPECT_EQ(7, values[1][0]);
+
+    // No single byte mutation gets there without breaking a[0] < 8
+    values = {{0, 0, 0, 0}, {7, 0, 0, 0}};
+    EXPECT_FALSE(repairInitialValues(constraints, isByte(readByte(a, 0), 0x80), objects, values));
+    EXPECT_EQ(0, values[0][0]);
+
+    // Symbolic offsets are left to the solver
+    auto index = ZExtExpr::create(readByte(b, 1), Expr::Int32);
+    auto read = ReadExpr::create(UpdateList::create(a, nullptr), index);
+    EXPECT_FALSE(repairInitialValues(constraints, isByte(read, 1), objects, values));
+}
+
+} // namespace
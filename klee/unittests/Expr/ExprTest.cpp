@@ -13,6 +13,7 @@
 #include <klee/Expr.h>
 #include <klee/Memory.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/CommandLine.h>
 
 using namespace klee;
 using llvm::cast;
@@ -247,4 +248,29 @@ TEST(ExprTest, ExtractConcat) {
     EXPECT_EQ(Expr::Extract, concat2->getKid(0)->getKind());
     EXPECT_EQ(Expr::Extract, concat2->getKid(1)->getKind());
 }
+
+TEST(ExprTest, HashConsing) {
+    auto opt = static_cast<llvm::cl::opt<bool> *>(llvm::cl::getRegisteredOptions()["hash-cons-exprs"]);
+    ASSERT_NE(nullptr, opt);
+    opt->setValue(true);
+
+    auto array = Array::create("arr4", 256);
+    auto ul = UpdateList::create(array, 0);
+
+    // Same structure built from different nodes
+    ref<Expr> a = AddExpr::create(ReadExpr::create(ul, ConstantExpr::alloc(3, 32)), ConstantExpr::alloc(0xf0, Expr::Int8));
+    ref<Expr> b = AddExpr::create(ReadExpr::create(ul, ConstantExpr::alloc(3, 32)), ConstantExpr::alloc(0xf0, Expr::Int8));
+    EXPECT_EQ(a.get(), b.get());
+
+    ref<Expr> c = AddExpr::create(ReadExpr::create(ul, ConstantExpr::alloc(4, 32)), ConstantExpr::alloc(0xf0, Expr::Int8));
+    EXPECT_NE(a.get(), c.get());
+    EXPECT_NE(a, c);
+
+    opt->setValue(false);
+
+    // Nodes created without hash-consing still compare structurally
+    ref<Expr> d = AddExpr::create(ReadExpr::create(ul, ConstantExpr::alloc(3, 32)), ConstantExpr::alloc(0xf0, Expr::Int8));
+    EXPECT_NE(a.get(), d.get());
+    EXPECT_EQ(a, d);
+}
 } // namespace
@@ -21,6 +21,7 @@
 ///
 
 #include <iostream>
+#include <string.h>
 #include "gtest/gtest.h"
 
 #include <klee/util/PagePool.h>
@@ -52,6 +53,25 @@ TEST(PagePoolTest, Allocation) {
     EXPECT_EQ(0u, pp->getFreePages());
 }
 
+TEST(PagePoolTest, ReleasedChunkReuse) {
+    auto pp = PagePool::create();
+
+    auto ptr = pp->alloc();
+    EXPECT_NE(nullptr, ptr);
+    EXPECT_EQ(PagePoolDesc::POOL_PAGE_SIZE, pp->getResidentBytes());
+    memset(ptr, 0xcc, 0x1000);
+
+    // The empty chunk is released but stays mapped
+    pp->free(ptr);
+    EXPECT_EQ(0u, pp->getResidentBytes());
+    EXPECT_EQ(0u, pp->getFreePages());
+
+    EXPECT_EQ(ptr, pp->alloc());
+    EXPECT_EQ(PagePoolDesc::POOL_PAGE_SIZE, pp->getResidentBytes());
+    EXPECT_EQ(2u, pp->getAllocations());
+    EXPECT_EQ(1u, pp->getFrees());
+}
+
 TEST(PagePoolTest, AllocationBenchmark) {
     auto pages = 0x1000000u;
     auto pp = PagePool::create();
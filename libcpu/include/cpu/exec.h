@@ -95,6 +95,7 @@ uint64_t get_ram_size(void);
 void *get_ram_list_phys_dirty(void);
 uint64_t get_ram_list_phys_dirty_size(void);
 ram_addr_t last_ram_offset(void);
+int qemu_ram_addr_from_host(void *ptr, ram_addr_t *ram_addr);
 
 void cpu_dump_state(CPUArchState *env, FILE *f, fprintf_function cpu_fprintf, int flags);
 void cpu_dump_statistics(CPUArchState *env, FILE *f, fprintf_function cpu_fprintf, int flags);
@@ -116,6 +117,12 @@ void LIBCPU_NORETURN cpu_loop_exit_restore(CPUArchState *env1, uintptr_t ra);
 #define VGA_DIRTY_FLAG 0x01
 #define CODE_DIRTY_FLAG 0x02
 
+/* Set on the first write to a page after it was reset, used by
+   plugins that want to track pages modified since a snapshot.
+   Guest stores set it through the notdirty path, writes done by the
+   engine or plugins through S2EExecutionStateMemory::write. */
+#define SNAPSHOT_DIRTY_FLAG 0x04
+
 void cpu_physical_memory_get_dirty_bitmap(uint8_t *bitmap, ram_addr_t start, int length, int dirty_flags);
 
 void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end, int dirty_flags);
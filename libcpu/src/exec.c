@@ -178,6 +178,29 @@ uintptr_t se_get_host_address(target_phys_addr_t paddr) {
     return sreg->kvm.userspace_addr + mem_desc_get_offset(sreg, paddr);
 }
 
+/* Invalidate the TBs that intersect with the given guest physical range.
+   This must be called when the engine modifies memory behind the back
+   of the softmmu (e.g., when restoring a memory snapshot), so that
+   the rest of the TB cache can be kept. */
+void se_tb_invalidate_phys_range(target_phys_addr_t start, uint64_t size) {
+    target_phys_addr_t end = start + size;
+
+    while (start < end) {
+        target_phys_addr_t page_end = (start & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+        if (page_end > end) {
+            page_end = end;
+        }
+
+        const MemoryDesc *sreg = mem_desc_find(start);
+        if (sreg) {
+            ram_addr_t addr1 = sreg->ram_addr + mem_desc_get_offset(sreg, start);
+            tb_invalidate_phys_page_range(addr1, addr1 + (page_end - start), 0);
+        }
+
+        start = page_end;
+    }
+}
+
 #if defined(__linux__) && !defined(TARGET_S390X)
 
 static void unassigned_mem_write(target_phys_addr_t addr, uint64_t val, unsigned size) {
@@ -31,30 +31,60 @@
 
 namespace s2e {
 
+///
+/// Three-level page table of cached objects.
+///
+/// Copies share the tables of the original, which is how forked states
+/// inherit the cache of their parent. The objects of both address spaces
+/// are the same right after the fork, and the cache only stores read-only
+/// references, so the entries stay valid. A table that is shared is copied
+/// before being modified.
+///
+/// Reference counts are not atomic, caches must only be used by the
+/// executor thread.
+///
 template <class T, unsigned OBJSIZE_BITS, unsigned PAGESIZE_BITS, unsigned SUPERPAGESIZE_BITS> class MemoryCache {
 private:
     struct ThirdLevel {
+        unsigned refCount;
         T level3[1 << (PAGESIZE_BITS - OBJSIZE_BITS)];
-        ThirdLevel() {
+
+        ThirdLevel() : refCount(1) {
             for (unsigned i = 0; i < (1 << (PAGESIZE_BITS - OBJSIZE_BITS)); ++i) {
                 level3[i] = T();
             }
         }
+
+        ThirdLevel(const ThirdLevel &one) : refCount(1) {
+            for (unsigned i = 0; i < (1 << (PAGESIZE_BITS - OBJSIZE_BITS)); ++i) {
+                level3[i] = one.level3[i];
+            }
+        }
     };
 
     struct SecondLevel {
+        unsigned refCount;
         ThirdLevel *level2[1 << (SUPERPAGESIZE_BITS - PAGESIZE_BITS)];
 
-        SecondLevel() {
+        SecondLevel() : refCount(1) {
             for (unsigned i = 0; i < (1 << (SUPERPAGESIZE_BITS - PAGESIZE_BITS)); ++i) {
                 level2[i] = nullptr;
             }
         }
 
+        SecondLevel(const SecondLevel &one) : refCount(1) {
+            for (unsigned i = 0; i < (1 << (SUPERPAGESIZE_BITS - PAGESIZE_BITS)); ++i) {
+                level2[i] = one.level2[i];
+                if (level2[i]) {
+                    ++level2[i]->refCount;
+                }
+            }
+        }
+
         ~SecondLevel() {
             for (unsigned i = 0; i < (1 << (SUPERPAGESIZE_BITS - PAGESIZE_BITS)); ++i) {
                 if (level2[i]) {
-                    delete level2[i];
+                    release(level2[i]);
                     level2[i] = nullptr;
                 }
             }
@@ -66,6 +96,24 @@ private:
     uint64_t m_size;
     unsigned m_pagecount;
 
+    template <typename L> static inline void release(L *level) {
+        if (--level->refCount == 0) {
+            delete level;
+        }
+    }
+
+    // Make sure that the table is only referenced by this cache
+    template <typename L> static inline L *getPrivate(L *&level) {
+        if (!level) {
+            level = new L();
+        } else if (level->refCount > 1) {
+            L *copy = new L(*level);
+            release(level);
+            level = copy;
+        }
+        return level;
+    }
+
     inline void resize() {
         uint64_t mask = (1 << SUPERPAGESIZE_BITS) - 1;
         uint64_t pagecount = m_size >> SUPERPAGESIZE_BITS;
@@ -87,15 +135,22 @@ public:
         resize();
     }
 
-    // XXX: Clone an empty cache for now
     MemoryCache(const MemoryCache &one) {
         m_hostAddrStart = one.m_hostAddrStart;
         m_size = one.m_size;
         resize();
+
+        for (unsigned i = 0; i < m_pagecount; ++i) {
+            m_level1[i] = one.m_level1[i];
+            if (m_level1[i]) {
+                ++m_level1[i]->refCount;
+            }
+        }
     }
 
     ~MemoryCache() {
         flushCache();
+        delete[] m_level1;
     }
 
     inline uint64_t getSize() const {
@@ -109,7 +164,7 @@ public:
     inline void flushCache() {
         for (unsigned i = 0; i < m_pagecount; ++i) {
             if (m_level1[i]) {
-                delete m_level1[i];
+                release(m_level1[i]);
                 m_level1[i] = nullptr;
             }
         }
@@ -125,17 +180,8 @@ public:
         uint64_t level2 = (offset & ((1 << SUPERPAGESIZE_BITS) - 1)) >> PAGESIZE_BITS;
         uint64_t level3 = (offset >> OBJSIZE_BITS) & ((1 << (PAGESIZE_BITS - OBJSIZE_BITS)) - 1);
 
-        SecondLevel *ptrLevel2;
-        if (!(ptrLevel2 = m_level1[level1])) {
-            ptrLevel2 = new SecondLevel();
-            m_level1[level1] = ptrLevel2;
-        }
-
-        ThirdLevel *ptrLevel3;
-        if (!(ptrLevel3 = ptrLevel2->level2[level2])) {
-            ptrLevel3 = new ThirdLevel();
-            ptrLevel2->level2[level2] = ptrLevel3;
-        }
+        SecondLevel *ptrLevel2 = getPrivate(m_level1[level1]);
+        ThirdLevel *ptrLevel3 = getPrivate(ptrLevel2->level2[level2]);
 
         assert(level3 < (1 << (PAGESIZE_BITS - OBJSIZE_BITS)));
 
@@ -161,7 +207,7 @@ public:
         return ptrLevel3->level3[level3];
     }
 
-    inline T *getArray(uint64_t hostAddress) {
+    inline const T *getArray(uint64_t hostAddress) {
         uint64_t offset = hostAddress - m_hostAddrStart;
         uint64_t level1 = offset >> SUPERPAGESIZE_BITS;
         uint64_t level2 = (offset & ((1 << SUPERPAGESIZE_BITS) - 1)) >> PAGESIZE_BITS;
@@ -243,7 +289,7 @@ public:
         }
     }
 
-    T *getArray(uint64_t hostAddress) {
+    const T *getArray(uint64_t hostAddress) {
         typename Caches::iterator it;
         for (it = m_caches.begin(); it != m_caches.end(); ++it) {
             if ((*it)->contains(hostAddress)) {
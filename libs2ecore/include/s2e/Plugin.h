@@ -85,6 +85,11 @@ public:
 
     PluginState *getPluginState(S2EExecutionState *s, PluginState *(*f)(Plugin *, S2EExecutionState *) ) const;
 
+    /** Return the plugin state for reading, without copying it if it is
+        copy-on-write and shared with other execution states */
+    const PluginState *getPluginStateConst(S2EExecutionState *s,
+                                           PluginState *(*f)(Plugin *, S2EExecutionState *) ) const;
+
     void refresh() {
         m_CachedPluginS2EState = nullptr;
         m_CachedPluginState = nullptr;
@@ -114,15 +119,23 @@ public:
 #define DECLARE_PLUGINSTATE_N(c, name, execstate) c *name = static_cast<c *>(getPluginState(execstate, &c::factory))
 
 #define DECLARE_PLUGINSTATE_CONST(c, execstate) \
-    const c *plgState = static_cast<c *>(getPluginState(execstate, &c::factory))
+    const c *plgState = static_cast<const c *>(getPluginStateConst(execstate, &c::factory))
 
 #define DECLARE_PLUGINSTATE_NCONST(c, name, execstate) \
-    const c *name = static_cast<c *>(getPluginState(execstate, &c::factory))
+    const c *name = static_cast<const c *>(getPluginStateConst(execstate, &c::factory))
 
 class PluginState {
 public:
     virtual ~PluginState(){};
     virtual PluginState *clone() const = 0;
+
+    /** States that return true are shared by the execution states forked
+        from the one that owns them, and only cloned when one of them gets
+        the state through DECLARE_PLUGINSTATE. Code that only reads the state
+        must use DECLARE_PLUGINSTATE_CONST and must not keep pointers to it. */
+    virtual bool isCopyOnWrite() const {
+        return false;
+    }
 };
 
 struct PluginInfo {
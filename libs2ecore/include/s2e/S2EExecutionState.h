@@ -47,6 +47,7 @@ struct TimersState;
 
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
+#include <memory>
 #include <tr1/unordered_map>
 
 namespace s2e {
@@ -56,7 +57,9 @@ class PluginState;
 class S2EDeviceState;
 class S2EExecutionState;
 
-typedef std::unordered_map<const Plugin *, PluginState *> PluginStateMap;
+/// Plugin states that are copy-on-write may be shared with other execution
+/// states, see PluginState::isCopyOnWrite().
+typedef std::unordered_map<const Plugin *, std::shared_ptr<PluginState>> PluginStateMap;
 typedef PluginState *(*PluginStateFactory)(Plugin *p, S2EExecutionState *s);
 
 class S2EExecutionState : public klee::ExecutionState, public klee::IConcretizer {
@@ -199,16 +202,12 @@ public:
 
     /*************************************************/
 
-    PluginState *getPluginState(Plugin *plugin, PluginStateFactory factory) {
-        PluginStateMap::iterator it = m_PluginState.find(plugin);
-        if (it == m_PluginState.end()) {
-            PluginState *ret = factory(plugin, this);
-            assert(ret);
-            m_PluginState[plugin] = ret;
-            return ret;
-        }
-        return (*it).second;
-    }
+    /// Return the state of the plugin, which may be modified. A shared
+    /// copy-on-write state is copied first.
+    PluginState *getPluginState(Plugin *plugin, PluginStateFactory factory);
+
+    /// Return the state of the plugin without copying it if it is shared.
+    const PluginState *getPluginStateConst(Plugin *plugin, PluginStateFactory factory);
 
     /** Returns true if this is the active state */
     inline bool isActive() const {
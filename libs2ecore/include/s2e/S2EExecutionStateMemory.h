@@ -27,6 +27,7 @@
 
 #include <klee/IAddressSpaceNotification.h>
 #include <klee/IConcretizer.h>
+#include <vector>
 #include "AddressSpaceCache.h"
 
 namespace s2e {
@@ -52,6 +53,8 @@ protected:
 
     bool writeMemory8(uint64_t address, const klee::ref<klee::Expr> &value, AddressType addressType = VirtualAddress);
 
+    void setSnapshotDirty(uint64_t hostAddress);
+
     klee::ref<klee::Expr> readMemory8(uint64_t address, AddressType addressType = VirtualAddress);
 
 public:
@@ -73,6 +76,31 @@ public:
     void writeDirtyMask(uint64_t host_address, uint8_t val);
     void registerDirtyMask(uint64_t host_address, uint64_t size);
 
+    ///
+    /// \brief Collect the guest physical pages of the given RAM range that were
+    /// written since the last call to resetDirtyPages.
+    ///
+    /// This relies on the SNAPSHOT_DIRTY_FLAG of the dirty mask, which is set by guest
+    /// stores and by the write methods of this class. Writes that bypass both, e.g.,
+    /// DMA into the host buffer of the RAM, are not tracked. The state must be active.
+    ///
+    /// \param physAddress the start of the RAM range
+    /// \param size the size of the RAM range
+    /// \param pages where to append the physical address of each dirty page
+    /// \return false if the range is not entirely backed by RAM
+    ///
+    bool getDirtyPages(uint64_t physAddress, uint64_t size, std::vector<uint64_t> &pages);
+
+    ///
+    /// \brief Clear the SNAPSHOT_DIRTY_FLAG of the given RAM range
+    ///
+    /// Subsequent writes to the range go through the notdirty slow path
+    /// once per page, which sets the flag again.
+    ///
+    /// \return false if the range is not entirely backed by RAM
+    ///
+    bool resetDirtyPages(uint64_t physAddress, uint64_t size);
+
     static const klee::ObjectKey &getDirtyMask() {
         return s_dirtyMask;
     }
@@ -67,6 +67,9 @@ public:
 
     bool addressSpaceChangeUpdateTlb(const klee::ObjectStateConstPtr &oldState, const klee::ObjectStatePtr &newState);
 
+    /* True if a TLB entry refers to the given object */
+    bool isMapped(const klee::ObjectStateConstPtr &os) const;
+
     void flushTlbCache();
 
     void flushTlbCachePage(const klee::ObjectStatePtr &objectState, int mmu_idx, int index);
@@ -176,6 +176,13 @@ public:
 
     bool merge(klee::ExecutionState &base, klee::ExecutionState &other);
 
+    /**
+     * Make the concrete memory pages of the states that have the same
+     * contents share a single buffer. The merged pages remain copy-on-write.
+     * Returns the number of pages merged.
+     */
+    unsigned deduplicatePages();
+
     S2ETranslationBlock *allocateS2ETb();
     void flushS2ETBs();
 
@@ -207,7 +214,13 @@ public:
 
     void doDeviceStateSave(S2EExecutionState *oldState);
 
-    void doDeviceStateRestore(S2EExecutionState *newState);
+    /**
+     * Restore the registers and device state saved by doDeviceStateSave.
+     * Callers that know which guest memory changed since the save can keep
+     * the translation block cache and invalidate only the affected pages
+     * with se_tb_invalidate_phys_range.
+     */
+    void doDeviceStateRestore(S2EExecutionState *newState, bool flushTbCache = true);
 
 protected:
     void updateClockScaling();
@@ -211,6 +211,7 @@ int s2e_is_forking();
 void s2e_fix_code_gen_ptr(struct TranslationBlock *tb, int code_gen_size);
 
 void se_tb_safe_flush(void);
+void se_tb_invalidate_phys_range(target_phys_addr_t start, uint64_t size);
 
 /******************************************************/
 /* Prototypes for special functions used in LLVM code */
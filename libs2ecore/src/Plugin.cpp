@@ -75,6 +75,15 @@ PluginState *Plugin::getPluginState(S2EExecutionState *s, PluginStateFactory f)
     return m_CachedPluginState;
 }
 
+const PluginState *Plugin::getPluginStateConst(S2EExecutionState *s, PluginStateFactory f) const {
+    // The cache only holds states owned by s, shared states are not cached
+    // so that modifying them later goes through the copy
+    if (m_CachedPluginS2EState == s) {
+        return m_CachedPluginState;
+    }
+    return s->getPluginStateConst(const_cast<Plugin *>(this), f);
+}
+
 llvm::raw_ostream &Plugin::getDebugStream(S2EExecutionState *state) const {
     if (m_logLevel <= LOG_DEBUG) {
         return s2e()->getDebugStream(state) << getPluginInfo()->name << ": ";
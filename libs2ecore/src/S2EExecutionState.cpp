@@ -79,17 +79,13 @@ S2EExecutionState::S2EExecutionState(klee::KFunction *kf)
 }
 
 S2EExecutionState::~S2EExecutionState() {
-    PluginStateMap::iterator it;
-
     if (VerboseStateDeletion) {
         g_s2e->getDebugStream() << "Deleting state " << m_stateID << " " << this << '\n';
     }
 
     // print_stacktrace();
 
-    for (it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        delete it->second;
-    }
+    m_PluginState.clear();
 
     g_s2e->refreshPlugins();
 
@@ -99,6 +95,31 @@ S2EExecutionState::~S2EExecutionState() {
     delete m_timersState;
 }
 
+PluginState *S2EExecutionState::getPluginState(Plugin *plugin, PluginStateFactory factory) {
+    auto it = m_PluginState.find(plugin);
+    if (it == m_PluginState.end()) {
+        PluginState *ret = factory(plugin, this);
+        assert(ret);
+        m_PluginState[plugin] = std::shared_ptr<PluginState>(ret);
+        return ret;
+    }
+
+    if (it->second.use_count() > 1) {
+        it->second = std::shared_ptr<PluginState>(it->second->clone());
+    }
+
+    return it->second.get();
+}
+
+const PluginState *S2EExecutionState::getPluginStateConst(Plugin *plugin, PluginStateFactory factory) {
+    auto it = m_PluginState.find(plugin);
+    if (it == m_PluginState.end()) {
+        return getPluginState(plugin, factory);
+    }
+
+    return it->second.get();
+}
+
 void S2EExecutionState::assignGuid(uint64_t guid) {
     m_guid = guid;
 }
@@ -115,6 +136,8 @@ ExecutionState *S2EExecutionState::clone() {
     m_tlb.clearRamTlb();
 #endif
 
+    // The copy shares the memory cache with this state, its entries remain
+    // valid as both address spaces have the same objects at this point.
     S2EExecutionState *ret = new S2EExecutionState(*this);
     ret->addressSpace.state = ret;
     ret->m_deviceState.setExecutionState(ret);
@@ -127,13 +150,19 @@ ExecutionState *S2EExecutionState::clone() {
     ret->m_timersState = new TimersState;
     *ret->m_timersState = *m_timersState;
 
-    // Clone the plugins
-    PluginStateMap::iterator it;
+    // Clone the plugins, copy-on-write states are copied on first modification
     ret->m_PluginState.clear();
-    for (it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        ret->m_PluginState.insert(std::make_pair((*it).first, (*it).second->clone()));
+    for (auto &it : m_PluginState) {
+        if (it.second->isCopyOnWrite()) {
+            ret->m_PluginState.insert(it);
+        } else {
+            ret->m_PluginState.insert(std::make_pair(it.first, std::shared_ptr<PluginState>(it.second->clone())));
+        }
     }
 
+    // Plugins may have cached states that are now shared
+    g_s2e->refreshPlugins();
+
     ret->m_tlb.assignNewState(&ret->m_asCache, &ret->m_registers);
 
     ret->m_registers.update(ret->addressSpace, &ret->m_active, &ret->m_runningConcrete, ret, ret);
@@ -23,6 +23,7 @@
 
 #include <s2e/cpu.h>
 
+#include <cpu/memory.h>
 #include <s2e/S2EExecutionStateMemory.h>
 
 // Undefine cat from "compiler.h"
@@ -165,6 +166,7 @@ bool S2EExecutionStateMemory::writeMemory8(uint64_t address, const ref<Expr> &va
         return false;
 #ifdef CONFIG_SYMBEX_MP
     transferRam(nullptr, hostAddress, (void *) &value, 1, true, false, true);
+    setSnapshotDirty(hostAddress);
 #else
     ConstantExpr *ce = dyn_cast<ConstantExpr>(value);
     *((uint8_t *) hostAddress) = (uint8_t) ce->getZExtValue();
@@ -212,6 +214,7 @@ bool S2EExecutionStateMemory::write(uint64_t address, const void *buf, uint64_t
         }
 
         transferRam(nullptr, hostAddress, const_cast<void *>(buf), length, true, false, false);
+        setSnapshotDirty(hostAddress);
 #else
         *((uint8_t *) hostAddress) = *((uint8_t *) buf);
         uint64_t length = 1;
@@ -454,6 +457,97 @@ void S2EExecutionStateMemory::writeDirtyMask(uint64_t host_address, uint8_t val)
     m_dirtyMask->write8(host_address, val);
 }
 
+///
+/// Guest stores mark the pages they write in the notdirty slow path, which
+/// the writes done here bypass. Mark them too, so that snapshots taken by
+/// plugins see the changes made by the engine and other plugins.
+///
+void S2EExecutionStateMemory::setSnapshotDirty(uint64_t hostAddress) {
+    ram_addr_t ramAddress;
+    if (!m_dirtyMask || qemu_ram_addr_from_host((void *) hostAddress, &ramAddress)) {
+        return;
+    }
+
+    uint64_t offset = ramAddress >> TARGET_PAGE_BITS;
+    uint8_t flags = 0;
+    m_dirtyMask->readConcrete8(offset, &flags);
+    if (!(flags & SNAPSHOT_DIRTY_FLAG)) {
+        m_dirtyMask->write8(offset, flags | SNAPSHOT_DIRTY_FLAG);
+    }
+}
+
+///
+/// The libcpu dirty mask helpers require ranges that do not span
+/// several RAM blocks. This returns the largest prefix of the given
+/// range that belongs to a single block.
+///
+static bool getRamChunk(uint64_t physAddress, uint64_t size, ram_addr_t *ramAddress, uint64_t *chunkSize) {
+    const MemoryDesc *desc = mem_desc_find(physAddress);
+    if (!desc) {
+        return false;
+    }
+
+    uint64_t offset = mem_desc_get_offset(desc, physAddress);
+    *ramAddress = desc->ram_addr + offset;
+    *chunkSize = std::min(size, (uint64_t) desc->kvm.memory_size - offset);
+    return true;
+}
+
+bool S2EExecutionStateMemory::getDirtyPages(uint64_t physAddress, uint64_t size, std::vector<uint64_t> &pages) {
+    assert(*m_active && "Dirty pages can only be queried on the active state");
+
+    uint64_t end = physAddress + size;
+    physAddress &= TARGET_PAGE_MASK;
+    size = end - physAddress;
+
+    std::vector<uint8_t> bitmap;
+    while (size > 0) {
+        ram_addr_t ramAddress;
+        uint64_t chunkSize;
+        if (!getRamChunk(physAddress, size, &ramAddress, &chunkSize)) {
+            return false;
+        }
+
+        uint64_t pageCount = TARGET_PAGE_ALIGN(chunkSize) >> TARGET_PAGE_BITS;
+        bitmap.assign((pageCount + 7) / 8, 0);
+        cpu_physical_memory_get_dirty_bitmap(bitmap.data(), ramAddress, chunkSize, SNAPSHOT_DIRTY_FLAG);
+
+        for (uint64_t i = 0; i < pageCount; ++i) {
+            if (bitmap[i / 8] & (1 << (i % 8))) {
+                pages.push_back(physAddress + i * TARGET_PAGE_SIZE);
+            }
+        }
+
+        physAddress += chunkSize;
+        size -= chunkSize;
+    }
+
+    return true;
+}
+
+bool S2EExecutionStateMemory::resetDirtyPages(uint64_t physAddress, uint64_t size) {
+    assert(*m_active && "Dirty pages can only be reset on the active state");
+
+    uint64_t end = physAddress + size;
+    physAddress &= TARGET_PAGE_MASK;
+    size = end - physAddress;
+
+    while (size > 0) {
+        ram_addr_t ramAddress;
+        uint64_t chunkSize;
+        if (!getRamChunk(physAddress, size, &ramAddress, &chunkSize)) {
+            return false;
+        }
+
+        cpu_physical_memory_reset_dirty(ramAddress, ramAddress + chunkSize, SNAPSHOT_DIRTY_FLAG);
+
+        physAddress += chunkSize;
+        size -= chunkSize;
+    }
+
+    return true;
+}
+
 /** Read an ASCIIZ string from memory */
 bool S2EExecutionStateMemory::readString(uint64_t address, std::string &s, unsigned maxLen) {
     return readGenericString<uint8_t>(address, s, maxLen);
@@ -170,6 +170,22 @@ void S2EExecutionStateTlb::updateTlb(const klee::ObjectStateConstPtr &oldState,
 #endif
 }
 
+bool S2EExecutionStateTlb::isMapped(const klee::ObjectStateConstPtr &os) const {
+    if (m_tlbMap.count(os)) {
+        return true;
+    }
+
+#if defined(SE_ENABLE_PHYSRAM_TLB)
+    CPUArchState *cpu = m_registers->getCpuState();
+    uintptr_t tlb_index = (os->getAddress() >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    if (cpu->se_ram_tlb[tlb_index].object_state == os.get()) {
+        return true;
+    }
+#endif
+
+    return false;
+}
+
 /***/
 
 void S2EExecutionStateTlb::flushTlbCache() {
@@ -46,6 +46,7 @@
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/Process.h>
+#include <llvm/Support/xxhash.h>
 
 #include <llvm/Config/config.h>
 #include <llvm/Support/FileSystem.h>
@@ -66,6 +67,8 @@
 
 #include <glib.h>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #ifdef WIN32
@@ -203,6 +206,10 @@ DebugConstraints("debug-constraints",
 
 extern cl::opt<bool> UseExprSimplifier;
 
+namespace klee {
+extern cl::opt<bool> ForkAsync;
+}
+
 extern "C" {
     int g_s2e_fork_on_symbolic_address = 0;
     int g_s2e_concretize_io_addresses = 1;
@@ -501,6 +508,15 @@ S2EExecutionState *S2EExecutor::createInitialState() {
     auto solver = factory->decorateSolver(endSolver);
     state->setSolver(solver);
 
+    // Pending states get their concrete values once admitted while the current state keeps
+    // running, onStateFork handlers would see neither target as it was at the fork
+    if (klee::ForkAsync && !m_s2e->getCorePlugin()->onStateFork.empty()) {
+        m_s2e->getWarningsStream() << klee::ForkAsync.ArgStr
+                                   << " cannot be used with plugins that handle onStateFork\n";
+        exit(-1);
+    }
+    setAsyncSolver(factory->createAsyncSolver());
+
     state->m_runningConcrete = true;
     state->m_active = true;
     state->setForking(EnableForking);
@@ -703,7 +719,7 @@ void S2EExecutor::computeNewStateGuids(std::unordered_map<ExecutionState *, uint
 }
 
 void S2EExecutor::doLoadBalancing() {
-    if (states.size() < 2) {
+    if (states.size() < 2 && pendingStates.empty()) {
         return;
     }
 
@@ -712,6 +728,16 @@ void S2EExecutor::doLoadBalancing() {
         return;
     }
 
+    // Pending states are not part of the state set, and the solver thread
+    // would not survive the fork
+    if (resolvePendingStates()) {
+        updateStates(g_s2e_state);
+    }
+
+    if (states.size() < 2) {
+        return;
+    }
+
     std::vector<S2EExecutionState *> allStates;
 
     foreach2 (it, states.begin(), states.end()) {
@@ -841,7 +867,7 @@ void S2EExecutor::doDeviceStateSave(S2EExecutionState *oldState) {
     g_se_disable_tlb_flush = 0;
 }
 
-void S2EExecutor::doDeviceStateRestore(S2EExecutionState *newState) {
+void S2EExecutor::doDeviceStateRestore(S2EExecutionState *newState, bool flushTbCache) {
     // Some state save/restore logic flushes the cache.
     // This can have bad effects in case of saving/restoring states
     // that were in the middle of a memory operation. Therefore,
@@ -865,7 +891,9 @@ void S2EExecutor::doDeviceStateRestore(S2EExecutionState *newState) {
 
     // XXX: specify which state should be used
     s2e_kvm_restore_device_state();
-    se_tb_safe_flush();
+    if (flushTbCache) {
+        se_tb_safe_flush();
+    }
 
     g_se_disable_tlb_flush = 0;
 
@@ -1707,6 +1735,96 @@ bool S2EExecutor::merge(klee::ExecutionState &_base, klee::ExecutionState &_othe
     return result;
 }
 
+unsigned S2EExecutor::deduplicatePages() {
+    // There is nobody to share pages with
+    if (g_s2e_single_path_mode) {
+        return 0;
+    }
+
+    auto isCandidate = [](const ObjectStateConstPtr &os) {
+        return os->isMemoryPage() && !os->isSharedConcrete() && !os->isReadOnly() &&
+               os->getSize() == SE_RAM_OBJECT_SIZE && !(os->getAddress() & ~SE_RAM_OBJECT_MASK) &&
+               os->getStoreOffset() == 0 && os->getBitArraySize() == os->getSize() && os->isAllConcrete();
+    };
+
+    // States write the objects they own in place, so the buffers of these
+    // objects must not be shared. The others are copied before being written.
+    std::unordered_set<ObjectStateConstPtr, ObjectStatePtrHash> owned;
+    for (auto es : states) {
+        const auto &as = es->addressSpace;
+        for (auto it = as.objects.begin(), ie = as.objects.end(); it != ie; ++it) {
+            if (isCandidate(it->second) && as.isOwnedByUs(it->second)) {
+                owned.insert(it->second);
+            }
+        }
+    }
+
+    // Buffers of the unowned pages seen so far, indexed by content hash
+    std::unordered_multimap<uint64_t, ConcreteBufferPtr> buffers;
+
+    // Replacement of each object, or null if it has the first buffer with
+    // its contents. The replacement is not owned by any state, so that all
+    // the states holding the object get the same one.
+    std::unordered_map<ObjectStateConstPtr, ObjectStatePtr, ObjectStatePtrHash> merged;
+
+    auto share = [&](const ObjectStateConstPtr &os) -> ObjectStatePtr {
+        const auto &buffer = os->getConcreteBufferPtr();
+        auto hash = llvm::xxHash64(llvm::ArrayRef<uint8_t>(buffer->get(), buffer->size()));
+
+        auto range = buffers.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            const auto &shared = it->second;
+            if (shared == buffer) {
+                return nullptr;
+            }
+
+            if (!memcmp(shared->get(), buffer->get(), buffer->size())) {
+                auto mask = os->getConcreteMask() ? BitArray::create(os->getConcreteMask()) : nullptr;
+                auto ret = os->copy(mask, shared);
+                ret->setOwnerId(0);
+                return ret;
+            }
+        }
+
+        buffers.insert(std::make_pair(hash, buffer));
+        return nullptr;
+    };
+
+    unsigned count = 0;
+    for (auto es : states) {
+        auto state = static_cast<S2EExecutionState *>(es);
+        std::vector<std::pair<ObjectStateConstPtr, ObjectStatePtr>> replacements;
+
+        const auto &as = state->addressSpace;
+        for (auto it = as.objects.begin(), ie = as.objects.end(); it != ie; ++it) {
+            const ObjectStateConstPtr os = it->second;
+            if (!isCandidate(os) || owned.count(os)) {
+                continue;
+            }
+
+            auto mit = merged.find(os);
+            if (mit == merged.end()) {
+                mit = merged.insert(std::make_pair(os, share(os))).first;
+            }
+
+            // TLB entries hold the address of the buffer. Updating them would
+            // write the CPU state, which may be shared with other states.
+            if (mit->second && !state->getTlb()->isMapped(os)) {
+                replacements.push_back(std::make_pair(os, mit->second));
+            }
+        }
+
+        for (const auto &r : replacements) {
+            state->addressSpace.replaceObject(r.first, r.second);
+        }
+
+        count += replacements.size();
+    }
+
+    stats::deduplicatedPages += count;
+    return count;
+}
+
 void S2EExecutor::terminateState(klee::ExecutionState &state, const std::string &message) {
     S2EExecutionState *s2estate = static_cast<S2EExecutionState *>(&state);
     m_s2e->getInfoStream(s2estate) << "Terminating state: " << message << "\n";
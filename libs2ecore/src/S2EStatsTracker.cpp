@@ -29,6 +29,7 @@
 #include <klee/CoreStats.h>
 #include <klee/Internal/System/Time.h>
 #include <klee/SolverStats.h>
+#include <klee/util/PagePool.h>
 
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Process.h>
@@ -164,7 +165,13 @@ void S2EStatsTracker::writeStatsHeader() {
         "CexCacheTime",
         "ForkTime",
         "ResolveTime",
-        "MemoryUsage"
+        "MemoryUsage",
+        "AddressSpaceCacheHits",
+        "AddressSpaceCacheMisses",
+        "DeduplicatedPages",
+        "PagePoolAllocations",
+        "PagePoolFrees",
+        "PagePoolResidentBytes"
     };
     // clang-format on
 
@@ -222,7 +229,13 @@ void S2EStatsTracker::writeStatsLine() {
              << "," << stats::cexCacheTime / 1000000.
              << "," << stats::forkTime / 1000000.
              << "," << stats::resolveTime / 1000000.
-             << "," << getProcessMemoryUsage();
+             << "," << getProcessMemoryUsage()
+             << "," << stats::addressSpaceCacheHits
+             << "," << stats::addressSpaceCacheMisses
+             << "," << stats::deduplicatedPages
+             << "," << PagePool::get()->getAllocations()
+             << "," << PagePool::get()->getFrees()
+             << "," << PagePool::get()->getResidentBytes();
     // clang-format on
     if (!CsvOutput) {
         *statsFile << ")";
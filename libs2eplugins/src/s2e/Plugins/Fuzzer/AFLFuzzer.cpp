@@ -20,11 +20,11 @@ namespace plugins {
 S2E_DEFINE_PLUGIN(AFLFuzzer, "trigger and record external interrupts", "AFLFuzzer", "PeripheralModelLearning");
 
 
-static void afl_setup(void) {
+static void afl_setup(uint32_t map_size, uint32_t worker_id) {
 /* Set up SHM region and initialize other stuff. */
-    AFL_shm_id = shmget((key_t) AFL_IoT_S2E_KEY, sizeof(struct AFL_data), IPC_CREAT | 0660);
-    bitmap_shm_id = shmget((key_t) AFL_BITMAP_KEY, MAP_SIZE, IPC_CREAT | 0660);
-    testcase_shm_id = shmget((key_t) AFL_TESTCASE_KEY, TESTCASE_SIZE, IPC_CREAT | 0660);
+    AFL_shm_id = shmget((key_t)(AFL_IoT_S2E_KEY + worker_id), sizeof(struct AFL_data), IPC_CREAT | 0660);
+    bitmap_shm_id = shmget((key_t)(AFL_BITMAP_KEY + worker_id), map_size, IPC_CREAT | 0660);
+    testcase_shm_id = shmget((key_t)(AFL_TESTCASE_KEY + worker_id), TESTCASE_SIZE, IPC_CREAT | 0660);
 
     if (AFL_shm_id < 0 || bitmap_shm_id < 0) {
         printf("shmget error\n");
@@ -43,6 +43,17 @@ static void afl_setup(void) {
         printf("shmat error\n");
         exit(-1);
     }
+
+    // CoverageBitmap only clears what it published itself
+    memset(afl_area_ptr, 0, map_size);
+}
+
+static void shutdownEngine() {
+    g_s2e->getCorePlugin()->onEngineShutdown.emit();
+    // Flush here just in case ~S2E() is not called (e.g., if atexit()
+    // shutdown handler was not called properly).
+    g_s2e->flushOutputStreams();
+    exit(0);
 }
 
 void AFLFuzzer::initialize() {
@@ -163,12 +174,43 @@ void AFLFuzzer::initialize() {
     }
 
     hw::PeripheralModelLearning *PeripheralConnection = s2e()->getPlugin<hw::PeripheralModelLearning>();
+    peripheral_learning = PeripheralConnection;
     PeripheralConnection->onFuzzingInput.connect(sigc::mem_fun(*this, &AFLFuzzer::onFuzzingInput));
     PeripheralConnection->onModeSwitch.connect(sigc::mem_fun(*this, &AFLFuzzer::onModeSwitch));
     PeripheralConnection->onInvalidPHs.connect(sigc::mem_fun(*this, &AFLFuzzer::onInvalidPHs));
 
-    afl_setup();
-    bitmap = (uint8_t *) malloc(MAP_SIZE);
+    dirty_page_snapshot = s2e()->getConfig()->getBool(getConfigKey() + ".dirtyPageSnapshot", false);
+    persistent_tb_cache = s2e()->getConfig()->getBool(getConfigKey() + ".persistentTBCache", false);
+
+    uint32_t map_size_pow2 = cfg->getInt(getConfigKey() + ".mapSizePow2", MAP_SIZE_POW2);
+    if (map_size_pow2 < MAP_SIZE_POW2 || map_size_pow2 > MAP_SIZE_POW2_MAX) {
+        getWarningsStream() << "mapSizePow2 should be between " << MAP_SIZE_POW2 << " and " << MAP_SIZE_POW2_MAX
+                            << "\n";
+        exit(-1);
+    }
+    map_size = 1 << map_size_pow2;
+    afl_inst_rms = map_size;
+    classify_counts = cfg->getBool(getConfigKey() + ".classifyCounts", false);
+
+    // each worker of a parallel campaign talks to its own AFL instance
+    worker_id = cfg->getInt(getConfigKey() + ".workerId", 0);
+    if (worker_id >= AFL_MAX_WORKERS) {
+        getWarningsStream() << "workerId should be less than " << AFL_MAX_WORKERS << "\n";
+        exit(-1);
+    }
+
+    shared_coverage = nullptr;
+    std::string sharedCoverageName = cfg->getString(getConfigKey() + ".sharedCoverage", "", &ok);
+    if (ok && !sharedCoverageName.empty()) {
+        shared_coverage = new S2ESynchronizedObject<AFLSharedCoverage>(sharedCoverageName.c_str());
+        getInfoStream() << "worker " << worker_id << " merges coverage into " << sharedCoverageName << "\n";
+    }
+
+    afl_setup(map_size, worker_id);
+    local_map.attach((uint8_t *) calloc(map_size, 1));
+    coverage = &local_map;
+    ring = nullptr;
+    ring_busy = false;
     afl_start_code = 0;
     afl_end_code = 0xffffffff;
     systick_flag = 0;
@@ -196,6 +238,127 @@ void AFLFuzzer::initialize() {
             exit(-1);
         }
     }
+
+    if (tc_length == 0 && cfg->getBool(getConfigKey() + ".useRing", false)) {
+        setupRing(cfg->getInt(getConfigKey() + ".ringKey", AFL_RING_KEY + worker_id),
+                  cfg->getInt(getConfigKey() + ".ringSlots", 16),
+                  cfg->getInt(getConfigKey() + ".ringDataSize", 1 << 20));
+    }
+}
+
+void AFLFuzzer::setupRing(key_t key, int64_t slot_count, int64_t data_size) {
+    if (slot_count <= 0 || slot_count > AFL_RING_MAX_SLOTS) {
+        getWarningsStream() << "ringSlots must be between 1 and " << AFL_RING_MAX_SLOTS << "\n";
+        exit(-1);
+    }
+
+    if (data_size <= 0 || data_size > AFL_RING_MAX_DATA_SIZE) {
+        getWarningsStream() << "ringDataSize must be between 1 and " << hexval(AFL_RING_MAX_DATA_SIZE) << "\n";
+        exit(-1);
+    }
+
+    int shm_id = shmget(key, afl_ring_size(slot_count, map_size, data_size), IPC_CREAT | 0660);
+    if (shm_id < 0) {
+        getWarningsStream() << "could not get the AFL ring, a smaller segment may already use key " << key << "\n";
+        exit(-1);
+    }
+
+    void *shm = shmat(shm_id, NULL, 0);
+    if (shm == (void *) -1) {
+        getWarningsStream() << "could not attach the AFL ring\n";
+        exit(-1);
+    }
+
+    // the front end waits for the magic before using the ring
+    ring = (AFL_ring_header *) shm;
+    ring->magic = 0;
+    ring->version = AFL_RING_VERSION;
+    ring->slot_count = slot_count;
+    ring->map_size = map_size;
+    ring->data_size = data_size;
+    ring->stop = 0;
+    ring->head = 0;
+    ring->tail = 0;
+
+    memset(afl_ring_trace_map(ring, 0), 0, (size_t) slot_count * map_size);
+    ring_maps.resize(slot_count);
+    for (uint32_t i = 0; i < slot_count; ++i) {
+        ring_maps[i].attach(afl_ring_trace_map(ring, i));
+    }
+
+    afl_ring_publish(&ring->magic, AFL_RING_MAGIC);
+
+    getInfoStream() << "AFL ring shm_id = " << shm_id << " slots = " << slot_count << " data size = " << hexval(data_size)
+                    << "\n";
+}
+
+bool AFLFuzzer::fetchTestcase(uint8_t **data, uint32_t *size) {
+    if (!ring) {
+        *data = testcase;
+        *size = afl_con->AFL_size;
+        return afl_con->AFL_input;
+    }
+
+    if (!ring_busy) {
+        // the front end normally queued the next testcases while the previous ones ran
+        uint32_t tail = ring->tail;
+        while (afl_ring_load(&ring->head) == tail) {
+            if (afl_ring_load(&ring->stop)) {
+                getInfoStream() << "==== Testing aborted by user via Fuzzer ====\n";
+                shutdownEngine();
+            }
+            afl_ring_wait(&ring->head, tail, 100);
+        }
+
+        ring_busy = true;
+        local_map.clear();
+        coverage = &ring_maps[tail % ring->slot_count];
+        coverage->clear();
+    }
+
+    AFL_ring_slot *slot = afl_ring_slot(ring, ring->tail);
+    uint32_t offset = std::min(slot->offset, ring->data_size);
+    *data = afl_ring_data(ring) + offset;
+    *size = std::min(slot->size, ring->data_size - offset);
+    return true;
+}
+
+void AFLFuzzer::mergeCoverage(const CoverageBitmap &map) {
+    if (!shared_coverage) {
+        return;
+    }
+
+    AFLSharedCoverage *global = shared_coverage->get();
+    size_t new_edges = map.merge(global->map);
+    if (new_edges) {
+        uint64_t edges = __atomic_add_fetch(&global->edges, new_edges, __ATOMIC_RELAXED);
+        getDebugStream() << "testcase covered " << new_edges << " new edges, " << edges << " edges in total\n";
+    }
+}
+
+void AFLFuzzer::publishBitmap() {
+    if (classify_counts) {
+        local_map.classify();
+    }
+    mergeCoverage(local_map);
+    local_map.publish(afl_area_ptr);
+    local_map.clear();
+}
+
+void AFLFuzzer::completeRingSlot(uint32_t fault) {
+    if (!ring_busy) {
+        return;
+    }
+
+    if (classify_counts) {
+        coverage->classify();
+    }
+    mergeCoverage(*coverage);
+
+    afl_ring_slot(ring, ring->tail)->fault = fault;
+    coverage = &local_map;
+    ring_busy = false;
+    afl_ring_publish(&ring->tail, ring->tail + 1);
 }
 
 void AFLFuzzer::forkPoint(S2EExecutionState *state) {
@@ -274,11 +437,15 @@ void AFLFuzzer::saveSymRegs(S2EExecutionState *state) {
 void AFLFuzzer::onCrashHang(S2EExecutionState *state, uint32_t flag) {
     PrintRegs(state);
     systick_flag = 0;
-    memcpy(afl_area_ptr, bitmap, MAP_SIZE);
-    if (flag != 0) {
-        afl_con->AFL_return = FAULT_CRASH;
+    if (ring) {
+        completeRingSlot(flag != 0 ? FAULT_CRASH : FAULT_TMOUT);
     } else {
-        afl_con->AFL_return = FAULT_TMOUT;
+        publishBitmap();
+        if (flag != 0) {
+            afl_con->AFL_return = FAULT_CRASH;
+        } else {
+            afl_con->AFL_return = FAULT_TMOUT;
+        }
     }
     invaild_pc = 0;
     for (auto phaddr_cur_loc : cur_read) {
@@ -286,10 +453,11 @@ void AFLFuzzer::onCrashHang(S2EExecutionState *state, uint32_t flag) {
     }
     Ethernet.pos = 0;
     if (tc_length == 0) { // Fuzzing
+        peripheral_learning->syncSharedKB();
         restoreMemRegSnapShot(state);
         restoreSymRegs(state);
         PrintRegs(state);
-        s2e()->getExecutor()->doDeviceStateRestore(state);
+        s2e()->getExecutor()->doDeviceStateRestore(state, !persistent_tb_cache);
     } else {
         g_s2e->getCorePlugin()->onEngineShutdown.emit();
         // Flush here just in case ~S2E() is not called (e.g., if atexit()
@@ -306,8 +474,12 @@ void AFLFuzzer::onTimer() {
 void AFLFuzzer::onModeSwitch(S2EExecutionState *state, bool fuzzing_to_learning, bool *fork_point_flag) {
     if (fuzzing_to_learning) {
         if (hit_flag) {
-            memcpy(afl_area_ptr, bitmap, MAP_SIZE);
-            afl_con->AFL_input = 0;
+            if (ring) {
+                completeRingSlot(FAULT_NONE);
+            } else {
+                publishBitmap();
+                afl_con->AFL_input = 0;
+            }
         } else {
             *fork_point_flag = false;
         }
@@ -378,11 +550,14 @@ void AFLFuzzer::onFuzzingInput(S2EExecutionState *state, PeripheralRegisterType
         timer_ticks = 0;
         uint32_t afl_length;
         if (tc_length == 0) { // Fuzzing
-            if (afl_con->AFL_size > max_afl_size) {
+            uint8_t *tc_data;
+            uint32_t tc_size;
+            bool tc_ready = fetchTestcase(&tc_data, &tc_size);
+            if (tc_size > max_afl_size) {
                afl_length = max_afl_size;
                 getDebugStream() << " max_size = " << max_afl_size << "\n";
             } else {
-                afl_length = afl_con->AFL_size;
+                afl_length = tc_size;
             }
             if (cur_read[phaddr] >= afl_length) { // fork point
                 if (state->regs()->getInterruptFlag() && state->regs()->getExceptionIndex() == 15 && systick_flag != 2) {
@@ -393,21 +568,27 @@ void AFLFuzzer::onFuzzingInput(S2EExecutionState *state, PeripheralRegisterType
                         cur_read[phaddr_cur_loc.first] = 0;
                     }
                     getDebugStream() <<  " phaddr first = " << hexval(phaddr) << " phaddr second" << hexval(cur_read[phaddr]) << "\n";
-                    memcpy(afl_area_ptr, bitmap, MAP_SIZE);
-                    afl_con->AFL_input = 0;
+                    if (ring) {
+                        completeRingSlot(FAULT_NONE);
+                    } else {
+                        publishBitmap();
+                        afl_con->AFL_input = 0;
+                    }
                     systick_flag = 0;
                     getDebugStream() << "testcase finish "<< " pc = " << hexval(state->regs()->getPc()) << "\n";
+                    peripheral_learning->syncSharedKB();
                     restoreMemRegSnapShot(state);
                     restoreSymRegs(state);
-                    s2e()->getExecutor()->doDeviceStateRestore(state);
+                    s2e()->getExecutor()->doDeviceStateRestore(state, !persistent_tb_cache);
                     return;
                 }
             }
 
-            if (afl_con->AFL_input) {
-                getDebugStream() << "AFL_input = " << afl_con->AFL_input << " AFL_size = " << afl_con->AFL_size
+            if (tc_ready) {
+                getDebugStream() << "AFL_input = " << tc_ready << " AFL_size = " << tc_size
                                  << " cur_read = " << cur_read[phaddr] << "\n";
-                memcpy(value, testcase + cur_read[phaddr], *size);
+                // do not read past the end of the testcase
+                memcpy(value, tc_data + cur_read[phaddr], std::min(*size, afl_length - cur_read[phaddr]));
                 cur_read[phaddr] += *size;
             } else {
                 memset(value, 0, 4 * sizeof(char));
@@ -432,37 +613,65 @@ void AFLFuzzer::onFuzzingInput(S2EExecutionState *state, PeripheralRegisterType
 void AFLFuzzer::saveMemRegSnapShot(S2EExecutionState *state) {
     // ram regions
     mems_snapshot.clear();
-    if (mems_snapshot.size() == 0) {
-        for (uint32_t j = 0; j < rams.size(); j++) {
-            std::vector<uint32_t> mem_snapshot;
-            for (uint32_t i = 0; i < rams[j].size; i = i+4) {
-                uint32_t ram_data = 0;
-                bool ok = state->mem()->read(rams[j].baseaddr + i, &ram_data, sizeof(ram_data));
-                mem_snapshot.push_back(ram_data);
-                if (ok) {
-                   // getDebugStream(state) << "read mem addr:" << hexval(rams[j].baseaddr+i) << " value = " << hexval(ram_data) << "\n";
-                } else {
-                    getWarningsStream(state) << "read mem addr:" << hexval(rams[j].baseaddr+i) << "fail!!\n";
-                    exit(-1);
-                }
-            }
-            mems_snapshot.push_back(mem_snapshot);
+    for (uint32_t j = 0; j < rams.size(); j++) {
+        std::vector<uint8_t> mem_snapshot(rams[j].size);
+        if (!state->mem()->read(rams[j].baseaddr, mem_snapshot.data(), rams[j].size)) {
+            getWarningsStream(state) << "read mem addr:" << hexval(rams[j].baseaddr) << " size:" << hexval(rams[j].size)
+                                     << " fail!!\n";
+            exit(-1);
+        }
+        mems_snapshot.push_back(std::move(mem_snapshot));
+
+        // start tracking the pages that the testcase writes from here
+        if (dirty_page_snapshot && !state->mem()->resetDirtyPages(rams[j].baseaddr, rams[j].size)) {
+            getWarningsStream(state) << "ram " << hexval(rams[j].baseaddr)
+                                     << " is not tracked by dirty mask, fall back to full snapshot\n";
+            dirty_page_snapshot = false;
         }
     }
 }
 
+void AFLFuzzer::restoreMemPages(S2EExecutionState *state, uint32_t ram_index, uint32_t offset, uint32_t size) {
+    uint32_t addr = rams[ram_index].baseaddr + offset;
+    if (!state->mem()->write(addr, &mems_snapshot[ram_index][offset], size)) {
+        getWarningsStream(state) << "write mem addr:" << hexval(addr) << " size:" << hexval(size) << " fail!!\n";
+        exit(-1);
+    }
+
+    // the restore bypasses the softmmu, drop the blocks translated from the old contents
+    if (persistent_tb_cache) {
+        se_tb_invalidate_phys_range(addr, size);
+    }
+}
+
 void AFLFuzzer::restoreMemRegSnapShot(S2EExecutionState *state) {
     // ram regions
     for (uint32_t j = 0; j < rams.size(); j++) {
-        for (uint32_t i = 0; i < rams[j].size; i = i+4) {
-            bool ok = state->mem()->write(rams[j].baseaddr + i, &mems_snapshot[j][i/4], sizeof(mems_snapshot[j][i/4]));
-            if (ok) {
-                getDebugStream(state) << "write mem addr:" << hexval(rams[j].baseaddr+i) << " value = " << hexval(mems_snapshot[j][i/4]) << "\n";
-            } else {
-                getWarningsStream(state) << "write mem addr:" << hexval(rams[j].baseaddr+i) << "fail!!\n";
-                exit(-1);
-            }
+        if (!dirty_page_snapshot) {
+            restoreMemPages(state, j, 0, rams[j].size);
+            continue;
+        }
+
+        std::vector<uint64_t> dirty_pages;
+        if (!state->mem()->getDirtyPages(rams[j].baseaddr, rams[j].size, dirty_pages)) {
+            getWarningsStream(state) << "cannot get dirty pages of ram " << hexval(rams[j].baseaddr)
+                                     << ", fall back to full snapshot\n";
+            dirty_page_snapshot = false;
+            restoreMemPages(state, j, 0, rams[j].size);
+            continue;
+        }
+
+        for (auto page : dirty_pages) {
+            // the first and last pages may be partially covered by the ram region
+            uint64_t begin = std::max<uint64_t>(page, rams[j].baseaddr);
+            uint64_t end = std::min<uint64_t>(page + TARGET_PAGE_SIZE, rams[j].baseaddr + rams[j].size);
+            restoreMemPages(state, j, begin - rams[j].baseaddr, end - begin);
         }
+        getDebugStream(state) << "restore " << dirty_pages.size() << " dirty pages of ram " << hexval(rams[j].baseaddr)
+                              << "\n";
+
+        // restoring marks the pages dirty again, start over from the snapshot
+        state->mem()->resetDirtyPages(rams[j].baseaddr, rams[j].size);
     }
 }
 
@@ -549,7 +758,7 @@ void AFLFuzzer::onBlockEnd(S2EExecutionState *state, uint64_t cur_loc, unsigned
         return;
     }
     // uEmu ends up with fuzzer
-    if (unlikely(afl_con->AFL_return == END_uEmu)) {
+    if (unlikely(ring ? afl_ring_load(&ring->stop) : afl_con->AFL_return == END_uEmu)) {
         getInfoStream() << "==== Testing aborted by user via Fuzzer ====\n";
         g_s2e->getCorePlugin()->onEngineShutdown.emit();
         // Flush here just in case ~S2E() is not called (e.g., if atexit()
@@ -576,7 +785,7 @@ void AFLFuzzer::onBlockEnd(S2EExecutionState *state, uint64_t cur_loc, unsigned
     }
 
     // path bitmap
-    if (cur_loc > afl_end_code || cur_loc < afl_start_code || !bitmap)
+    if (cur_loc > afl_end_code || cur_loc < afl_start_code)
         return;
 
     /* Looks like QEMU always maps to fixed locations, so ASAN is not a
@@ -589,29 +798,27 @@ void AFLFuzzer::onBlockEnd(S2EExecutionState *state, uint64_t cur_loc, unsigned
             return;
         } else if (state->regs()->getExceptionIndex() == 15) {
             cur_loc = (cur_loc >> 8) ^ (cur_loc << 4);
-            cur_loc &= MAP_SIZE - 1;
-            cur_loc |= 0x8000;
+            cur_loc &= map_size - 1;
+            cur_loc |= map_size / 2;
             if (cur_loc >= afl_inst_rms)
                 return;
-            if (bitmap[cur_loc]) // only count once for systick irq
-                return;
-            bitmap[cur_loc]++;
+            coverage->hitOnce(cur_loc); // only count once for systick irq
             return;
         }
     }
 
     cur_loc = (cur_loc >> 8) ^ (cur_loc << 4);
-    cur_loc &= MAP_SIZE/2 - 1;
+    cur_loc &= map_size / 2 - 1;
 
     /* Implement probabilistic instrumentation by looking at scrambled block
      address. This keeps the instrumented locations stable across runs. */
 
     if (cur_loc >= afl_inst_rms)
         return;
-    bitmap[cur_loc ^ prev_loc]++;
+    coverage->hit(cur_loc ^ prev_loc);
     prev_loc = cur_loc >> 1;
 
-    // getDebugStream() << "count bitmap = " << count_bytes(bitmap) << "\n";
+    // getDebugStream() << "count bitmap = " << coverage->edges() << "\n";
 
     // crash/hang
     if (timer_ticks > hang_timeout && hit_flag) {
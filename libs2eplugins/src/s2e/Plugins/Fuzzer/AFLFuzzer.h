@@ -10,9 +10,11 @@
 
 #include <s2e/CorePlugin.h>
 #include <s2e/Plugin.h>
+#include <s2e/Plugins/Fuzzer/AFLRing.h>
 #include <s2e/Plugins/uEmu/PeripheralModelLearning.h>
 #include <s2e/S2EExecutionState.h>
 #include <s2e/SymbolicHardwareHook.h>
+#include <s2e/Synchronization.h>
 
 namespace s2e {
 namespace plugins {
@@ -24,17 +26,21 @@ namespace plugins {
 
 #define MAP_SIZE_POW2 16
 #define MAP_SIZE (1 << MAP_SIZE_POW2)
+#define MAP_SIZE_POW2_MAX 20
 /* Environment variable used to pass SHM ID to the called program. */
 #define SHM_ENV_VAR "__AFL_SHM_ID"
 static unsigned int afl_inst_rms = MAP_SIZE;
 static unsigned char *afl_area_ptr;
 static uint8_t *testcase;
-static uint8_t *bitmap;
 struct AFL_data *afl_con;
 static int32_t AFL_shm_id, bitmap_shm_id, testcase_shm_id;
+/* Base SysV keys, worker n of a parallel campaign uses base + n */
 #define AFL_IoT_S2E_KEY 7777
 #define AFL_BITMAP_KEY 8888
 #define AFL_TESTCASE_KEY 9999
+#define AFL_RING_KEY 6666
+/* The bases are 1111 apart, more workers would make the keys of two bases collide */
+#define AFL_MAX_WORKERS (AFL_IoT_S2E_KEY - AFL_RING_KEY)
 #define TESTCASE_SIZE 2048
 void *afl_shm = NULL;
 void *bitmap_shm = NULL;
@@ -66,6 +72,118 @@ enum {
     /* 06 */ INVALIDPH
 };
 
+///
+/// Edge hit counts of the current testcase.
+///
+/// The entries touched since the last clear are recorded, so that clearing,
+/// classifying and publishing the map cost the number of edges hit rather
+/// than the size of the map. Counts saturate at 255 instead of wrapping to 0.
+///
+class CoverageBitmap {
+public:
+    CoverageBitmap() : m_counts(nullptr) {
+    }
+
+    void attach(uint8_t *counts) {
+        m_counts = counts;
+        m_touched.clear();
+    }
+
+    void hit(uint32_t index) {
+        uint8_t &count = m_counts[index];
+        if (!count) {
+            m_touched.push_back(index);
+        }
+        if (count != 0xff) {
+            ++count;
+        }
+    }
+
+    void hitOnce(uint32_t index) {
+        if (!m_counts[index]) {
+            m_counts[index] = 1;
+            m_touched.push_back(index);
+        }
+    }
+
+    void clear() {
+        for (auto index : m_touched) {
+            m_counts[index] = 0;
+        }
+        m_touched.clear();
+    }
+
+    /// Bucket the hit counts like AFL's classify_counts
+    void classify() {
+        for (auto index : m_touched) {
+            m_counts[index] = countClass(m_counts[index]);
+        }
+    }
+
+    /// Copy the map into an AFL trace map that holds the previously published map
+    void publish(uint8_t *trace) {
+        for (auto index : m_published) {
+            trace[index] = 0;
+        }
+        for (auto index : m_touched) {
+            trace[index] = m_counts[index];
+        }
+        m_published = m_touched;
+    }
+
+    size_t edges() const {
+        return m_touched.size();
+    }
+
+    /// Mark the edges of the map in a campaign-wide edge map, returns the number of new edges
+    size_t merge(uint8_t *global) const {
+        size_t ret = 0;
+        for (auto index : m_touched) {
+            if (!__atomic_load_n(&global[index], __ATOMIC_RELAXED) &&
+                !__atomic_exchange_n(&global[index], 1, __ATOMIC_RELAXED)) {
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+private:
+    uint8_t *m_counts;
+    std::vector<uint32_t> m_touched;
+    std::vector<uint32_t> m_published;
+
+    static uint8_t countClass(uint8_t count) {
+        if (count <= 2) {
+            return count;
+        } else if (count == 3) {
+            return 4;
+        } else if (count <= 7) {
+            return 8;
+        } else if (count <= 15) {
+            return 16;
+        } else if (count <= 31) {
+            return 32;
+        } else if (count <= 127) {
+            return 64;
+        }
+        return 128;
+    }
+};
+
+///
+/// Edges covered by all the workers of a parallel campaign, lives in a named
+/// S2ESynchronizedObject. Entries are only ever set, so workers update it
+/// with atomics instead of taking the lock.
+///
+struct AFLSharedCoverage {
+    uint64_t edges;
+    uint8_t map[1 << MAP_SIZE_POW2_MAX];
+
+    // Leave the fields alone so that attaching to an existing object keeps its content,
+    // new shared memory objects are zero-filled
+    AFLSharedCoverage() {
+    }
+};
 
 class AFLFuzzer : public Plugin {
     S2E_PLUGIN
@@ -116,9 +234,26 @@ private:
     uint32_t systick_flag;
     uint32_t max_afl_size;
     bool hit_flag;
-    std::vector<std::vector<uint32_t>> mems_snapshot;
+    bool dirty_page_snapshot; // only restore ram pages written since the fork point
+    bool persistent_tb_cache; // keep translated blocks across testcase resets
+    std::vector<std::vector<uint8_t>> mems_snapshot;
     std::vector<target_ulong> reg_snapshot;
 
+    // testcase exchange through the shared ring of AFLRing.h instead of AFL_data
+    AFL_ring_header *ring;
+    bool ring_busy; // the slot at ring->tail is being executed
+
+    uint32_t map_size;
+    bool classify_counts;                  // bucket hit counts before handing them to AFL
+    CoverageBitmap local_map;              // published to afl_area_ptr, or blocks outside of ring slots
+    std::vector<CoverageBitmap> ring_maps; // one per ring slot trace map
+    CoverageBitmap *coverage;              // map updated by onBlockEnd
+
+    // parallel fuzzing
+    uint32_t worker_id;                                      // offset of the SysV keys of this worker
+    S2ESynchronizedObject<AFLSharedCoverage> *shared_coverage; // edges of all the workers
+    hw::PeripheralModelLearning *peripheral_learning;
+
     void onConcreteDataMemoryAccess(S2EExecutionState *state, uint64_t vaddr, uint64_t value, uint8_t size,
                                     unsigned flags);
     void onInvalidPHs(S2EExecutionState *state, uint64_t addr);
@@ -134,8 +269,14 @@ private:
     void forkPoint(S2EExecutionState *state);
     void saveMemRegSnapShot(S2EExecutionState *state);
     void restoreMemRegSnapShot(S2EExecutionState *state);
+    void restoreMemPages(S2EExecutionState *state, uint32_t ram_index, uint32_t offset, uint32_t size);
     void saveSymRegs(S2EExecutionState *state);
     void restoreSymRegs(S2EExecutionState *state);
+    void setupRing(key_t key, int64_t slot_count, int64_t data_size);
+    bool fetchTestcase(uint8_t **data, uint32_t *size);
+    void completeRingSlot(uint32_t fault);
+    void publishBitmap();
+    void mergeCoverage(const CoverageBitmap &map);
 };
 
 } // namespace plugins
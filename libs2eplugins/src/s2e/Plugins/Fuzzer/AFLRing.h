@@ -0,0 +1,106 @@
+///
+/// Copyright (C) 2010-2015, Dependable Systems Laboratory, EPFL
+/// All rights reserved.
+///
+/// Licensed under the Cyberhaven Research License Agreement.
+///
+
+#ifndef S2E_PLUGINS_AFL_RING_H
+#define S2E_PLUGINS_AFL_RING_H
+
+/*
+ * Shared-memory ring between AFLFuzzer and the AFL front end.
+ *
+ * This header is plain C so that the front end can include it as is.
+ *
+ * Layout of the segment:
+ *   struct AFL_ring_header
+ *   struct AFL_ring_slot slots[slot_count]
+ *   uint8_t trace_maps[slot_count][map_size]
+ *   uint8_t data[data_size]
+ *
+ * The front end is the only writer of head, AFLFuzzer is the only writer
+ * of tail. Both are free-running counters, slot i lives at i % slot_count.
+ * The front end may queue up to slot_count testcases ahead: it copies the
+ * testcase into the data area, fills slots[head % slot_count], then
+ * increments head and wakes up the head futex. AFLFuzzer runs the slot at
+ * tail, writes the coverage into the slot trace map and the fault code into
+ * the slot, then increments tail and wakes up the tail futex. The front end
+ * can collect all the results between its last read and tail at once.
+ *
+ * Testcases are contiguous in the data area and have no size limit other
+ * than data_size. The front end is responsible for not overwriting the data
+ * of slots that were not completed yet.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AFL_RING_MAGIC 0x676e6972 /* "ring" */
+#define AFL_RING_VERSION 1
+
+/* Limits of the segment, both values must also be nonzero */
+#define AFL_RING_MAX_SLOTS 1024
+#define AFL_RING_MAX_DATA_SIZE (1u << 30)
+
+struct AFL_ring_slot {
+    uint32_t offset; /* start of the testcase in the data area */
+    uint32_t size;   /* size of the testcase */
+    uint32_t fault;  /* FAULT_* code, written by AFLFuzzer */
+    uint32_t reserved;
+};
+
+struct AFL_ring_header {
+    uint32_t magic; /* written last by AFLFuzzer once the segment is ready */
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t map_size;
+    uint32_t data_size;
+    uint32_t stop; /* set by the front end to terminate uEmu */
+    uint32_t head; /* testcases queued by the front end */
+    uint32_t tail; /* testcases completed by AFLFuzzer */
+};
+
+static inline size_t afl_ring_size(uint32_t slot_count, uint32_t map_size, uint32_t data_size) {
+    return sizeof(struct AFL_ring_header) + (size_t) slot_count * sizeof(struct AFL_ring_slot) +
+           (size_t) slot_count * map_size + data_size;
+}
+
+static inline struct AFL_ring_slot *afl_ring_slot(struct AFL_ring_header *ring, uint32_t seq) {
+    struct AFL_ring_slot *slots = (struct AFL_ring_slot *) (ring + 1);
+    return &slots[seq % ring->slot_count];
+}
+
+static inline uint8_t *afl_ring_trace_map(struct AFL_ring_header *ring, uint32_t seq) {
+    uint8_t *maps = (uint8_t *) ((struct AFL_ring_slot *) (ring + 1) + ring->slot_count);
+    return maps + (size_t)(seq % ring->slot_count) * ring->map_size;
+}
+
+static inline uint8_t *afl_ring_data(struct AFL_ring_header *ring) {
+    return afl_ring_trace_map(ring, 0) + (size_t) ring->slot_count * ring->map_size;
+}
+
+static inline uint32_t afl_ring_load(const uint32_t *word) {
+    return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+/* Publish a new counter value and wake up the other side */
+static inline void afl_ring_publish(uint32_t *word, uint32_t value) {
+    __atomic_store_n(word, value, __ATOMIC_RELEASE);
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* Sleep until the counter changes from value or the timeout expires */
+static inline void afl_ring_wait(uint32_t *word, uint32_t value, unsigned timeout_ms) {
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+#endif // S2E_PLUGINS_AFL_RING_H
@@ -49,6 +49,13 @@ void ResourceMonitor::initialize() {
     m_cgroupMemLimit = 0;
     m_rss = 0;
 
+    // Merge identical concrete pages of the states once the usage reaches deduplicateThreshold
+    // of the limit, at most every deduplicateInterval seconds
+    m_deduplicatePages = s2e()->getConfig()->getBool(getConfigKey() + ".deduplicatePages", false);
+    m_deduplicateThreshold = s2e()->getConfig()->getDouble(getConfigKey() + ".deduplicateThreshold", 0.85);
+    m_deduplicateInterval = s2e()->getConfig()->getInt(getConfigKey() + ".deduplicateInterval", 60);
+    m_nextDeduplication = std::chrono::steady_clock::now();
+
     bool *notifiedQMP = m_notifiedQMP.acquire();
     *notifiedQMP = false;
     m_notifiedQMP.release();
@@ -109,6 +116,8 @@ void ResourceMonitor::onTimer(void) {
 
     getDebugStream() << "ontimer started\n";
     updateMemoryUsage();
+    deduplicatePages();
+
     if (memoryLimitExceeded()) {
         dropStates();
 
@@ -154,6 +163,27 @@ void ResourceMonitor::updateMemoryUsage() {
     getWarningsStream() << "END\n";
 }
 
+void ResourceMonitor::deduplicatePages() {
+    if (!m_deduplicatePages || m_rss < m_deduplicateThreshold * m_cgroupMemLimit) {
+        return;
+    }
+
+    // Each pass hashes every concrete page of every state
+    auto now = std::chrono::steady_clock::now();
+    if (now < m_nextDeduplication) {
+        return;
+    }
+    m_nextDeduplication = now + std::chrono::seconds(m_deduplicateInterval);
+
+    // This runs on the timer rather than on a background thread, because
+    // address spaces are not thread-safe. Released pages are not returned
+    // to the OS, so the rss does not drop, but the next allocations reuse
+    // them. Merging below the limit lets the states grow into them before
+    // any is dropped.
+    unsigned count = s2e()->getExecutor()->deduplicatePages();
+    getDebugStream() << "ResourceMonitor: merged " << count << " identical pages\n";
+}
+
 void ResourceMonitor::dropStates() {
     S2EExecutor *executor = s2e()->getExecutor();
     assert(executor->getStatesCount() > 0 && "no states left to remove\n");
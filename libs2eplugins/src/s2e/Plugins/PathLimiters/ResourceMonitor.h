@@ -29,6 +29,7 @@
 #include <s2e/S2EExecutionState.h>
 #include <s2e/Synchronization.h>
 
+#include <chrono>
 #include <memory>
 
 namespace s2e {
@@ -46,6 +47,10 @@ private:
     uint64_t m_timerCount;
     uint64_t m_rss;
     uint64_t m_cgroupMemLimit;
+    bool m_deduplicatePages;
+    double m_deduplicateThreshold;
+    unsigned m_deduplicateInterval;
+    std::chrono::steady_clock::time_point m_nextDeduplication;
     std::string m_memStatFileName;
     S2ESynchronizedObject<bool> m_notifiedQMP;
 
@@ -53,6 +58,7 @@ private:
     void onTimer(void);
     void updateMemoryUsage();
     bool memoryLimitExceeded();
+    void deduplicatePages();
     void dropStates();
     void emitQMPNofitication();
 };
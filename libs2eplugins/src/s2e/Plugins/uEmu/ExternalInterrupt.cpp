@@ -5,6 +5,8 @@
 /// Licensed under the Cyberhaven Research License Agreement.
 ///
 
+#include <string.h>
+
 #include <s2e/ConfigFile.h>
 #include <s2e/S2E.h>
 #include <s2e/SymbolicHardwareHook.h>
@@ -24,8 +26,7 @@ private:
     uint64_t tb_count;
     uint64_t re_tb_count;
     uint64_t new_tb_count;
-    std::vector<uint32_t> last_irqs_bitmap;
-    std::map<uint32_t /* external irq no */, bool /*enable*/> active_irqs;
+    ExternalIrqSchedule active_irqs;
     bool disable_systick; // per state
     bool enable_interrupt;
     TBCounts new_tb_map;
@@ -37,9 +38,6 @@ public:
         new_tb_map.clear();
         disable_systick = true;
         enable_interrupt = false;
-        last_irqs_bitmap.push_back(0);
-        last_irqs_bitmap.push_back(0);
-        last_irqs_bitmap.push_back(0);
     }
 
     virtual ~ExternalInterruptState() {
@@ -92,26 +90,25 @@ public:
         return enable_interrupt;
     }
 
-    void insert_lastirqs_bitmap(std::vector<uint32_t> irqsbitmap) {
-        last_irqs_bitmap = irqsbitmap;
-    }
-
-    std::vector<uint32_t> get_lastirqs_bitmap() {
-        return last_irqs_bitmap;
-    }
-
-    void update_activeirqs(std::map<uint32_t, bool> activeirqs) {
-        active_irqs = activeirqs;
+    ExternalIrqSchedule &get_activeirqs() {
+        return active_irqs;
     }
+};
 
-    void insert_activeirqs(uint32_t irq_no) {
-        active_irqs[irq_no] = true;
+bool ExternalIrqSchedule::update(const uint32_t *bitmap) {
+    if (!memcmp(m_bitmap, bitmap, sizeof(m_bitmap))) {
+        return false;
     }
 
-    std::map<uint32_t, bool> get_activeirqs() {
-        return active_irqs;
+    memcpy(m_bitmap, bitmap, sizeof(m_bitmap));
+    m_count = 0;
+    for (unsigned i = 0; i < EXTERNAL_IRQ_WORDS; ++i) {
+        for (uint32_t word = m_bitmap[i]; word; word &= word - 1) {
+            m_irqs[m_count++] = i * 32 + __builtin_ctz(word);
+        }
     }
-};
+    return true;
+}
 
 void ExternalInterrupt::initialize() {
     s2e()->getCorePlugin()->onTranslateBlockStart.connect(
@@ -133,10 +130,24 @@ void ExternalInterrupt::initialize() {
     }
 
     ConfigFile *cfg = s2e()->getConfig();
+    memset(disable_irqs, 0, sizeof(disable_irqs));
     auto disableirqs = cfg->getIntegerList(getConfigKey() + ".disableIrqs");
     foreach2 (it, disableirqs.begin(), disableirqs.end()) {
         getDebugStream() << "Add disable irqs = " << hexval(*it) << "\n";
-        disable_irqs.push_back(*it);
+        if (*it < 0 || *it >= EXTERNAL_IRQ_NUM) {
+            getWarningsStream() << "Ignoring disabled irq " << *it << " out of the range of the NVIC\n";
+            continue;
+        }
+        disable_irqs[*it / 32] |= 1u << (*it % 32);
+    }
+
+    // flat tb counters for the firmware code, tbs start on halfword boundaries
+    rom_baseaddr = 0;
+    if (cfg->getListSize("mem.rom") > 0) {
+        rom_baseaddr = cfg->getInt("mem.rom[1][1]", 0, &ok);
+        uint32_t rom_size = cfg->getInt("mem.rom[1][2]", 0, &ok);
+        rom_tb_map.resize(rom_size / 2);
+        getDebugStream() << "count tbs of rom " << hexval(rom_baseaddr) << " size " << hexval(rom_size) << "\n";
     }
 
     systick_disable_flag = s2e()->getConfig()->getBool(getConfigKey() + ".disableSystickInterrupt", false);
@@ -157,14 +168,33 @@ void ExternalInterrupt::recordTBMap() {
     std::ofstream fTBmap;
     fTBmap.open(fileName, std::ios::out | std::ios::trunc);
 
-    for (auto ittb : all_tb_map) {
-        if (ittb.second > 0)
-            fTBmap << hexval(ittb.first)  << " " << ittb.second << std::endl;;
+    auto ittb = all_tb_map.begin();
+    for (; ittb != all_tb_map.end() && ittb->first < rom_baseaddr; ++ittb) {
+        if (ittb->second > 0)
+            fTBmap << hexval(ittb->first) << " " << ittb->second << std::endl;
+    }
+
+    for (size_t i = 0; i < rom_tb_map.size(); ++i) {
+        if (rom_tb_map[i] > 0)
+            fTBmap << hexval(rom_baseaddr + i * 2) << " " << rom_tb_map[i] << std::endl;
+    }
+
+    for (; ittb != all_tb_map.end(); ++ittb) {
+        if (ittb->second > 0)
+            fTBmap << hexval(ittb->first) << " " << ittb->second << std::endl;
     }
 
     fTBmap.close();
 }
 
+uint32_t &ExternalInterrupt::getTBCount(uint32_t pc) {
+    uint32_t offset = pc - rom_baseaddr;
+    if (offset / 2 < rom_tb_map.size()) {
+        return rom_tb_map[offset / 2];
+    }
+    return all_tb_map[pc];
+}
+
 void ExternalInterrupt::onuEmuShutdown() {
     if (g_s2e_cache_mode) {
         recordTBMap();
@@ -178,19 +208,6 @@ void ExternalInterrupt::onTranslateBlockStart(ExecutionSignal *signal, S2EExecut
     signal->connect(sigc::mem_fun(*this, &ExternalInterrupt::onBlockStart));
 }
 
-std::map<uint32_t, bool> setActiveIrqs(std::vector<uint32_t> irqs_bitmap) {
-    std::map<uint32_t /* external irq no */, bool /*enable*/> active_irqs;
-
-    for (int i = 0; i < irqs_bitmap.size(); i++) {
-        for (int j = 0; j < 32; j++) {
-            if (irqs_bitmap[i] & (1 << j)) {
-                active_irqs[i * 32 + j] = true;
-            }
-        }
-    }
-    return active_irqs;
-}
-
 void ExternalInterrupt::onBlockStart(S2EExecutionState *state, uint64_t pc) {
     DECLARE_PLUGINSTATE(ExternalInterruptState, state);
 
@@ -206,10 +223,11 @@ void ExternalInterrupt::onBlockStart(S2EExecutionState *state, uint64_t pc) {
     plgState->inc_tb_num(pc);
 
     // record total bb number
-    if (all_tb_map[pc] < 1) {
+    uint32_t &tb_count = getTBCount(pc);
+    if (tb_count < 1) {
         ++unique_tb_num;
     }
-    ++all_tb_map[pc];
+    ++tb_count;
 
     if (!g_s2e_cache_mode) { // learning mode only
         // in case no external irqs
@@ -231,65 +249,52 @@ void ExternalInterrupt::onBlockStart(S2EExecutionState *state, uint64_t pc) {
         }
     }
 
-    std::vector<uint32_t> irqs_bitmap;
-    std::vector<uint32_t> last_irqs_bitmap;
     if (plgState->get_tb_num() % tb_interval == 0) {
-        irqs_bitmap.push_back(s2e()->getExecutor()->getActiveExternalInterrupt(0));
-        getDebugStream() << "external bit map = " << hexval(irqs_bitmap[0]) << "\n";
-        irqs_bitmap.push_back(s2e()->getExecutor()->getActiveExternalInterrupt(4));
-        getDebugStream() << "external bit map 2 = " << hexval(irqs_bitmap[1]) << "\n";
-        irqs_bitmap.push_back(s2e()->getExecutor()->getActiveExternalInterrupt(8));
-        getDebugStream() << "external bit map 3 = " << hexval(irqs_bitmap[2]) << "\n";
-
-        last_irqs_bitmap = plgState->get_lastirqs_bitmap();
-        for (int k = 0; k < irqs_bitmap.size(); k++) {
-            if (last_irqs_bitmap[k] != irqs_bitmap[k]) {
-                getInfoStream() << "active irq has changed\n";
-                getInfoStream() << "last external irq bit map = " << hexval(last_irqs_bitmap[0]) << "\n";
-                getInfoStream() << "last external irq bit map 2 = " << hexval(last_irqs_bitmap[1]) << "\n";
-                getInfoStream() << "last external irq bit map 3 = " << hexval(last_irqs_bitmap[2]) << "\n";
-                plgState->insert_lastirqs_bitmap(irqs_bitmap);
-                plgState->update_activeirqs(setActiveIrqs(irqs_bitmap));
-                break;
+        uint32_t irqs_bitmap[EXTERNAL_IRQ_WORDS];
+        for (unsigned k = 0; k < EXTERNAL_IRQ_WORDS; ++k) {
+            irqs_bitmap[k] = s2e()->getExecutor()->getActiveExternalInterrupt(k * 4);
+        }
+
+        ExternalIrqSchedule &active_irqs = plgState->get_activeirqs();
+        const uint32_t *last_irqs_bitmap = active_irqs.bitmap();
+        if (memcmp(last_irqs_bitmap, irqs_bitmap, sizeof(irqs_bitmap))) {
+            getInfoStream() << "active irq has changed\n";
+            for (unsigned k = 0; k < EXTERNAL_IRQ_WORDS; ++k) {
+                getInfoStream() << "last external irq bit map " << k + 1 << " = " << hexval(last_irqs_bitmap[k])
+                                << " new = " << hexval(irqs_bitmap[k]) << "\n";
             }
+            active_irqs.update(irqs_bitmap);
         }
 
-        int i = 0;
-        for (auto it : plgState->get_activeirqs()) {
-            if ((plgState->get_tb_num() / tb_interval) % plgState->get_activeirqs().size() == i) {
-                if (state->regs()->getInterruptFlag() && state->regs()->getExceptionIndex() == (it.first + 16)) {
-                    getDebugStream() << i << " should not happen pc = " << hexval(pc) << "irq num"
-                                     << state->regs()->getExceptionIndex() << "\n";
-                    ++i;
-                    continue;
-                }
-                if (!g_s2e_cache_mode) {
-                    // plgState->cachepirq(it.first);
-                    getInfoStream() << i << " trigger external irq " << it.first << " total irq number is "
-                                        << plgState->get_activeirqs().size()
-                                        << "total tb num = " << plgState->get_tb_num() << "\n";
-                    if (std::find(disable_irqs.begin(), disable_irqs.end(), it.first) == disable_irqs.end()) {
-                        ++i;
-                        s2e()->getExecutor()->setExternalInterrupt(it.first);
-                    } else {
-                        getWarningsStream() << " cannot trigger external irq " << it.first << " which has been disable\n";
-                        ++i;
-                        continue;
-                    }
-                } else {
-                    if (std::find(disable_irqs.begin(), disable_irqs.end(), it.first) == disable_irqs.end()) {
-                        getDebugStream() << " trigger external irq " << it.first
-                                         << "total tb num = " << plgState->get_tb_num() << "\n";
-                        ++i;
-                        s2e()->getExecutor()->setExternalInterrupt(it.first);
-                    } else {
-                        ++i;
-                        continue;
-                    }
-                }
+        if (active_irqs.size() == 0) {
+            return;
+        }
+
+        // one external irq per interval, in round robin
+        uint64_t round = plgState->get_tb_num() / tb_interval;
+        uint32_t irq_no = active_irqs.irq(round);
+        unsigned i = round % active_irqs.size();
+        if (state->regs()->getInterruptFlag() && state->regs()->getExceptionIndex() == (irq_no + 16)) {
+            getDebugStream() << i << " should not happen pc = " << hexval(pc) << "irq num"
+                             << state->regs()->getExceptionIndex() << "\n";
+            return;
+        }
+
+        if (!g_s2e_cache_mode) {
+            getInfoStream() << i << " trigger external irq " << irq_no << " total irq number is " << active_irqs.size()
+                            << "total tb num = " << plgState->get_tb_num() << "\n";
+            if (isIrqDisabled(irq_no)) {
+                getWarningsStream() << " cannot trigger external irq " << irq_no << " which has been disable\n";
+                return;
+            }
+        } else {
+            if (isIrqDisabled(irq_no)) {
+                return;
             }
-            ++i;
-        } // each exteranl irq trigger
+            getDebugStream() << " trigger external irq " << irq_no << "total tb num = " << plgState->get_tb_num()
+                             << "\n";
+        }
+        s2e()->getExecutor()->setExternalInterrupt(irq_no);
     }     // each interval
 }
 
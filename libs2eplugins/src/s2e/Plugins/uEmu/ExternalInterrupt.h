@@ -17,6 +17,43 @@ namespace s2e {
 namespace plugins {
 typedef std::map<uint32_t, uint32_t> TBCounts;
 
+// NVIC enable registers polled by the scheduler (ISER0-ISER2)
+#define EXTERNAL_IRQ_WORDS 3
+#define EXTERNAL_IRQ_NUM (EXTERNAL_IRQ_WORDS * 32)
+
+///
+/// \brief Round-robin schedule of the enabled external irqs
+///
+/// The enabled irqs are kept as a bitmask together with the list of their
+/// numbers, which is only rebuilt when the bitmask changes. The irq for a
+/// given round is a direct lookup in that list.
+///
+class ExternalIrqSchedule {
+private:
+    uint32_t m_bitmap[EXTERNAL_IRQ_WORDS];
+    uint8_t m_irqs[EXTERNAL_IRQ_NUM];
+    unsigned m_count;
+
+public:
+    ExternalIrqSchedule() : m_bitmap(), m_irqs(), m_count(0) {
+    }
+
+    /// Returns true if the set of enabled irqs changed
+    bool update(const uint32_t *bitmap);
+
+    const uint32_t *bitmap() const {
+        return m_bitmap;
+    }
+
+    unsigned size() const {
+        return m_count;
+    }
+
+    uint32_t irq(uint64_t round) const {
+        return m_irqs[round % m_count];
+    }
+};
+
 class ExternalInterrupt : public Plugin {
     S2E_PLUGIN
 public:
@@ -28,13 +65,20 @@ private:
     uint32_t tb_interval;
     uint32_t tb_scale;
     bool systick_disable_flag; // used for state 0
-    std::vector<uint32_t> disable_irqs;
+    uint32_t disable_irqs[EXTERNAL_IRQ_WORDS];
     uint64_t systick_begin_point;
+    // executed count of each tb start address, flat for the firmware rom and sparse elsewhere
+    uint32_t rom_baseaddr;
+    std::vector<uint32_t> rom_tb_map;
     TBCounts all_tb_map;
     uint64_t unique_tb_num; // new tb number
 
     void onuEmuShutdown();
     void recordTBMap();
+    uint32_t &getTBCount(uint32_t pc);
+    bool isIrqDisabled(uint32_t irq_no) const {
+        return irq_no < EXTERNAL_IRQ_NUM && (disable_irqs[irq_no / 32] & (1u << (irq_no % 32)));
+    }
     void onTranslateBlockStart(ExecutionSignal *signal, S2EExecutionState *state, TranslationBlock *tb, uint64_t pc);
     void onBlockStart(S2EExecutionState *state, uint64_t pc);
 };
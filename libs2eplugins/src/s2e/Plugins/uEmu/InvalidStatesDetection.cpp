@@ -10,6 +10,7 @@
 #include <s2e/opcodes.h>
 
 #include <iostream>
+#include <string.h>
 
 #include <s2e/ConfigFile.h>
 #include <s2e/S2E.h>
@@ -28,8 +29,12 @@ namespace {
 
 class InvalidStatesDetectionState : public PluginState {
 private:
-    CacheConregs cacheconregs;
-    CacheConregs loopconregs;
+    // ring of the last max_cache_tb_num blocks, block seq lives at seq % size
+    std::vector<TBRegs> cacheconregs;
+    uint64_t cache_seq; // number of blocks inserted so far
+    // blocks of the cache still to be matched by the current loop
+    uint64_t loop_seq;
+    uint64_t loop_end_seq;
     // add count limit
     std::map<UniquePcRegMap, uint32_t /* count */> reg_loop_count;
     std::map<UniquePcRegMap, std::deque<int> /* reg_value */> re_reg_map;
@@ -50,14 +55,21 @@ public:
         return new InvalidStatesDetectionState(*this);
     }
 
+    // Forked states often die before running a block, don't copy the
+    // block caches for them
+    virtual bool isCopyOnWrite() const {
+        return true;
+    }
+
     InvalidStatesDetectionState() {
         tb_num = 0;
         new_tb_num = 0;
         re_tb_num = 0;
         loopcmpflag = false;
         enable_kill = false;
-        cacheconregs.clear();
-        loopconregs.clear();
+        cache_seq = 0;
+        loop_seq = 0;
+        loop_end_seq = 0;
         new_tb_map.clear();
     }
 
@@ -73,8 +85,9 @@ public:
         re_tb_num = 0;
         loopcmpflag = false;
         enable_kill = false;
-        cacheconregs.clear();
-        loopconregs.clear();
+        cache_seq = 0;
+        loop_seq = 0;
+        loop_end_seq = 0;
     }
 
     void inckpcount(uint32_t pc) {
@@ -117,21 +130,22 @@ public:
         return enable_kill;
     }
 
-    void assignloopregs(uint32_t i) {
-        // already judge first one continue will the second
-        loopconregs.assign(cacheconregs.begin() + i, cacheconregs.end());
+    void assignloopregs(uint64_t seq) {
+        // already judge first one continue will the second, up to the current tb
+        loop_seq = seq + 1;
+        loop_end_seq = cache_seq;
     }
 
-    ConRegs getcurloopregs() {
-        return loopconregs.at(0);
+    const TBRegs &getcurloopregs() const {
+        return getcachedtb(loop_seq);
     }
 
     void poploopregs() {
-        loopconregs.pop_front();
+        ++loop_seq;
     }
 
-    uint32_t getloopsize() {
-        return loopconregs.size();
+    uint32_t getloopsize() const {
+        return loop_end_seq - loop_seq;
     }
 
     void setloopflag(bool loop_cmp_flag) {
@@ -151,6 +165,12 @@ public:
     }
 
     void setcachenum(uint32_t cache_tb_num) {
+        if (cacheconregs.size() != cache_tb_num) {
+            cacheconregs.resize(cache_tb_num);
+            cache_seq = 0;
+            loop_seq = 0;
+            loop_end_seq = 0;
+        }
         max_cache_tb_num = cache_tb_num;
     }
 
@@ -174,45 +194,40 @@ public:
         }
     }
 
-    uint64_t getnewtbnum() {
+    uint64_t getnewtbnum() const {
         return new_tb_num;
     }
 
-    uint64_t gettbnum() {
+    uint64_t gettbnum() const {
         return tb_num;
     }
 
-    uint64_t getretbnum() {
+    uint64_t getretbnum() const {
         return re_tb_num;
     }
 
-    void inserttbregs(ConRegs regs) {
-        if (cacheconregs.size() < max_cache_tb_num) {
-            cacheconregs.push_back(regs);
-        } else {
-            cacheconregs.pop_front();
-            cacheconregs.push_back(regs);
-        }
-    }
-
-    uint32_t getcachesize() {
-        return cacheconregs.size();
+    // overwrites the oldest block once the cache is full
+    void inserttbregs(const TBRegs &regs) {
+        cacheconregs[cache_seq % max_cache_tb_num] = regs;
+        ++cache_seq;
     }
 
-    ConRegs getcurtbregs(uint32_t cachePos) {
-        return cacheconregs.at(cachePos);
+    uint32_t getcachesize() const {
+        return std::min<uint64_t>(cache_seq, max_cache_tb_num);
     }
 
-    uint32_t getcurtbpc(uint32_t cachePos) {
-        return cacheconregs.at(cachePos)[0];
+    // seq of the oldest block in the cache
+    uint64_t getcachestart() const {
+        return cache_seq - getcachesize();
     }
 
-    uint32_t getcurtbmode(uint32_t cachePos) {
-        return cacheconregs.at(cachePos)[1];
+    // seq one past the newest block in the cache
+    uint64_t getcacheend() const {
+        return cache_seq;
     }
 
-    uint32_t getcurtbregssize(uint32_t cachePos) {
-        return cacheconregs.at(cachePos).size();
+    const TBRegs &getcachedtb(uint64_t seq) const {
+        return cacheconregs[seq % max_cache_tb_num];
     }
 
     void insert_current_irq_num(uint32_t irq_num) {
@@ -300,23 +315,51 @@ template <typename T> static bool getConcolicValue(S2EExecutionState *state, uns
     return true;
 }
 
-static std::vector<uint32_t> getRegs(S2EExecutionState *state, uint32_t pc) {
-    std::vector<uint32_t> conregs;
-    bool mode = g_s2e_fast_concrete_invocation;
+static void getRegs(S2EExecutionState *state, uint32_t pc, TBRegs *conregs) {
+    const unsigned count = sizeof(conregs->regs) / sizeof(conregs->regs[0]);
 
-    conregs.push_back(pc);
-    conregs.push_back(mode);
-    for (unsigned i = 0; i < 15; ++i) {
-        unsigned offset = offsetof(CPUARMState, regs[i]);
-        target_ulong concreteData;
+    conregs->pc = pc;
+    conregs->mode = g_s2e_fast_concrete_invocation;
 
-        // if (state->regs()->read(offset, &concreteData, sizeof(concreteData), false)) {
-        getConcolicValue(state, offset, &concreteData);
-        conregs.push_back(concreteData);
-        // }
+    // Registers are usually all concrete, read them in one go from the cpu state
+    // and only evaluate them one by one if some of them are symbolic
+    if (!state->regs()->read(offsetof(CPUARMState, regs), conregs->regs, sizeof(conregs->regs), false)) {
+        for (unsigned i = 0; i < count; ++i) {
+            getConcolicValue(state, offsetof(CPUARMState, regs) + i * sizeof(uint32_t), &conregs->regs[i]);
+        }
     }
 
-    return conregs;
+    // FNV-1a over pc and registers
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = (hash ^ pc) * 0x100000001b3ULL;
+    for (unsigned i = 0; i < count; ++i) {
+        hash = (hash ^ conregs->regs[i]) * 0x100000001b3ULL;
+    }
+    conregs->hash = hash;
+}
+
+// Index of the first different field in the (pc, mode, r0, ..., r14) layout,
+// or 2 + number of registers if both blocks are identical
+static unsigned getFirstDiffReg(const TBRegs &a, const TBRegs &b, bool skip_mode) {
+    const unsigned count = sizeof(a.regs) / sizeof(a.regs[0]);
+
+    if (a.pc != b.pc) {
+        return 0;
+    }
+    if (!skip_mode && a.mode != b.mode) {
+        return 1;
+    }
+    // the hash only filters out different blocks, colliding ones must match register by register
+    if (a.hash == b.hash && !memcmp(a.regs, b.regs, sizeof(a.regs))) {
+        return count + 2;
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        if (a.regs[i] != b.regs[i]) {
+            return i + 2;
+        }
+    }
+    return count + 2;
 }
 
 void InvalidStatesDetection::onCacheModeMonitor(S2EExecutionState *state, uint64_t pc) {
@@ -358,7 +401,7 @@ void InvalidStatesDetection::onCacheModeMonitor(S2EExecutionState *state, uint64
 
 void InvalidStatesDetection::onInvalidStatesKill(S2EExecutionState *state, uint64_t pc, InvalidStatesType type,
                                                  std::string reason_str) {
-    DECLARE_PLUGINSTATE(InvalidStatesDetectionState, state);
+    DECLARE_PLUGINSTATE_CONST(InvalidStatesDetectionState, state);
 
     onInvalidStatesEvent.emit(state, pc, type, plgState->getnewtbnum());
     std::string s;
@@ -430,7 +473,7 @@ void InvalidStatesDetection::onKillandAlivePoints(S2EExecutionState *state, uint
 }
 
 void InvalidStatesDetection::onInvalidPCAccess(S2EExecutionState *state, uint64_t addr) {
-    DECLARE_PLUGINSTATE(InvalidStatesDetectionState, state);
+    DECLARE_PLUGINSTATE_CONST(InvalidStatesDetectionState, state);
     if (!init_cache_mode) {
         getWarningsStream() << "Invalid memory (" << hexval(addr) << ") access\n";
         std::string reason_str = "Kill State due to invalid memory access:";
@@ -487,10 +530,11 @@ void InvalidStatesDetection::onInvalidLoopDetection(S2EExecutionState *state, ui
 
     plgState->setmaxloopnum(max_loop_tb_num);
     plgState->setcachenum(cache_tb_num);
-    std::vector<uint32_t> conregs = getRegs(state, pc);
+    TBRegs conregs;
+    getRegs(state, pc, &conregs);
 
     getInfoStream(state) << state->regs()->getInterruptFlag() << " current pc = " << hexval(pc) << " re tb num "
-                             << plgState->getretbnum() << " concrete mode: " << conregs[1] << "\n";
+                             << plgState->getretbnum() << " concrete mode: " << conregs.mode << "\n";
 
     // kill points defined by users
     if (kill_point_flag) {
@@ -519,21 +563,15 @@ void InvalidStatesDetection::onInvalidLoopDetection(S2EExecutionState *state, ui
 
     // if already at least on tb is same, compare other tbs in loop
     if (plgState->getloopflag()) {
-        std::vector<uint32_t> loopregs = plgState->getcurloopregs();
-        int k;
-        for (k = 0; k < conregs.size(); ++k) {
-            if (loopregs[k] == conregs[k] || k == 1) {
-                continue;
-            } else {
-                break;
-            }
-        }
+        const TBRegs &loopregs = plgState->getcurloopregs();
+        const unsigned size = sizeof(conregs.regs) / sizeof(conregs.regs[0]) + 2;
+        unsigned k = getFirstDiffReg(loopregs, conregs, true);
 
-        if (k == conregs.size()) {
+        if (k == size) {
             plgState->poploopregs();
 
             // at least one tb is symbolic
-            if (conregs[1] == 0) {
+            if (conregs.mode == 0) {
                 plgState->setmodeflag(true);
             }
 
@@ -554,11 +592,14 @@ void InvalidStatesDetection::onInvalidLoopDetection(S2EExecutionState *state, ui
                 return;
             }
         } else {
-            getDebugStream() << " state: " << state->getID() << " loop reg " << k - 2 << " = " << hexval(loopregs[k])
-                             << " cache reg = " << k - 2 << " is " << hexval(conregs[k]) << " different \n";
+            if (k > 1) {
+                getDebugStream() << " state: " << state->getID() << " loop reg " << k - 2 << " = "
+                                 << hexval(loopregs.regs[k - 2]) << " cache reg = " << k - 2 << " is "
+                                 << hexval(conregs.regs[k - 2]) << " different \n";
+            }
             if (k > 1 && !state->regs()->getInterruptFlag()) {
                 UniquePcRegMap uniquepcregmap = std::make_pair(pc, k - 2);
-                if (plgState->judgelongloopregs(uniquepcregmap, conregs[k])) {
+                if (plgState->judgelongloopregs(uniquepcregmap, conregs.regs[k - 2])) {
                     plgState->setloopflag(false);
                     std::string reason_str = "Kill State due to long loop (multi-tbs): ";
                     onInvalidStatesKill(state, pc, LL2, reason_str);
@@ -571,25 +612,15 @@ void InvalidStatesDetection::onInvalidLoopDetection(S2EExecutionState *state, ui
     }
 
     // if we find at least on tb is different in loop, then we continue compare other cache tb
-    int i, j;
+    const unsigned size = sizeof(conregs.regs) / sizeof(conregs.regs[0]) + 2;
     std::tuple<uint32_t /* pc */, uint32_t /* reg_num */, uint32_t /* value */> last_re_reg_map;
-    for (i = 0; i < plgState->getcachesize(); ++i) {
-        if (conregs.size() != plgState->getcurtbregssize(i)) {
-            continue;
-        }
-        std::vector<uint32_t> cacheregs = plgState->getcurtbregs(i);
-        // already compare pc and mode, so j begin with 2
-        for (j = 0; j < conregs.size(); ++j) {
-            if (cacheregs[j] == conregs[j]) {
-                continue;
-            } else {
-                break;
-            }
-        }
+    for (uint64_t i = plgState->getcachestart(); i < plgState->getcacheend(); ++i) {
+        const TBRegs &cacheregs = plgState->getcachedtb(i);
+        unsigned j = getFirstDiffReg(cacheregs, conregs, false);
 
-        if (j == conregs.size()) { // TODO: if only one reg is different, we should also go to long loop check.
-            if (i == plgState->getcachesize() - 1) {
-                if (conregs[1] == 0) {
+        if (j == size) { // TODO: if only one reg is different, we should also go to long loop check.
+            if (i == plgState->getcacheend() - 1) {
+                if (conregs.mode == 0) {
                     // only one tb in loop, kill directly if it is in symbolic mode
                     std::string reason_str = "Kill State due to Dead Loop (single tb): ";
                     single_dead_loop[pc]++;
@@ -605,21 +636,22 @@ void InvalidStatesDetection::onInvalidLoopDetection(S2EExecutionState *state, ui
                     return;
                 }
             } else {
-                if (conregs[1] == 0) {
+                if (conregs.mode == 0) {
                     plgState->setmodeflag(true);
                 } else {
                     plgState->setmodeflag(false);
                 }
+                getDebugStream(state) << " Same as the " << i - plgState->getcachestart()
+                                      << " current pc = " << hexval(pc) << " cachereg pc = " << hexval(cacheregs.pc)
+                                      << " \n";
                 plgState->inserttbregs(conregs); // insert current tb before assign loop tb
                 plgState->assignloopregs(i);     // assign loop tb
                 plgState->setloopflag(true);     // next round compare loop tb first
-                getDebugStream(state) << " Same as the " << i << " current pc = " << hexval(pc)
-                                      << " cachereg pc = " << hexval(cacheregs[0]) << " \n";
                 return;
             }
         } else {
             if (j > 1 && plgState->getnewtbnum() > 200) {
-                last_re_reg_map = std::make_tuple(pc, j - 2, conregs[j]);
+                last_re_reg_map = std::make_tuple(pc, j - 2, conregs.regs[j - 2]);
             }
         }
     }
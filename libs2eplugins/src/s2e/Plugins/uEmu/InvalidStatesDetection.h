@@ -18,8 +18,20 @@
 namespace s2e {
 namespace plugins {
 typedef std::pair<uint32_t /* pc */, uint32_t /* reg num */> UniquePcRegMap;
-typedef std::vector<uint32_t> ConRegs;
-typedef std::deque<ConRegs> CacheConregs;
+
+///
+/// \brief Fingerprint of the cpu state at the end of a translation block
+///
+/// Two blocks are considered identical when their pc, mode and registers match.
+/// The hash rules out most different blocks without comparing the registers.
+///
+struct TBRegs {
+    uint64_t hash; // pc and register file
+    uint32_t pc;
+    uint32_t mode; // 1 if the block was executed in concrete mode
+    uint32_t regs[15];
+};
+
 typedef std::map<uint32_t, uint32_t> TBCounts;
 enum InvalidStatesType { DL1, DL2, LL1, LL2, UKP, IM };
 
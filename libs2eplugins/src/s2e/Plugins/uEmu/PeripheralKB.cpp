@@ -0,0 +1,422 @@
+///
+/// Copyright (C) 2017, Cyberhaven
+/// All rights reserved.
+///
+/// Licensed under the Cyberhaven Research License Agreement.
+///
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+
+#include <s2e/Utils.h>
+
+#include "PeripheralKB.h"
+
+namespace s2e {
+namespace plugins {
+namespace hw {
+
+static const char *getKBKindName(uint32_t kind) {
+    switch (kind) {
+        case KB_T0:
+            return "t0";
+        case KB_T1:
+            return "t1";
+        case KB_PT1:
+            return "pt1";
+        case KB_DT1:
+            return "dt1";
+        case KB_T2:
+            return "t2";
+        case KB_T3:
+            return "t3";
+        case KB_TIRQS:
+            return "tirqs";
+        case KB_TIRQC:
+            return "tirqc";
+        case KB_FUZZ:
+            return "fuzz";
+        case KB_FUZZC:
+            return "fuzzc";
+        default:
+            return "unknown";
+    }
+}
+
+std::string formatKBRecord(const PeripheralKBRecord &rec) {
+    std::stringstream ss;
+    ss << getKBKindName(rec.kind) << "_";
+
+    switch (rec.kind) {
+        case KB_TIRQC:
+            ss << hexval(rec.cw_value) << "_" << hexval(rec.phaddr) << "_" << hexval(rec.cr_phaddr) << "_"
+               << hexval(rec.cr_value) << "_" << hexval(rec.value);
+            break;
+        case KB_FUZZ:
+        case KB_FUZZC:
+            ss << hexval(rec.phaddr) << "_" << hexval(rec.pc) << "_" << hexval(rec.value);
+            break;
+        case KB_T3:
+            // the order of t3 values has always been written in decimal
+            ss << hexval(rec.phaddr) << "_" << hexval(rec.pc) << "_" << rec.cw_value << "_" << hexval(rec.value);
+            break;
+        default:
+            ss << hexval(rec.phaddr) << "_" << hexval(rec.pc) << "_" << hexval(rec.cw_value) << "_"
+               << hexval(rec.value);
+            break;
+    }
+
+    return ss.str();
+}
+
+// Sections of the text KB, each one starts before the first record of the given kind
+static const std::pair<uint32_t, const char *> s_kbSections[] = {
+    {KB_TIRQC, "IRQCR"}, {KB_FUZZ, "DefaultDataRegs"}, {KB_FUZZC, "CandidateDataRegs"}};
+
+bool parseKBRecord(const std::string &line, PeripheralKBRecord *rec) {
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, '_')) {
+        fields.push_back(field);
+    }
+
+    if (fields.empty()) {
+        return false;
+    }
+
+    uint32_t kind = KB_T0;
+    while (kind <= KB_FUZZC && fields[0] != getKBKindName(kind)) {
+        ++kind;
+    }
+    if (kind > KB_FUZZC) {
+        return false;
+    }
+
+    size_t expected = kind == KB_TIRQC ? 6 : (kind == KB_FUZZ || kind == KB_FUZZC) ? 4 : 5;
+    if (fields.size() != expected) {
+        return false;
+    }
+
+    std::vector<uint64_t> values;
+    try {
+        for (size_t i = 1; i < fields.size(); ++i) {
+            // the order of t3 values is written in decimal, see formatKBRecord
+            int base = kind == KB_T3 && i == 3 ? 10 : 16;
+            values.push_back(std::stoull(fields[i], nullptr, base));
+        }
+    } catch (std::exception &) {
+        return false;
+    }
+
+    *rec = PeripheralKBRecord();
+    rec->kind = kind;
+    if (kind == KB_TIRQC) {
+        rec->cw_value = values[0];
+        rec->phaddr = values[1];
+        rec->cr_phaddr = values[2];
+        rec->cr_value = values[3];
+        rec->value = values[4];
+    } else if (kind == KB_FUZZ || kind == KB_FUZZC) {
+        rec->phaddr = values[0];
+        rec->pc = values[1];
+        rec->value = values[2];
+    } else {
+        rec->phaddr = values[0];
+        rec->pc = values[1];
+        rec->cw_value = values[2];
+        rec->value = values[3];
+    }
+
+    return true;
+}
+
+bool isBinaryKB(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    uint32_t magic = 0;
+    bool ret = ::read(fd, &magic, sizeof(magic)) == sizeof(magic) && magic == PERIPHERAL_KB_MAGIC;
+    ::close(fd);
+    return ret;
+}
+
+static bool writeAll(int fd, const void *buffer, size_t size) {
+    const uint8_t *ptr = static_cast<const uint8_t *>(buffer);
+    while (size > 0) {
+        ssize_t ret = ::write(fd, ptr, size);
+        if (ret <= 0) {
+            return false;
+        }
+        ptr += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+bool KBRecordLess::operator()(const PeripheralKBRecord &a, const PeripheralKBRecord &b) const {
+    return std::tie(a.kind, a.phaddr, a.pc, a.cw_value, a.cr_phaddr, a.cr_value, a.value) <
+           std::tie(b.kind, b.phaddr, b.pc, b.cw_value, b.cr_phaddr, b.cr_value, b.value);
+}
+
+void sortKBRecords(std::vector<PeripheralKBRecord> &records) {
+    std::sort(records.begin(), records.end(), KBRecordLess());
+}
+
+// Single write per round, readers ignore the block if it ends up truncated
+static bool writeKBBlock(int fd, uint32_t magic, uint32_t round, uint32_t state_id, uint64_t tb_num,
+                         const std::vector<PeripheralKBRecord> &records) {
+    PeripheralKBRoundHeader rhdr = {magic, round, (uint32_t) records.size(), state_id, tb_num};
+    std::vector<uint8_t> buffer(sizeof(rhdr) + records.size() * sizeof(PeripheralKBRecord));
+    memcpy(buffer.data(), &rhdr, sizeof(rhdr));
+    if (!records.empty()) {
+        memcpy(buffer.data() + sizeof(rhdr), records.data(), records.size() * sizeof(PeripheralKBRecord));
+    }
+    return writeAll(fd, buffer.data(), buffer.size());
+}
+
+static bool writeKBFileHeader(int fd) {
+    PeripheralKBFileHeader hdr = {PERIPHERAL_KB_MAGIC, PERIPHERAL_KB_VERSION, sizeof(PeripheralKBRecord), 0};
+    return writeAll(fd, &hdr, sizeof(hdr));
+}
+
+bool appendKBRound(const std::string &path, uint32_t round, uint32_t state_id, uint64_t tb_num,
+                   const std::vector<PeripheralKBRecord> &records, const std::vector<PeripheralKBRecord> &previous) {
+    std::vector<PeripheralKBRecord> delta;
+    std::set_difference(records.begin(), records.end(), previous.begin(), previous.end(), std::back_inserter(delta),
+                        KBRecordLess());
+    size_t added = delta.size();
+    std::set_difference(previous.begin(), previous.end(), records.begin(), records.end(), std::back_inserter(delta),
+                        KBRecordLess());
+    for (size_t i = added; i < delta.size(); ++i) {
+        delta[i].kind |= KB_REMOVED;
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ret = true;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ret = false;
+    } else if (st.st_size == 0) {
+        ret = writeKBFileHeader(fd);
+    }
+
+    if (ret) {
+        ret = writeKBBlock(fd, PERIPHERAL_KB_DELTA_MAGIC, round, state_id, tb_num, delta);
+    }
+
+    ::close(fd);
+    return ret;
+}
+
+bool writeKBSnapshot(const std::string &path, uint32_t round, uint32_t state_id, uint64_t tb_num,
+                     const std::vector<PeripheralKBRecord> &records) {
+    std::string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ret = writeKBFileHeader(fd) && writeKBBlock(fd, PERIPHERAL_KB_ROUND_MAGIC, round, state_id, tb_num, records);
+    ret = ::close(fd) == 0 && ret;
+    if (!ret || ::rename(tmpPath.c_str(), path.c_str()) < 0) {
+        ::unlink(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool readKBRecords(const std::string &path, std::vector<PeripheralKBRecord> &records) {
+    records.clear();
+
+    if (isBinaryKB(path)) {
+        PeripheralKBFile kb;
+        if (!kb.open(path)) {
+            return false;
+        }
+        records.assign(kb.begin(), kb.end());
+        return true;
+    }
+
+    std::ifstream fPHKB(path);
+    if (!fPHKB) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(fPHKB, line) && !line.empty() && line != "Statistic:") {
+        bool section = false;
+        for (const auto &it : s_kbSections) {
+            section |= line == it.second;
+        }
+        if (section) {
+            continue;
+        }
+
+        PeripheralKBRecord rec;
+        if (!parseKBRecord(line, &rec)) {
+            return false;
+        }
+        records.push_back(rec);
+    }
+
+    sortKBRecords(records);
+    return true;
+}
+
+bool writeTextKB(const std::string &path, const std::vector<PeripheralKBRecord> &records) {
+    std::string tmpPath = path + ".tmp";
+    std::ofstream fPHKB(tmpPath, std::ios::out | std::ios::trunc);
+    if (!fPHKB) {
+        return false;
+    }
+
+    const unsigned count = sizeof(s_kbSections) / sizeof(s_kbSections[0]);
+    unsigned section = 0;
+    for (const auto &rec : records) {
+        for (; section < count && rec.kind >= s_kbSections[section].first; ++section) {
+            fPHKB << s_kbSections[section].second << std::endl;
+        }
+        fPHKB << formatKBRecord(rec) << std::endl;
+    }
+    for (; section < count; ++section) {
+        fPHKB << s_kbSections[section].second << std::endl;
+    }
+
+    fPHKB.close();
+    if (!fPHKB || ::rename(tmpPath.c_str(), path.c_str()) < 0) {
+        ::unlink(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Register modelled by a record, t0 to tirqs records all describe the same register
+static std::tuple<uint32_t, uint64_t, uint32_t> getKBRecordRegister(const PeripheralKBRecord &rec) {
+    switch (rec.kind) {
+        case KB_TIRQC:
+            return std::make_tuple(rec.kind, rec.cw_value, rec.phaddr);
+        case KB_FUZZ:
+        case KB_FUZZC:
+            return std::make_tuple(rec.kind, 0, rec.phaddr);
+        default:
+            return std::make_tuple(KB_T0, 0, rec.phaddr);
+    }
+}
+
+void mergeKBRecords(const std::vector<PeripheralKBRecord> &base, const std::vector<PeripheralKBRecord> &extra,
+                    std::vector<PeripheralKBRecord> &merged) {
+    std::set<std::tuple<uint32_t, uint64_t, uint32_t>> known;
+    for (const auto &rec : base) {
+        known.insert(getKBRecordRegister(rec));
+    }
+
+    merged = base;
+    for (const auto &rec : extra) {
+        if (!known.count(getKBRecordRegister(rec))) {
+            merged.push_back(rec);
+        }
+    }
+    sortKBRecords(merged);
+}
+
+bool PeripheralKBFile::open(const std::string &path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(PeripheralKBFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    const PeripheralKBFileHeader *hdr = static_cast<const PeripheralKBFileHeader *>(base);
+    if (hdr->magic != PERIPHERAL_KB_MAGIC || (hdr->version != PERIPHERAL_KB_VERSION && hdr->version != 1) ||
+        hdr->record_size != sizeof(PeripheralKBRecord)) {
+        munmap(base, st.st_size);
+        return false;
+    }
+
+    // Records written several times weight the value picked from the cache, keep every copy
+    std::multiset<PeripheralKBRecord, KBRecordLess> kb;
+    bool found = false;
+    const uint8_t *ptr = static_cast<const uint8_t *>(base) + sizeof(*hdr);
+    const uint8_t *limit = static_cast<const uint8_t *>(base) + st.st_size;
+    while ((size_t)(limit - ptr) >= sizeof(PeripheralKBRoundHeader)) {
+        const PeripheralKBRoundHeader *rhdr = reinterpret_cast<const PeripheralKBRoundHeader *>(ptr);
+        size_t size = sizeof(*rhdr) + (size_t) rhdr->count * sizeof(PeripheralKBRecord);
+        bool delta = rhdr->magic == PERIPHERAL_KB_DELTA_MAGIC;
+        if ((rhdr->magic != PERIPHERAL_KB_ROUND_MAGIC && !delta) || (size_t)(limit - ptr) < size) {
+            break;
+        }
+
+        if (!delta) {
+            kb.clear();
+        }
+
+        const PeripheralKBRecord *records = reinterpret_cast<const PeripheralKBRecord *>(rhdr + 1);
+        for (uint32_t i = 0; i < rhdr->count; ++i) {
+            PeripheralKBRecord rec = records[i];
+            if (rec.kind & KB_REMOVED) {
+                rec.kind &= ~KB_REMOVED;
+                auto it = kb.find(rec);
+                if (it != kb.end()) {
+                    kb.erase(it);
+                }
+            } else {
+                kb.insert(rec);
+            }
+        }
+
+        m_round = *rhdr;
+        found = true;
+        ptr += size;
+    }
+
+    munmap(base, st.st_size);
+
+    if (!found) {
+        return false;
+    }
+
+    m_records.assign(kb.begin(), kb.end());
+    m_round.count = m_records.size();
+    return true;
+}
+
+void PeripheralKBFile::close() {
+    m_round = PeripheralKBRoundHeader();
+    m_records.clear();
+}
+
+} // namespace hw
+} // namespace plugins
+} // namespace s2e
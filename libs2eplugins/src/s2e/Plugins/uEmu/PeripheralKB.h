@@ -0,0 +1,185 @@
+///
+/// Copyright (C) 2017, Cyberhaven
+/// All rights reserved.
+///
+/// Licensed under the Cyberhaven Research License Agreement.
+///
+
+#ifndef S2E_PLUGINS_PeripheralKB_H
+#define S2E_PLUGINS_PeripheralKB_H
+
+#include <inttypes.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+namespace hw {
+
+///
+/// Binary peripheral knowledge base.
+///
+/// The file starts with a PeripheralKBFileHeader and is followed by one block per
+/// learning round. A block is a PeripheralKBRoundHeader followed by count fixed-size
+/// records sorted by KBRecordLess. The first block is a snapshot of the whole KB,
+/// the following ones are deltas that only hold the records added during their
+/// round and, flagged with KB_REMOVED, the records dropped. Readers replay the
+/// blocks in order and stop at the first incomplete one, so a block truncated by
+/// a crash is ignored.
+///
+/// Deltas are appended, a snapshot rewrites the file, which keeps its size bounded.
+///
+/// scripts/uemu_kb_convert.py converts between this format and the text format.
+///
+
+#define PERIPHERAL_KB_MAGIC 0x424b4575 /* "uEKB" */
+#define PERIPHERAL_KB_ROUND_MAGIC 0x444e5252 /* "RRND" */
+#define PERIPHERAL_KB_DELTA_MAGIC 0x544c4452 /* "RDLT" */
+#define PERIPHERAL_KB_VERSION 2 // version 1 files only contain snapshots
+
+#define KB_REMOVED 0x80000000 // kind flag of the records dropped by a delta
+
+enum PeripheralKBKind {
+    KB_T0,
+    KB_T1,
+    KB_PT1,
+    KB_DT1,
+    KB_T2,
+    KB_T3,
+    KB_TIRQS,
+    KB_TIRQC,
+    KB_FUZZ, // default data registers
+    KB_FUZZC // candidate data registers
+};
+
+struct PeripheralKBFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+struct PeripheralKBRoundHeader {
+    uint32_t magic;
+    uint32_t round;
+    uint32_t count;
+    uint32_t state_id;
+    uint64_t tb_num;
+};
+
+struct PeripheralKBRecord {
+    uint32_t kind;
+    uint32_t phaddr;
+    uint32_t pc;       // size for t3 and data registers
+    uint32_t value;    // read count for data registers
+    uint64_t cw_value; // caller pc&function regs hash value, order for t3, irq no for tirqs and tirqc
+    uint32_t cr_phaddr;
+    uint32_t cr_value;
+};
+
+static_assert(sizeof(PeripheralKBRecord) == 32, "PeripheralKBRecord layout is part of the file format");
+
+/// \brief Format a record as a line of the text KB (without end of line)
+std::string formatKBRecord(const PeripheralKBRecord &rec);
+
+/// \brief Parse a line of the text KB, section names and statistics are not records
+bool parseKBRecord(const std::string &line, PeripheralKBRecord *rec);
+
+/// \brief Return true if the file starts with the binary KB magic
+bool isBinaryKB(const std::string &path);
+
+/// \brief Read the sorted records of a text or binary KB
+bool readKBRecords(const std::string &path, std::vector<PeripheralKBRecord> &records);
+
+/// \brief Write sorted records as a text KB, through a temporary file renamed over path
+bool writeTextKB(const std::string &path, const std::vector<PeripheralKBRecord> &records);
+
+///
+/// \brief Merge the KBs learnt by two fuzzing workers
+///
+/// The registers modelled by base keep their model, extra only contributes the records
+/// of the registers base does not know. Both lists must be sorted.
+///
+void mergeKBRecords(const std::vector<PeripheralKBRecord> &base, const std::vector<PeripheralKBRecord> &extra,
+                    std::vector<PeripheralKBRecord> &merged);
+
+/// \brief Order of the records in a block, records that only differ by their value are distinct
+struct KBRecordLess {
+    bool operator()(const PeripheralKBRecord &a, const PeripheralKBRecord &b) const;
+};
+
+/// \brief Sort the records of a round
+///
+/// Duplicates are kept, writeTIRQPeripheralstoKB writes some records twice to double
+/// their chance of being picked.
+void sortKBRecords(std::vector<PeripheralKBRecord> &records);
+
+/// \brief Append the changes of a learning round to a binary KB
+///
+/// Both record lists must be sorted. The block only holds the records that are not in
+/// previous and a KB_REMOVED copy of those that are not in records, each copy of a
+/// duplicated record counts.
+bool appendKBRound(const std::string &path, uint32_t round, uint32_t state_id, uint64_t tb_num,
+                   const std::vector<PeripheralKBRecord> &records, const std::vector<PeripheralKBRecord> &previous);
+
+/// \brief Replace a binary KB by a snapshot of one learning round
+///
+/// The snapshot is written to a temporary file that is renamed over path, readers see
+/// either the old content or the new one.
+bool writeKBSnapshot(const std::string &path, uint32_t round, uint32_t state_id, uint64_t tb_num,
+                     const std::vector<PeripheralKBRecord> &records);
+
+///
+/// \brief Latest KB published by the fuzzing workers of a campaign
+///
+/// Lives in a named S2ESynchronizedObject shared by all the workers. A worker
+/// that learnt on top of an older generation merges its KB into the published
+/// one before publishing the result.
+///
+struct PeripheralSharedKB {
+    uint32_t generation; // 0 until the first KB is published
+    char path[PATH_MAX];
+
+    // Leave the fields alone so that attaching to an existing object keeps its content,
+    // new shared memory objects are zero-filled
+    PeripheralSharedKB() {
+    }
+};
+
+///
+/// \brief KB obtained by replaying the complete rounds of a binary KB
+///
+class PeripheralKBFile {
+private:
+    PeripheralKBRoundHeader m_round; // last replayed round, count is the size of the KB
+    std::vector<PeripheralKBRecord> m_records;
+
+public:
+    PeripheralKBFile() : m_round() {
+    }
+
+    PeripheralKBFile(const PeripheralKBFile &) = delete;
+    PeripheralKBFile &operator=(const PeripheralKBFile &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+
+    const PeripheralKBRoundHeader *round() const {
+        return &m_round;
+    }
+
+    const PeripheralKBRecord *begin() const {
+        return m_records.data();
+    }
+
+    const PeripheralKBRecord *end() const {
+        return m_records.data() + m_records.size();
+    }
+};
+
+} // namespace hw
+} // namespace plugins
+} // namespace s2e
+
+#endif
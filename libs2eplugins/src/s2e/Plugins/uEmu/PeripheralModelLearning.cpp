@@ -14,9 +14,11 @@
 #include <s2e/cpu.h>
 #include <s2e/opcodes.h>
 
+#include "PeripheralKB.h"
 #include "PeripheralModelLearning.h"
 
 #include <llvm/Support/CommandLine.h>
+#include <memory>
 
 using namespace klee;
 
@@ -48,47 +50,102 @@ S2E_DEFINE_PLUGIN(PeripheralModelLearning, "PeripheralModelLearning S2E plugin",
                   "InvalidStatesDetection", "ARMFunctionMonitor");
 
 namespace {
+// The learned maps can hold thousands of entries. Forked states share them and a
+// state only gets its own copy of a map the first time it updates that map.
+template <typename T> class CopyOnWrite {
+private:
+    std::shared_ptr<T> m_data;
+
+public:
+    CopyOnWrite() : m_data(std::make_shared<T>()) {
+    }
+
+    const T &get() const {
+        return *m_data;
+    }
+
+    // keeps the current content alive, later updates go to a new copy
+    std::shared_ptr<const T> snapshot() const {
+        return m_data;
+    }
+
+    T &mut() {
+        if (m_data.use_count() > 1) {
+            m_data = std::make_shared<T>(*m_data);
+        }
+        return *m_data;
+    }
+};
+
+// Lookup without inserting a default entry
+template <typename M> typename M::mapped_type lookup(const M &map, const typename M::key_type &key) {
+    auto it = map.find(key);
+    return it == map.end() ? typename M::mapped_type() : it->second;
+}
+
+// Same as lookup for getters returning a reference, a missing key yields a shared empty value
+template <typename M> const typename M::mapped_type &lookupRef(const M &map, const typename M::key_type &key) {
+    static const typename M::mapped_type empty = typename M::mapped_type();
+    auto it = map.find(key);
+    return it == map.end() ? empty : it->second;
+}
+
+// Size below which symbolic access sites are not pruned
+const size_t MIN_SYMBOLIC_ACCESS_SITES = 4096;
+
+// Parse the unique number that createSymbolicValue appends to variable names
+bool getSymbolicVariableNo(const std::string &name, uint64_t *no) {
+    auto pos = name.rfind('_');
+    if (pos == std::string::npos || pos + 1 == name.size() ||
+        name.find_first_not_of("0123456789", pos + 1) != std::string::npos) {
+        return false;
+    }
+
+    *no = std::stoull(name.substr(pos + 1), NULL, 10);
+    return true;
+}
+
 class PeripheralModelLearningState : public PluginState {
 private:
-    AllKnowledgeBaseMap lastforkphs;
+    CopyOnWrite<AllKnowledgeBaseMap> lastforkphs;
     std::pair<uint32_t, std::vector<uint32_t>> last_fork_cond;
-    std::map<uint32_t /* irq num */, AllKnowledgeBaseMap> irq_lastforkphs;
-    std::map<uint32_t /* pc */, uint32_t /* count */> irqfork_count;
-    WritePeripheralMap write_phs;
-    ReadPeripheralMap read_phs;          // map pair with count rather that value
-    TypeFlagPeripheralMap type_flag_phs; // use to indicate control phs map but don't store the value
-    TypeFlagPeripheralMap dt1_type_flag_phs; // use to indicate third kind of data registers
-    TypeFlagPeripheralMap all_rw_phs;    // use to indicate control phs map but don't store the value
-    TypeFlagPeripheralMap condition_phs; // record all phs which meet conditions
-    TypeFlagPeripheralMap lock_t1_type_flag;
-    TypeFlagPeripheralMap t0_type_flag_phs; // use to indicate which t0 phs have been read
-    TypeFlagPeripheralMap t3_size_map;      // use to indicate t3 ph size
-    std::map<uint32_t, std::map<uint32_t, uint32_t>> t3_value_count; // use to indicate t3 value count
-    T1PeripheralMap symbolicpc_phs;         // 1 means this phs have been read as pc
-    T1PeripheralMap symbolicpc_phs_fork_count;
-    T0PeripheralMap t0_type_phs;
-    T1BNPeripheralMap t1_type_phs;
-    T1PeripheralMap pdata_type_phs; // for only one time reading becase t1 is stored in second time reading
-    T1BNPeripheralMap pt1_type_phs;
-    T1PeripheralMap
+    CopyOnWrite<std::map<uint32_t /* irq num */, AllKnowledgeBaseMap>> irq_lastforkphs;
+    CopyOnWrite<std::map<uint32_t /* pc */, uint32_t /* count */>> irqfork_count;
+    CopyOnWrite<WritePeripheralMap> write_phs;
+    CopyOnWrite<ReadPeripheralMap> read_phs;          // map pair with count rather that value
+    CopyOnWrite<TypeFlagPeripheralMap> type_flag_phs; // use to indicate control phs map but don't store the value
+    CopyOnWrite<TypeFlagPeripheralMap> dt1_type_flag_phs; // use to indicate third kind of data registers
+    CopyOnWrite<TypeFlagPeripheralMap> all_rw_phs;    // use to indicate control phs map but don't store the value
+    CopyOnWrite<TypeFlagPeripheralMap> condition_phs; // record all phs which meet conditions
+    CopyOnWrite<TypeFlagPeripheralMap> lock_t1_type_flag;
+    CopyOnWrite<TypeFlagPeripheralMap> t0_type_flag_phs; // use to indicate which t0 phs have been read
+    CopyOnWrite<TypeFlagPeripheralMap> t3_size_map;      // use to indicate t3 ph size
+    CopyOnWrite<std::map<uint32_t, std::map<uint32_t, uint32_t>>> t3_value_count; // use to indicate t3 value count
+    CopyOnWrite<T1PeripheralMap> symbolicpc_phs;         // 1 means this phs have been read as pc
+    CopyOnWrite<T1PeripheralMap> symbolicpc_phs_fork_count;
+    CopyOnWrite<T0PeripheralMap> t0_type_phs;
+    CopyOnWrite<T1BNPeripheralMap> t1_type_phs;
+    CopyOnWrite<T1PeripheralMap> pdata_type_phs; // for only one time reading becase t1 is stored in second time reading
+    CopyOnWrite<T1BNPeripheralMap> pt1_type_phs;
+    CopyOnWrite<T1PeripheralMap>
         pt1_type_flag_phs;            // 1 means this reg has never been read as seed; 2 means already been read as seed
-    T1PeripheralMap t2_type_flag_phs; // If t2 or not (base on phaddr & pc)
-    T2PeripheralMap pt2_type_flag_phs; // 1 means this reg has never been read as t2; 2 means already been read
-    T2PeripheralMap t2_type_phs;
-    TIRQCPeripheralMap tirqc_type_phs; // store the control ph values corresponding to the regs has
-    TIRQCPeripheralMap etirqc_type_phs;
-    TypeFlagPeripheralMap type_irq_flag;
-    PeripheralForkCount ph_forks_count;
-    std::map<uint32_t /* irq no */, std::deque<uint64_t>> hash_stack;
-    TypeFlagPeripheralMap concrete_t3_flag;
-    T3PeripheralMap t3_type_phs;
+    CopyOnWrite<T1PeripheralMap> t2_type_flag_phs; // If t2 or not (base on phaddr & pc)
+    CopyOnWrite<T2PeripheralMap> pt2_type_flag_phs; // 1 means this reg has never been read as t2; 2 means already been read
+    CopyOnWrite<T2PeripheralMap> t2_type_phs;
+    CopyOnWrite<TIRQCPeripheralMap> tirqc_type_phs; // store the control ph values corresponding to the regs has
+    CopyOnWrite<TIRQCPeripheralMap> etirqc_type_phs;
+    CopyOnWrite<TypeFlagPeripheralMap> type_irq_flag;
+    CopyOnWrite<PeripheralForkCount> ph_forks_count;
+    CopyOnWrite<std::map<uint32_t /* irq no */, std::deque<uint64_t>>> hash_stack;
+    CopyOnWrite<TypeFlagPeripheralMap> concrete_t3_flag;
+    CopyOnWrite<T3PeripheralMap> t3_type_phs;
     std::deque<UniquePeripheral> current_irq_phs_value;
-    AllKnowledgeBaseNoMap allcache_phs; // save every value for all phs read (once for each read)
+    CopyOnWrite<AllKnowledgeBaseNoMap> allcache_phs; // save every value for all phs read (once for each read)
     // TIRQSPeripheralMap tirqs_type_phs;
     // TWHCPeripheralMap twhc_type_phs; // twhc type
 public:
     PeripheralModelLearningState() {
-        write_phs.clear();
+        write_phs.mut().clear();
     }
 
     virtual ~PeripheralModelLearningState() {
@@ -103,218 +160,224 @@ public:
     }
     // irq fork count
     void incirqfork_count(uint32_t pc) {
-        ++irqfork_count[pc];
+        ++irqfork_count.mut()[pc];
     }
 
     uint32_t getirqfork_count(uint32_t pc) {
-        return irqfork_count[pc];
+        return lookup(irqfork_count.get(), pc);
     }
     // phs cache
     // type flag
     void insert_all_rw_phs(uint32_t phaddr, uint32_t flag) {
-        all_rw_phs[phaddr] = flag;
+        all_rw_phs.mut()[phaddr] = flag;
     }
 
-    TypeFlagPeripheralMap get_all_rw_phs() {
-        return all_rw_phs;
+    const TypeFlagPeripheralMap &get_all_rw_phs() {
+        return all_rw_phs.get();
     }
 
     // type flag
     void insert_type_flag_phs(uint32_t phaddr, uint32_t flag) {
-        type_flag_phs[phaddr] = flag;
+        type_flag_phs.mut()[phaddr] = flag;
     }
 
-    TypeFlagPeripheralMap get_type_flag_phs() {
-        return type_flag_phs;
+    const TypeFlagPeripheralMap &get_type_flag_phs() {
+        return type_flag_phs.get();
+    }
+
+    std::shared_ptr<const TypeFlagPeripheralMap> snapshot_type_flag_phs() const {
+        return type_flag_phs.snapshot();
     }
 
     uint32_t get_type_flag_ph_it(uint32_t phaddr) {
-        return type_flag_phs[phaddr];
+        return lookup(type_flag_phs.get(), phaddr);
     }
 
     // t0
     void insert_t0_type_flag_phs(uint32_t phaddr, uint32_t flag) {
-        t0_type_flag_phs[phaddr] = flag;
+        t0_type_flag_phs.mut()[phaddr] = flag;
     }
 
     uint32_t get_t0_type_flag_ph_it(uint32_t phaddr) {
-        return t0_type_flag_phs[phaddr];
+        return lookup(t0_type_flag_phs.get(), phaddr);
     }
 
     void insert_t0_type_phs(uint32_t phaddr, uint32_t pc, uint64_t caller_fp_hash, NumPair no_value) {
-        t0_type_phs[phaddr][pc] = std::make_pair(caller_fp_hash, no_value);
+        t0_type_phs.mut()[phaddr][pc] = std::make_pair(caller_fp_hash, no_value);
     }
 
-    std::map<uint32_t, std::pair<uint64_t, NumPair>> get_t0_type_phs(uint32_t phaddr) {
-        return t0_type_phs[phaddr];
+    const std::map<uint32_t, std::pair<uint64_t, NumPair>> &get_t0_type_phs(uint32_t phaddr) {
+        return lookupRef(t0_type_phs.get(), phaddr);
     }
 
     // t1
     void insert_t1_type_phs(UniquePeripheral phc, uint64_t caller_fp_hash, NumPair no_value) {
-        t1_type_phs[phc] = std::make_pair(caller_fp_hash, no_value);
+        t1_type_phs.mut()[phc] = std::make_pair(caller_fp_hash, no_value);
     }
 
-    T1BNPeripheralMap get_t1_type_phs() {
-        return t1_type_phs;
+    const T1BNPeripheralMap &get_t1_type_phs() {
+        return t1_type_phs.get();
     }
 
     uint32_t get_t1_type_ph_it(UniquePeripheral phc) {
-        return t1_type_phs[phc].second.second;
+        return lookup(t1_type_phs.get(), phc).second.second;
     }
 
     void insert_lock_t1_type_flag(uint32_t phaddr, uint32_t flag) {
-        lock_t1_type_flag[phaddr] = flag;
+        lock_t1_type_flag.mut()[phaddr] = flag;
     }
 
     uint32_t get_lock_t1_type_flag(uint32_t phaddr) {
-        return lock_t1_type_flag[phaddr];
+        return lookup(lock_t1_type_flag.get(), phaddr);
     }
 
     // data t1 for first time store
     void insert_pdata_type_phs(UniquePeripheral phc, uint32_t value) {
-        pdata_type_phs[phc] = value;
+        pdata_type_phs.mut()[phc] = value;
     }
 
-    T1PeripheralMap get_pdata_type_phs() {
-        return pdata_type_phs;
+    const T1PeripheralMap &get_pdata_type_phs() {
+        return pdata_type_phs.get();
     }
 
     // pt1
     void insert_pt1_type_phs(UniquePeripheral phc, uint64_t caller_fp_hash, NumPair no_value) {
-        pt1_type_phs[phc] = std::make_pair(caller_fp_hash, no_value);
+        pt1_type_phs.mut()[phc] = std::make_pair(caller_fp_hash, no_value);
     }
 
-    T1BNPeripheralMap get_pt1_type_phs() {
-        return pt1_type_phs;
+    const T1BNPeripheralMap &get_pt1_type_phs() {
+        return pt1_type_phs.get();
     }
 
     uint32_t get_pt1_type_ph_it(UniquePeripheral phc) {
-        return pt1_type_phs[phc].second.second;
+        return lookup(pt1_type_phs.get(), phc).second.second;
     }
 
     void erase_pt1_type_ph_it(UniquePeripheral phc) {
-        pt1_type_phs.erase(phc);
+        pt1_type_phs.mut().erase(phc);
     }
 
     void insert_pt1_type_flag_phs(UniquePeripheral phc, uint32_t flag) {
-        pt1_type_flag_phs[phc] = flag;
+        pt1_type_flag_phs.mut()[phc] = flag;
     }
 
     uint32_t get_pt1_type_flag_ph_it(UniquePeripheral phc) {
-        return pt1_type_flag_phs[phc];
+        return lookup(pt1_type_flag_phs.get(), phc);
     }
 
-    T1PeripheralMap get_pt1_type_flag_all_phs() {
-        return pt1_type_flag_phs;
+    const T1PeripheralMap &get_pt1_type_flag_all_phs() {
+        return pt1_type_flag_phs.get();
     }
 
     void insert_dt1_type_flag_phs(uint32_t phaddr, uint32_t flag) {
-        dt1_type_flag_phs[phaddr] = flag;
+        dt1_type_flag_phs.mut()[phaddr] = flag;
     }
 
     uint32_t get_dt1_type_flag_ph_it(uint32_t phaddr) {
-        return dt1_type_flag_phs[phaddr];
+        return lookup(dt1_type_flag_phs.get(), phaddr);
     }
     // t2
     void insert_t2_type_phs(UniquePeripheral phc, uint64_t caller_fp_hash, uint32_t value) {
-        t2_type_phs[phc][caller_fp_hash] = value;
+        t2_type_phs.mut()[phc][caller_fp_hash] = value;
     }
 
-    T2PeripheralMap get_t2_type_phs() {
-        return t2_type_phs;
+    const T2PeripheralMap &get_t2_type_phs() {
+        return t2_type_phs.get();
     }
 
     uint32_t get_t2_type_ph_it(UniquePeripheral phc, uint64_t caller_fp_hash) {
-        return t2_type_phs[phc][caller_fp_hash];
+        return lookup(lookupRef(t2_type_phs.get(), phc), caller_fp_hash);
     }
 
-    CWMap get_t2_type_samepc_phs(UniquePeripheral phc) {
-        return t2_type_phs[phc];
+    const CWMap &get_t2_type_samepc_phs(UniquePeripheral phc) {
+        return lookupRef(t2_type_phs.get(), phc);
     }
 
     void erase_t2_type_phs(UniquePeripheral phc) {
-        t2_type_phs.erase(phc);
+        t2_type_phs.mut().erase(phc);
     }
 
     void insert_t2_type_flag_phs(UniquePeripheral phc, uint32_t flag) {
-        t2_type_flag_phs[phc] = flag;
+        t2_type_flag_phs.mut()[phc] = flag;
     }
 
     uint32_t get_t2_type_flag_ph_it(UniquePeripheral phc) {
-        return t2_type_flag_phs[phc];
+        return lookup(t2_type_flag_phs.get(), phc);
     }
 
     void insert_pt2_type_flag_ph_it(UniquePeripheral phc, uint64_t caller_fp_hash, uint32_t flag) {
-        pt2_type_flag_phs[phc][caller_fp_hash] = flag;
+        pt2_type_flag_phs.mut()[phc][caller_fp_hash] = flag;
     }
 
     uint32_t get_pt2_type_flag_ph_it(UniquePeripheral phc, uint64_t caller_fp_hash) {
-        return pt2_type_flag_phs[phc][caller_fp_hash];
+        return lookup(lookupRef(pt2_type_flag_phs.get(), phc), caller_fp_hash);
     }
 
     // t3
     void insert_concrete_t3_flag(uint32_t phaddr, uint32_t flag) {
-        concrete_t3_flag[phaddr] = flag;
+        concrete_t3_flag.mut()[phaddr] = flag;
     }
 
     uint32_t get_concrete_t3_flag(uint32_t phaddr) {
-        return concrete_t3_flag[phaddr];
+        return lookup(concrete_t3_flag.get(), phaddr);
     }
 
     uint32_t get_t3_type_ph_size(uint32_t phaddr) {
-        return t3_type_phs[phaddr].size();
+        return lookupRef(t3_type_phs.get(), phaddr).size();
     }
 
     void insert_t3_type_ph_back(uint32_t phaddr, uint32_t value) {
-        if (find(t3_type_phs[phaddr].begin(), t3_type_phs[phaddr].end(), value)
-                == t3_type_phs[phaddr].end()) {
-            t3_type_phs[phaddr].push_back(value);
-            t3_value_count[phaddr][value] = 1;
+        if (find(t3_type_phs.mut()[phaddr].begin(), t3_type_phs.mut()[phaddr].end(), value)
+                == t3_type_phs.mut()[phaddr].end()) {
+            t3_type_phs.mut()[phaddr].push_back(value);
+            t3_value_count.mut()[phaddr][value] = 1;
         } else {
-            t3_value_count[phaddr][value]++;
+            t3_value_count.mut()[phaddr][value]++;
         }
     }
 
     uint32_t get_t3_type_ph_value_count(uint32_t phaddr, uint32_t value) {
-        return t3_value_count[phaddr][value];
+        return lookup(lookupRef(t3_value_count.get(), phaddr), value);
     }
 
     void push_t3_type_ph_back(uint32_t phaddr, uint32_t value) {
-        t3_type_phs[phaddr].push_back(value);
+        t3_type_phs.mut()[phaddr].push_back(value);
     }
 
-    T3PeripheralMap get_t3_type_phs() {
-        return t3_type_phs;
+    const T3PeripheralMap &get_t3_type_phs() {
+        return t3_type_phs.get();
     }
 
     void clear_t3_type_phs(uint32_t phaddr) {
-        t3_type_phs[phaddr].clear();
+        t3_type_phs.mut()[phaddr].clear();
     }
 
     void erase_t3_type_ph_it(uint32_t phaddr, uint32_t value) {
-        std::deque<uint32_t>::iterator itun = std::find(t3_type_phs[phaddr].begin(), t3_type_phs[phaddr].end(), value);
-        t3_type_phs[phaddr].erase(itun);
+        std::deque<uint32_t>::iterator itun = std::find(t3_type_phs.mut()[phaddr].begin(), t3_type_phs.mut()[phaddr].end(), value);
+        t3_type_phs.mut()[phaddr].erase(itun);
     }
 
     void pop_t3_type_ph_it(uint32_t phaddr) {
-        t3_type_phs[phaddr].pop_front();
+        t3_type_phs.mut()[phaddr].pop_front();
     }
 
     uint32_t get_t3_type_ph_it_front(uint32_t phaddr) {
-        return t3_type_phs[phaddr].front();
+        const auto &values = lookupRef(t3_type_phs.get(), phaddr);
+        return values.empty() ? 0 : values.front();
     }
 
     uint32_t get_t3_type_ph_it_back(uint32_t phaddr) {
-        return t3_type_phs[phaddr].back();
+        const auto &values = lookupRef(t3_type_phs.get(), phaddr);
+        return values.empty() ? 0 : values.back();
     }
 
     // irq flag for irqs
     void insert_irq_flag_phs(uint32_t phaddr, uint32_t flag) {
-        type_irq_flag[phaddr] = flag;
+        type_irq_flag.mut()[phaddr] = flag;
     }
 
     uint32_t get_irq_flag_ph_it(uint32_t phaddr) {
-        return type_irq_flag[phaddr];
+        return lookup(type_irq_flag.get(), phaddr);
     }
 
     // IRQS
@@ -332,54 +395,53 @@ public:
 
     // IRQC
     void insert_tirqc_type_phs(uint32_t irq_no, uint32_t phaddr, uint32_t crphaddr, uint32_t crvalue, uint32_t value) {
-        if (find(tirqc_type_phs[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].begin(),
-                 tirqc_type_phs[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].end(),
-                 value) == tirqc_type_phs[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].end())
-            tirqc_type_phs[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].push_back(value);
+        const auto &values = lookup(lookupRef(get_tirqc_type_phs(irq_no, phaddr), crphaddr), crvalue);
+        if (find(values.begin(), values.end(), value) == values.end())
+            tirqc_type_phs.mut()[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].push_back(value);
     }
 
-    IRQCRMap get_tirqc_type_phs(uint32_t irq_no, uint32_t phaddr) {
-        return tirqc_type_phs[std::make_pair(irq_no, phaddr)];
+    const IRQCRMap &get_tirqc_type_phs(uint32_t irq_no, uint32_t phaddr) {
+        return lookupRef(tirqc_type_phs.get(), std::make_pair(irq_no, phaddr));
     }
 
-    TIRQCPeripheralMap get_tirqc_type_all_phs() {
-        return tirqc_type_phs;
+    const TIRQCPeripheralMap &get_tirqc_type_all_phs() {
+        return tirqc_type_phs.get();
     }
 
     // IRQC Empty
     void insert_etirqc_type_phs(uint32_t irq_no, uint32_t phaddr, uint32_t crphaddr, uint32_t crvalue, uint32_t value) {
-        if (etirqc_type_phs[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].size() == 0 && value == 0)
-            etirqc_type_phs[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].push_back(value);
+        if (etirqc_type_phs.mut()[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].size() == 0 && value == 0)
+            etirqc_type_phs.mut()[std::make_pair(irq_no, phaddr)][crphaddr][crvalue].push_back(value);
     }
 
-    TIRQCPeripheralMap get_etirqc_type_all_phs() {
-        return etirqc_type_phs;
+    const TIRQCPeripheralMap &get_etirqc_type_all_phs() {
+        return etirqc_type_phs.get();
     }
 
     // read and write phs
     void inc_readphs(uint32_t phaddr, uint32_t size) {
-        read_phs[phaddr].first = size;
-        read_phs[phaddr].second++;
+        read_phs.mut()[phaddr].first = size;
+        read_phs.mut()[phaddr].second++;
     }
 
     uint64_t get_readphs_count(uint32_t phaddr) {
-        return read_phs[phaddr].second;
+        return lookup(read_phs.get(), phaddr).second;
     }
 
     uint32_t get_readphs_size(uint32_t phaddr) {
-        return read_phs[phaddr].first;
+        return lookup(read_phs.get(), phaddr).first;
     }
 
     void update_writeph(uint32_t phaddr, uint32_t value) {
-        write_phs[phaddr] = value;
+        write_phs.mut()[phaddr] = value;
     }
 
-    ReadPeripheralMap get_readphs() {
-        return read_phs;
+    const ReadPeripheralMap &get_readphs() {
+        return read_phs.get();
     }
 
     bool whether_write(uint32_t phaddr) {
-        if (write_phs.count(phaddr) > 0) {
+        if (write_phs.get().count(phaddr) > 0) {
             return true;
         } else {
             return false;
@@ -387,7 +449,7 @@ public:
     }
 
     uint32_t get_writeph(uint32_t phaddr) {
-        return write_phs[phaddr];
+        return lookup(write_phs.get(), phaddr);
     }
 
     // last fork conds
@@ -401,28 +463,28 @@ public:
 
     // last fork phs interrupt
     void irq_insertlastfork_phs(uint32_t irq_num, UniquePeripheral phc, uint64_t ch_value, NumPair value_no) {
-        irq_lastforkphs[irq_num][phc][ch_value] = value_no;
+        irq_lastforkphs.mut()[irq_num][phc][ch_value] = value_no;
     }
 
-    AllKnowledgeBaseMap irq_getlastfork_phs(uint32_t irq_num) {
-        return irq_lastforkphs[irq_num];
+    const AllKnowledgeBaseMap &irq_getlastfork_phs(uint32_t irq_num) {
+        return lookupRef(irq_lastforkphs.get(), irq_num);
     }
 
     void irq_clearlastfork_phs(uint32_t irq_num) {
-        irq_lastforkphs[irq_num].clear();
+        irq_lastforkphs.mut()[irq_num].clear();
     }
 
     // last fork phs
     void insertlastfork_phs(UniquePeripheral phc, uint64_t ch_value, NumPair value_no) {
-        lastforkphs[phc][ch_value] = value_no;
+        lastforkphs.mut()[phc][ch_value] = value_no;
     }
 
-    AllKnowledgeBaseMap getlastfork_phs() {
-        return lastforkphs;
+    const AllKnowledgeBaseMap &getlastfork_phs() {
+        return lastforkphs.get();
     }
 
     void clearlastfork_phs() {
-        lastforkphs.clear();
+        lastforkphs.mut().clear();
     }
 
     // update current irq peripherals
@@ -434,94 +496,95 @@ public:
         current_irq_phs_value.clear();
     }
 
-    std::deque<UniquePeripheral> get_current_irq_values() {
+    const std::deque<UniquePeripheral> &get_current_irq_values() {
         return current_irq_phs_value;
     }
 
     // cache phs order by no
     void insert_cachephs(uint32_t phaddr, uint64_t no, uint32_t value) {
-        allcache_phs[phaddr][no] = value;
+        allcache_phs.mut()[phaddr][no] = value;
     }
 
-    NumMap get_cache_phs(uint32_t phaddr) {
-        return allcache_phs[phaddr];
+    const NumMap &get_cache_phs(uint32_t phaddr) {
+        return lookupRef(allcache_phs.get(), phaddr);
     }
 
-    AllKnowledgeBaseNoMap get_all_cache_phs() {
-        return allcache_phs;
+    const AllKnowledgeBaseNoMap &get_all_cache_phs() {
+        return allcache_phs.get();
     }
 
     // record all conditional phs
     void insert_condition_ph_it(uint32_t phaddr) {
-        condition_phs[phaddr] = 1;
+        condition_phs.mut()[phaddr] = 1;
     }
 
-    TypeFlagPeripheralMap get_condition_phs() {
-        return condition_phs;
+    const TypeFlagPeripheralMap &get_condition_phs() {
+        return condition_phs.get();
     }
 
     // record t3 max size map
     void insert_t3_size_ph_it(uint32_t phaddr, uint32_t size) {
-        t3_size_map[phaddr] = size;
+        t3_size_map.mut()[phaddr] = size;
     }
 
     uint32_t get_t3_size_ph_it(uint32_t phaddr) {
-        return t3_size_map[phaddr];
+        return lookup(t3_size_map.get(), phaddr);
     }
     // update hash
     void insert_hashstack(uint32_t irq_no, uint64_t sum_hash) {
-        hash_stack[irq_no].push_back(sum_hash);
-        if (hash_stack[irq_no].size() > 9) {
-            hash_stack[irq_no].pop_front();
+        hash_stack.mut()[irq_no].push_back(sum_hash);
+        if (hash_stack.mut()[irq_no].size() > 9) {
+            hash_stack.mut()[irq_no].pop_front();
         }
     }
 
     void pop_hashstack(uint32_t irq_no) {
-        if (hash_stack[irq_no].size() > 0) {
-            hash_stack[irq_no].pop_back();
+        if (hash_stack.mut()[irq_no].size() > 0) {
+            hash_stack.mut()[irq_no].pop_back();
         }
     }
 
-    uint64_t get_current_hash(uint32_t irq_no) {
-        if (hash_stack.find(irq_no) == hash_stack.end()) {
+    uint64_t get_current_hash(uint32_t irq_no) const {
+        auto it = hash_stack.get().find(irq_no);
+        if (it == hash_stack.get().end()) {
             return 0;
         } else {
-            if (hash_stack[irq_no].size() == 0) {
+            if (it->second.size() == 0) {
                 return 0;
             } else {
-                return hash_stack[irq_no].back();
+                return it->second.back();
             }
         }
     }
 
     // update fork pc map in lastest read
     void inc_peripheral_fork_count(UniquePeripheral phc) {
-        ph_forks_count[phc]++;
+        ph_forks_count.mut()[phc]++;
     }
 
     void clear_peripheral_fork_count(UniquePeripheral phc) {
-        ph_forks_count[phc] = 0;
+        ph_forks_count.mut()[phc] = 0;
     }
 
     uint32_t get_peripheral_fork_count(UniquePeripheral phc) {
-        return ph_forks_count[phc];
+        return lookup(ph_forks_count.get(), phc);
     }
 
     // update symbolic pc phs
     void insert_symbolicpc_ph_it(UniquePeripheral phc) {
-        symbolicpc_phs[phc] = 1;
+        symbolicpc_phs.mut()[phc] = 1;
     }
 
     uint32_t get_symbolicpc_ph_it(UniquePeripheral phc) {
-        return symbolicpc_phs[phc];
+        return lookup(symbolicpc_phs.get(), phc);
     }
     // update symbolic pc phs forking count
     void inc_symbolicpc_ph_count(UniquePeripheral phc) {
-        symbolicpc_phs_fork_count[phc]++;
+        symbolicpc_phs_fork_count.mut()[phc]++;
     }
 
     uint32_t get_symbolicpc_ph_count(UniquePeripheral phc) {
-        return symbolicpc_phs_fork_count[phc];
+        return lookup(symbolicpc_phs_fork_count.get(), phc);
     }
 
 };
@@ -537,6 +600,7 @@ void PeripheralModelLearning::initialize() {
 
     round_count = 0;
     durationtime = 0;
+    symbolic_access_sites_limit = MIN_SYMBOLIC_ACCESS_SITES;
     all_peripheral_no = 0;
     firmwareName = s2e()->getConfig()->getString(getConfigKey() + ".firmwareName", "x.elf");
     getInfoStream() << "firmware name is " << firmwareName << "\n";
@@ -546,10 +610,24 @@ void PeripheralModelLearning::initialize() {
     t2_max_context = s2e()->getConfig()->getInt(getConfigKey() + ".maxT2Size", 8, &ok);
     t3_max_symbolic_count = s2e()->getConfig()->getInt(getConfigKey() + ".limitSymNum", 10, &ok);
     allow_new_phs = s2e()->getConfig()->getBool(getConfigKey() + ".allowNewPhs", true);
+    // append learned rounds to a binary KB (<firmware>_KB.bin) instead of writing one text KB per round
+    binary_kb = s2e()->getConfig()->getBool(getConfigKey() + ".binaryKB", false);
+    // later rounds only append their changes, every that many rounds the file is rewritten as a snapshot
+    kb_snapshot_interval = s2e()->getConfig()->getInt(getConfigKey() + ".binaryKBSnapshotInterval", 16, &ok);
+    kb_delta_rounds = kb_snapshot_interval;
     if (!allow_new_phs) {
         getWarningsStream() << "Not allow new peripherals registers in fuzzing mode\n";
     }
 
+    // name of the shared memory object through which parallel fuzzing workers exchange their KB
+    shared_kb = nullptr;
+    kb_generation = 0;
+    std::string sharedKBName = s2e()->getConfig()->getString(getConfigKey() + ".sharedKB", "", &ok);
+    if (ok && !sharedKBName.empty()) {
+        shared_kb = new S2ESynchronizedObject<PeripheralSharedKB>(sharedKBName.c_str());
+        getInfoStream() << "share KB with other workers through " << sharedKBName << "\n";
+    }
+
     onARMFunctionConnection = s2e()->getPlugin<ARMFunctionMonitor>();
     onARMFunctionConnection->onARMFunctionCallEvent.connect(
         sigc::mem_fun(*this, &PeripheralModelLearning::onARMFunctionCall));
@@ -568,6 +646,8 @@ void PeripheralModelLearning::initialize() {
             getWarningsStream() << "Could not read peripheral regs from cache file" << fileName << "\n";
             exit(-1);
         }
+        // other workers may have already extended the KB
+        syncSharedKB();
     } else {
         onInterruptExitonnection = s2e()->getCorePlugin()->onExceptionExit.connect(
             sigc::mem_fun(*this, &PeripheralModelLearning::onExceptionExit));
@@ -789,7 +869,259 @@ bool PeripheralModelLearning::getGeneralEntryfromKB(std::string variablePeripher
     return true;
 }
 
+void PeripheralModelLearning::loadGeneralKBEntry(uint32_t type, uint32_t phaddr, uint32_t pc, uint32_t value,
+                                                 uint64_t cwirq_value) {
+    UniquePeripheral uniquePeripheral = std::make_pair(phaddr, pc);
+    if (type == T0) {
+        cache_type_flag_phs[phaddr] = T0;
+    } else if (type == T1) {
+        cache_type_flag_phs[phaddr] = T1;
+        cache_t1_type_flag_phs[uniquePeripheral] = 1;
+        cache_t1_type_phs[uniquePeripheral] = std::make_pair(cwirq_value, value);
+    } else if (type == PT1) {
+        cache_type_flag_phs[phaddr] = T1;
+        cache_t1_type_flag_phs[uniquePeripheral] = 2;
+        cache_pt1_type_phs[uniquePeripheral] = std::make_pair(cwirq_value, value);
+    } else if (type == T2) {
+        cache_type_flag_phs[phaddr] = T1;
+        cache_t2_type_flag_phs[uniquePeripheral] = T2;
+        cache_t2_type_phs[uniquePeripheral][cwirq_value] = value;
+    } else if (type == T3) {
+        cache_type_flag_phs[phaddr] = T3;
+        cache_all_cache_phs[phaddr][cwirq_value] = value;
+        cache_t3_type_phs_backup[phaddr].push_back(value);
+        cache_t3_type_phs[phaddr].push_back(value);
+        cache_dr_type_size[phaddr] = pc; // pc_pos is size for t3
+    } else if (type == TIRQS) {
+        cache_type_flag_phs[phaddr] = T1;
+        fixed_type_irq_flag[phaddr] = 1;
+        cache_type_irqs_flag[std::make_tuple(cwirq_value, phaddr, pc)] = 1;
+        cache_tirqs_type_phs[std::make_tuple(cwirq_value, phaddr, pc)].push_back(value);
+    } else {
+        getWarningsStream() << "Unrecognized perpherial\n";
+    }
+    valid_phs.push_back(phaddr);
+}
+
+void PeripheralModelLearning::loadIRQKBEntry(uint32_t irq_no, uint32_t phaddr, uint32_t cr_phaddr, uint32_t value,
+                                             uint32_t cr_value) {
+    cache_type_flag_phs[phaddr] = T1;
+    cache_type_irqc_flag[std::make_pair(irq_no, phaddr)] = 2;
+    cache_tirqc_type_phs[std::make_pair(irq_no, phaddr)][cr_phaddr][cr_value].push_back(value);
+}
+
+void PeripheralModelLearning::loadDRKBEntry(uint32_t phaddr, uint32_t size) {
+    if (cache_type_flag_phs[phaddr] != T3) {
+        cache_type_flag_phs[phaddr] = T3;
+        cache_dr_type_size[phaddr] = size;
+        cache_t3_type_phs[phaddr].push_back(0x0);
+        cache_t3_type_phs[phaddr].pop_front();
+    } else {
+        if (cache_t3_type_phs[phaddr].size() == 1) { //only one item no need for replay leave for fuzzing
+            cache_t3_type_phs[phaddr].pop_front();
+        } else if (cache_t3_type_phs[phaddr].size() == 2) {
+            if ((find(cache_t3_type_phs[phaddr].begin(), cache_t3_type_phs[phaddr].end(), 0x1)
+                    != cache_t3_type_phs[phaddr].end()) && (find(cache_t3_type_phs[phaddr].begin(), cache_t3_type_phs[phaddr].end(), 0x0)
+                    != cache_t3_type_phs[phaddr].end())) {
+                cache_t3_io_type_phs[phaddr] = 1;
+                return;
+            }
+            cache_t3_type_phs[phaddr].pop_front();
+            cache_t3_type_phs[phaddr].pop_front();
+        }
+    }
+}
+
+bool PeripheralModelLearning::readBinaryKBfromFile(std::string fileName) {
+    PeripheralKBFile kb;
+    if (!kb.open(fileName)) {
+        getWarningsStream() << "Could not map binary peripheral knowledge base file: " << fileName << " \n";
+        return false;
+    }
+
+    getInfoStream() << "Loading round " << kb.round()->round << " of " << fileName << " ("
+                    << kb.round()->count << " entries)\n";
+
+    bool general_done = false;
+    for (const PeripheralKBRecord *rec = kb.begin(); rec != kb.end(); ++rec) {
+        if (rec->kind >= KB_TIRQC && !general_done) {
+            std::sort(valid_phs.begin(), valid_phs.end());
+            valid_phs.erase(std::unique(valid_phs.begin(), valid_phs.end()), valid_phs.end());
+            general_done = true;
+        }
+
+        switch (rec->kind) {
+            case KB_T0:
+                loadGeneralKBEntry(T0, rec->phaddr, rec->pc, rec->value, rec->cw_value);
+                break;
+            case KB_T1:
+                loadGeneralKBEntry(T1, rec->phaddr, rec->pc, rec->value, rec->cw_value);
+                break;
+            case KB_PT1:
+            case KB_DT1:
+                loadGeneralKBEntry(PT1, rec->phaddr, rec->pc, rec->value, rec->cw_value);
+                break;
+            case KB_T2:
+                loadGeneralKBEntry(T2, rec->phaddr, rec->pc, rec->value, rec->cw_value);
+                break;
+            case KB_T3:
+                loadGeneralKBEntry(T3, rec->phaddr, rec->pc, rec->value, rec->cw_value);
+                break;
+            case KB_TIRQS:
+                loadGeneralKBEntry(TIRQS, rec->phaddr, rec->pc, rec->value, rec->cw_value);
+                break;
+            case KB_TIRQC:
+                loadIRQKBEntry(rec->cw_value, rec->phaddr, rec->cr_phaddr, rec->value, rec->cr_value);
+                break;
+            case KB_FUZZ:
+                loadDRKBEntry(rec->phaddr, rec->pc);
+                break;
+            case KB_FUZZC:
+                // candidate data registers are only informative
+                break;
+            default:
+                getWarningsStream() << "Unrecognized peripheral kind " << rec->kind << "\n";
+                return false;
+        }
+    }
+
+    if (!general_done) {
+        std::sort(valid_phs.begin(), valid_phs.end());
+        valid_phs.erase(std::unique(valid_phs.begin(), valid_phs.end()), valid_phs.end());
+    }
+
+    return true;
+}
+
+void PeripheralModelLearning::clearKBCache() {
+    cache_t2_type_phs.clear();
+    cache_pt1_type_phs.clear();
+    cache_t1_type_phs.clear();
+    cache_t3_type_phs.clear();
+    cache_t3_type_phs_backup.clear();
+    cache_t3_io_type_phs.clear();
+    cache_dr_type_size.clear();
+    cache_tirqc_type_phs.clear();
+    cache_tirqs_type_phs.clear();
+    cache_type_irqc_flag.clear();
+    cache_type_irqs_flag.clear();
+    cache_type_flag_phs.clear();
+    cache_t1_type_flag_phs.clear();
+    cache_t2_type_flag_phs.clear();
+    cache_all_cache_phs.clear();
+    fixed_type_irq_flag.clear();
+    possible_irq_values.clear();
+    valid_phs.clear();
+}
+
+// Merge the KB learnt by this worker into the one at path, the result replaces fileName
+bool PeripheralModelLearning::mergeSharedKB(const std::string &path) {
+    std::vector<PeripheralKBRecord> published, own, merged;
+    if (!readKBRecords(path, published)) {
+        getWarningsStream() << "Could not read peripheral regs from cache file" << path << "\n";
+        return false;
+    }
+    if (!readKBRecords(fileName, own)) {
+        getWarningsStream() << "Could not read peripheral regs from cache file" << fileName << "\n";
+        return false;
+    }
+
+    mergeKBRecords(published, own, merged);
+    getInfoStream() << "Merged " << merged.size() - published.size() << " entries of " << fileName << " into "
+                    << path << "\n";
+
+    std::size_t index = firmwareName.find_last_of("/\\");
+    std::string mergedName = s2e()->getOutputDirectory() + "/" + firmwareName.substr(index + 1) + "-merged_KB" +
+                             (binary_kb ? ".bin" : ".dat");
+    bool written = binary_kb ? writeKBSnapshot(mergedName, round_count, 0, 0, merged) : writeTextKB(mergedName, merged);
+    if (!written) {
+        getWarningsStream() << "Could not write merged KB " << mergedName << "\n";
+        return false;
+    }
+
+    fileName = mergedName;
+    return true;
+}
+
+void PeripheralModelLearning::publishSharedKB() {
+    if (!shared_kb) {
+        return;
+    }
+
+    // The lock only covers reading and publishing the path, the merge runs unlocked and
+    // is redone if another worker publishes before this one gets the lock back
+    bool stale = false;
+    char path[PATH_MAX];
+    while (true) {
+        if (!realpath(fileName.c_str(), path)) {
+            getWarningsStream() << "Could not resolve " << fileName << ", KB not shared\n";
+            break;
+        }
+
+        PeripheralSharedKB *kb = shared_kb->acquire();
+        uint32_t generation = kb->generation;
+        if (generation == kb_generation) {
+            strncpy(kb->path, path, sizeof(kb->path));
+            ++kb->generation;
+            kb_generation = kb->generation;
+            shared_kb->release();
+            getInfoStream() << "Published KB " << path << " generation " << kb_generation << "\n";
+            break;
+        }
+        std::string published = kb->path;
+        shared_kb->release();
+
+        getWarningsStream() << "KB generation " << generation << " was published meanwhile, merging " << fileName
+                            << " into " << published << "\n";
+        if (!mergeSharedKB(published)) {
+            exit(-1);
+        }
+        kb_generation = generation;
+        stale = true;
+    }
+
+    if (stale) {
+        clearKBCache();
+        if (!readKBfromFile(fileName)) {
+            getWarningsStream() << "Could not read peripheral regs from cache file" << fileName << "\n";
+            exit(-1);
+        }
+    }
+}
+
+bool PeripheralModelLearning::syncSharedKB() {
+    if (!shared_kb || !g_s2e_cache_mode) {
+        return false;
+    }
+
+    if (__atomic_load_n(&shared_kb->get()->generation, __ATOMIC_ACQUIRE) == kb_generation) {
+        return false;
+    }
+
+    PeripheralSharedKB *kb = shared_kb->acquire();
+    std::string path = kb->path;
+    kb_generation = kb->generation;
+    shared_kb->release();
+
+    // The published KB already holds what this worker published, the merge keeps
+    // what it learnt since then
+    getInfoStream() << "Loading KB " << path << " generation " << kb_generation << " from another worker\n";
+    if (!mergeSharedKB(path)) {
+        exit(-1);
+    }
+    clearKBCache();
+    if (!readKBfromFile(fileName)) {
+        getWarningsStream() << "Could not read peripheral regs from cache file" << fileName << "\n";
+        exit(-1);
+    }
+    return true;
+}
+
 bool PeripheralModelLearning::readKBfromFile(std::string fileName) {
+    if (isBinaryKB(fileName)) {
+        return readBinaryKBfromFile(fileName);
+    }
+
     std::ifstream fPHKB;
     std::string line;
     fPHKB.open(fileName, std::ios::in);
@@ -811,36 +1143,7 @@ bool PeripheralModelLearning::readKBfromFile(std::string fileName) {
         }
 
         if (getGeneralEntryfromKB(peripheralcache, &type, &phaddr, &pc, &value, &cwirq_value)) {
-            UniquePeripheral uniquePeripheral = std::make_pair(phaddr, pc);
-            if (type == T0) {
-                cache_type_flag_phs[phaddr] = T0;
-            } else if (type == T1) {
-                cache_type_flag_phs[phaddr] = T1;
-                cache_t1_type_flag_phs[uniquePeripheral] = 1;
-                cache_t1_type_phs[uniquePeripheral] = std::make_pair(cwirq_value, value);
-            } else if (type == PT1) {
-                cache_type_flag_phs[phaddr] = T1;
-                cache_t1_type_flag_phs[uniquePeripheral] = 2;
-                cache_pt1_type_phs[uniquePeripheral] = std::make_pair(cwirq_value, value);
-            } else if (type == T2) {
-                cache_type_flag_phs[phaddr] = T1;
-                cache_t2_type_flag_phs[uniquePeripheral] = T2;
-                cache_t2_type_phs[uniquePeripheral][cwirq_value] = value;
-            } else if (type == T3) {
-                cache_type_flag_phs[phaddr] = T3;
-                cache_all_cache_phs[phaddr][cwirq_value] = value;
-                cache_t3_type_phs_backup[phaddr].push_back(value);
-                cache_t3_type_phs[phaddr].push_back(value);
-                cache_dr_type_size[phaddr] = pc; // pc_pos is size for t3
-            } else if (type == TIRQS) {
-                cache_type_flag_phs[phaddr] = T1;
-                fixed_type_irq_flag[phaddr] = 1;
-                cache_type_irqs_flag[std::make_tuple(cwirq_value, phaddr, pc)] = 1;
-                cache_tirqs_type_phs[std::make_tuple(cwirq_value, phaddr, pc)].push_back(value);
-            } else {
-                getWarningsStream() << "Unrecognized perpherial\n";
-            }
-            valid_phs.push_back(phaddr);
+            loadGeneralKBEntry(type, phaddr, pc, value, cwirq_value);
         } else {
             return false;
         }
@@ -863,9 +1166,7 @@ bool PeripheralModelLearning::readKBfromFile(std::string fileName) {
 
         if (getIRQEntryfromKB(peripheral_irqcr_cache, &irq_no, &type, &phaddr, &cr_phaddr, &value, &cr_value)) {
             if (type == TIRQC) {
-                cache_type_flag_phs[phaddr] = T1;
-                cache_type_irqc_flag[std::make_pair(irq_no, phaddr)] = 2;
-                cache_tirqc_type_phs[std::make_pair(irq_no, phaddr)][cr_phaddr][cr_value].push_back(value);
+                loadIRQKBEntry(irq_no, phaddr, cr_phaddr, value, cr_value);
             } else {
                 getWarningsStream() << "unrecognized perpherial\n";
             }
@@ -885,25 +1186,7 @@ bool PeripheralModelLearning::readKBfromFile(std::string fileName) {
         }
 
         if (getDREntryfromKB(peripheral_dr_cache, &type, &phaddr, &size)) {
-            if (cache_type_flag_phs[phaddr] != T3) {
-                cache_type_flag_phs[phaddr] = T3;
-                cache_dr_type_size[phaddr] = size;
-                cache_t3_type_phs[phaddr].push_back(0x0);
-                cache_t3_type_phs[phaddr].pop_front();
-            } else {
-                if (cache_t3_type_phs[phaddr].size() == 1) { //only one item no need for replay leave for fuzzing
-                    cache_t3_type_phs[phaddr].pop_front();
-                } else if (cache_t3_type_phs[phaddr].size() == 2) {
-                    if ((find(cache_t3_type_phs[phaddr].begin(), cache_t3_type_phs[phaddr].end(), 0x1)
-                            != cache_t3_type_phs[phaddr].end()) && (find(cache_t3_type_phs[phaddr].begin(), cache_t3_type_phs[phaddr].end(), 0x0)
-                            != cache_t3_type_phs[phaddr].end())) {
-                        cache_t3_io_type_phs[phaddr] = 1;
-                        continue;
-                    }
-                    cache_t3_type_phs[phaddr].pop_front();
-                    cache_t3_type_phs[phaddr].pop_front();
-                }
-            }
+            loadDRKBEntry(phaddr, size);
         } else {
             return false;
         }
@@ -924,7 +1207,19 @@ struct CmpByNo {
     }
 };
 
-void PeripheralModelLearning::writeTIRQPeripheralstoKB(S2EExecutionState *state, std::ofstream &fPHKB) {
+static PeripheralKBRecord makeKBRecord(uint32_t kind, uint32_t phaddr, uint32_t pc, uint64_t cw_value,
+                                       uint32_t value) {
+    PeripheralKBRecord rec = {kind, phaddr, pc, value, cw_value, 0, 0};
+    return rec;
+}
+
+static PeripheralKBRecord makeIRQKBRecord(uint32_t irq_no, uint32_t phaddr, uint32_t cr_phaddr, uint32_t cr_value,
+                                          uint32_t value) {
+    PeripheralKBRecord rec = {KB_TIRQC, phaddr, 0, value, irq_no, cr_phaddr, cr_value};
+    return rec;
+}
+
+void PeripheralModelLearning::writeTIRQPeripheralstoKB(S2EExecutionState *state, std::ostream &fPHKB) {
     DECLARE_PLUGINSTATE(PeripheralModelLearningState, state);
 
     TIRQCPeripheralMap tirqc_type_phs = plgState->get_tirqc_type_all_phs();
@@ -935,9 +1230,9 @@ void PeripheralModelLearning::writeTIRQPeripheralstoKB(S2EExecutionState *state,
         if (plgState->get_type_flag_ph_it(std::get<1>(itpossirqs.first)) == T1 && irq_data_phs[std::get<1>(itpossirqs.first)] != 2) {
             if (plgState->get_irq_flag_ph_it(std::get<1>(itpossirqs.first)) == 1) {
                 for (auto irqs_value : itpossirqs.second) {
-                    fPHKB << "tirqs_" << hexval(std::get<1>(itpossirqs.first)) << "_"
-                          << hexval(std::get<2>(itpossirqs.first)) << "_" << hexval(std::get<0>(itpossirqs.first))
-                          << "_" << hexval(irqs_value) << std::endl;
+                    writeKBRecord(fPHKB, makeKBRecord(KB_TIRQS, std::get<1>(itpossirqs.first),
+                                                      std::get<2>(itpossirqs.first), std::get<0>(itpossirqs.first),
+                                                      irqs_value));
                 }
             } else if (plgState->get_irq_flag_ph_it(std::get<1>(itpossirqs.first)) == 2 &&
                        tirqc_type_phs[std::make_pair(std::get<0>(itpossirqs.first), std::get<1>(itpossirqs.first))]
@@ -950,15 +1245,15 @@ void PeripheralModelLearning::writeTIRQPeripheralstoKB(S2EExecutionState *state,
                       << hexval(std::get<2>(itpossirqs.first)) << "_" << hexval(std::get<0>(itpossirqs.first)) << " size = "
                       << tirqc_type_phs[std::make_pair(std::get<0>(itpossirqs.first), std::get<1>(itpossirqs.first))].size() << "\n";
                 for (auto irqs_value : itpossirqs.second) {
-                    fPHKB << "tirqs_" << hexval(std::get<1>(itpossirqs.first)) << "_"
-                          << hexval(std::get<2>(itpossirqs.first)) << "_" << hexval(std::get<0>(itpossirqs.first))
-                          << "_" << hexval(irqs_value) << std::endl;
+                    writeKBRecord(fPHKB, makeKBRecord(KB_TIRQS, std::get<1>(itpossirqs.first),
+                                                      std::get<2>(itpossirqs.first), std::get<0>(itpossirqs.first),
+                                                      irqs_value));
                 }
             }
         }
     }
 
-    fPHKB << "IRQCR" << std::endl;
+    writeKBSection(fPHKB, "IRQCR");
 
     for (auto ittirqc : tirqc_type_phs) {
         if (plgState->get_type_flag_ph_it(ittirqc.first.second) == T1 && irq_data_phs[ittirqc.first.second] != 2) {
@@ -966,13 +1261,11 @@ void PeripheralModelLearning::writeTIRQPeripheralstoKB(S2EExecutionState *state,
                 for (auto itcrs : ittirqc.second) {
                     for (auto itcr : itcrs.second) {
                         for (auto itv : itcr.second) {
-                            fPHKB << "tirqc_" << hexval(ittirqc.first.first) << "_" << hexval(ittirqc.first.second)
-                                  << "_" << hexval(itcrs.first) << "_" << hexval(itcr.first) << "_" << hexval(itv)
-                                  << std::endl;
+                            writeKBRecord(fPHKB, makeIRQKBRecord(ittirqc.first.first, ittirqc.first.second,
+                                                                 itcrs.first, itcr.first, itv));
                             if (itv != 0)
-                            fPHKB << "tirqc_" << hexval(ittirqc.first.first) << "_" << hexval(ittirqc.first.second)
-                                  << "_" << hexval(itcrs.first) << "_" << hexval(itcr.first) << "_" << hexval(itv)
-                                  << std::endl;
+                            writeKBRecord(fPHKB, makeIRQKBRecord(ittirqc.first.first, ittirqc.first.second,
+                                                                 itcrs.first, itcr.first, itv));
                         }
                     }
                 }
@@ -986,9 +1279,8 @@ void PeripheralModelLearning::writeTIRQPeripheralstoKB(S2EExecutionState *state,
                 for (auto itcrs : itetirqc.second) {
                     for (auto itcr : itcrs.second) {
                         for (auto itv : itcr.second) {
-                            fPHKB << "tirqc_" << hexval(itetirqc.first.first) << "_" << hexval(itetirqc.first.second)
-                                  << "_" << hexval(itcrs.first) << "_" << hexval(itcr.first) << "_" << hexval(itv)
-                                  << std::endl;
+                            writeKBRecord(fPHKB, makeIRQKBRecord(itetirqc.first.first, itetirqc.first.second,
+                                                                 itcrs.first, itcr.first, itv));
                         }
                     }
                 }
@@ -997,21 +1289,21 @@ void PeripheralModelLearning::writeTIRQPeripheralstoKB(S2EExecutionState *state,
     }
 }
 
-void PeripheralModelLearning::identifyDataPeripheralRegs(S2EExecutionState *state, std::ofstream &fPHKB) {
+void PeripheralModelLearning::identifyDataPeripheralRegs(S2EExecutionState *state, std::ostream &fPHKB) {
     DECLARE_PLUGINSTATE(PeripheralModelLearningState, state);
 
     ReadPeripheralMap read_cache_phs = plgState->get_readphs();
     ReadPeripheralMap read_cache_data_phs;
-    TypeFlagPeripheralMap type_flag_phs = plgState->get_type_flag_phs();
+    const TypeFlagPeripheralMap &type_flag_phs = plgState->get_type_flag_phs();
 
     ReadPeripheralMap::iterator it;
     it = read_cache_phs.begin();
     while (it != read_cache_phs.end()) {
-        if (type_flag_phs[it->first] == T3) {
+        if (lookup(type_flag_phs, it->first) == T3) {
             read_cache_data_phs[it->first] = it->second;
             read_cache_phs.erase(it++);
             continue;
-        } else if (type_flag_phs[it->first] == T1) {
+        } else if (lookup(type_flag_phs, it->first) == T1) {
             if (irq_data_phs[it->first] == 2) { // data regs in irq
                 getInfoStream() << "The first kind of data register phaddr = "
                                  << hexval(it->first) << " count = " << it->second.second << "\n";
@@ -1055,21 +1347,19 @@ void PeripheralModelLearning::identifyDataPeripheralRegs(S2EExecutionState *stat
         fuzz_data_phs.push_back(std::make_pair(it.first, it.second));
     }
 
-    fPHKB << "DefaultDataRegs" << std::endl;
+    writeKBSection(fPHKB, "DefaultDataRegs");
     std::sort(fuzz_data_phs.begin(), fuzz_data_phs.end(), CmpByCount());
     for (auto itd : fuzz_data_phs) {
-        fPHKB << "fuzz_" << hexval(itd.first) << "_" << hexval(itd.second.first) << "_" << hexval(itd.second.second)
-              << std::endl;
+        writeKBRecord(fPHKB, makeKBRecord(KB_FUZZ, itd.first, itd.second.first, 0, itd.second.second));
     }
 
-    fPHKB << "CandidateDataRegs" << std::endl;
+    writeKBSection(fPHKB, "CandidateDataRegs");
     for (auto &it : read_cache_phs) {
         fuzz_candidate_phs.push_back(std::make_pair(it.first, it.second));
     }
     std::sort(fuzz_candidate_phs.begin(), fuzz_candidate_phs.end(), CmpByCount());
     for (auto itc : fuzz_candidate_phs) {
-        fPHKB << "fuzzc_" << hexval(itc.first) << "_" << hexval(itc.second.first) << "_" << hexval(itc.second.second)
-              << std::endl;
+        writeKBRecord(fPHKB, makeKBRecord(KB_FUZZC, itc.first, itc.second.first, 0, itc.second.second));
     }
 }
 
@@ -1078,20 +1368,6 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
 
     uint32_t phaddr = address;
     uint32_t pc = state->regs()->getPc();
-    std::stringstream ss;
-    switch (type) {
-        case SYMB_MMIO:
-            ss << "iommuread_";
-            break;
-        case SYMB_DMA:
-            ss << "dmaread_";
-            break;
-        case SYMB_PORT:
-            ss << "portread_";
-            break;
-    }
-
-    ss << hexval(address) << "@" << hexval(pc);
 
     // record all read phs
     DECLARE_PLUGINSTATE(PeripheralModelLearningState, state);
@@ -1128,18 +1404,19 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
     } else {
         sum_hash = plgState->get_current_hash(0);
     }
-    ss << "_" << hexval(sum_hash);
+    uint32_t site = internAccessSite(phaddr, pc, sum_hash);
 
     plgState->insert_t0_type_flag_phs(phaddr, 1);
     all_peripheral_no++;
 
-    getInfoStream(state) << ss.str() << " size " << hexval(size) << " sum_hash = " << hexval(sum_hash)
+    getInfoStream(state) << "read ph addr = " << hexval(phaddr) << " pc = " << hexval(pc)
+                             << " size " << hexval(size) << " sum_hash = " << hexval(sum_hash)
                              << " reading times = " << plgState->get_readphs_count(phaddr)
                              << " peripheral no = " << all_peripheral_no - 1 << "\n";
 
     // first find peripheral type
-    TypeFlagPeripheralMap type_flag_phs = plgState->get_type_flag_phs();
-    TypeFlagPeripheralMap::iterator itf = type_flag_phs.find(phaddr);
+    const TypeFlagPeripheralMap &type_flag_phs = plgState->get_type_flag_phs();
+    TypeFlagPeripheralMap::const_iterator itf = type_flag_phs.find(phaddr);
     if (itf == type_flag_phs.end()) {
         ConcreteArray concolicValue;
         if (state->regs()->getInterruptFlag() && state->regs()->getExceptionIndex() > 15) {
@@ -1162,7 +1439,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
         plgState->insert_type_flag_phs(phaddr, T1);
         SymbHwGetConcolicVector(0x0, size, concolicValue);
         plgState->insert_cachephs(phaddr, all_peripheral_no - 1, 0);
-        return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+        return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
     }
 
     if (enable_fuzzing) {
@@ -1205,7 +1482,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
             }
             ConcreteArray concolicValue;
             SymbHwGetConcolicVector(value, size, concolicValue);
-            return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+            return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
         }
         case T1: {
             if (state->regs()->getInterruptFlag() && state->regs()->getExceptionIndex() > 15) { // irq mode
@@ -1268,7 +1545,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
                         already_used_irq_values[uniqueirqsphs].push_back(IRQS_value);
                     }
                     SymbHwGetConcolicVector(IRQS_value, size, concolicValue);
-                    return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+                    return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
                 }
             } else { // normal mode
                 if (plgState->get_t2_type_flag_ph_it(UniquePeripheral(phaddr, pc)) == T2) {
@@ -1287,17 +1564,17 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
                         } else {
                             ConcreteArray concolicValue;
                             SymbHwGetConcolicVector(value, size, concolicValue);
-                            return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+                            return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
                         }
                     } else {
                         plgState->insert_pt2_type_flag_ph_it(UniquePeripheral(phaddr, pc), sum_hash, 1);
                         ConcreteArray concolicValue;
                         SymbHwGetConcolicVector(0x0, size, concolicValue);
-                        return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+                        return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
                     }
                 } else { // real T1
-                    T1BNPeripheralMap t1_type_phs = plgState->get_t1_type_phs();
-                    T1BNPeripheralMap::iterator itt1 = t1_type_phs.find(UniquePeripheral(phaddr, pc));
+                    const T1BNPeripheralMap &t1_type_phs = plgState->get_t1_type_phs();
+                    auto itt1 = t1_type_phs.find(UniquePeripheral(phaddr, pc));
                     if (itt1 != t1_type_phs.end()) {
                         value = plgState->get_t1_type_ph_it(UniquePeripheral(phaddr, pc));
                         plgState->insert_pt1_type_flag_phs(UniquePeripheral(phaddr, pc), 2);
@@ -1310,17 +1587,17 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
                             plgState->insert_cachephs(phaddr, all_peripheral_no - 1, value);
                             ConcreteArray concolicValue;
                             SymbHwGetConcolicVector(value, size, concolicValue);
-                            return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+                            return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
                         }
                     } else {
-                        T1BNPeripheralMap pt1_type_phs = plgState->get_pt1_type_phs();
-                        T1BNPeripheralMap::iterator itpt1 = pt1_type_phs.find(UniquePeripheral(phaddr, pc));
+                        const T1BNPeripheralMap &pt1_type_phs = plgState->get_pt1_type_phs();
+                        auto itpt1 = pt1_type_phs.find(UniquePeripheral(phaddr, pc));
                         if (itpt1 == pt1_type_phs.end()) {
                             plgState->insert_cachephs(phaddr, all_peripheral_no - 1, 0);
                             ConcreteArray concolicValue;
                             plgState->insert_pt1_type_flag_phs(UniquePeripheral(phaddr, pc), 1);
                             SymbHwGetConcolicVector(0x0, size, concolicValue);
-                            return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+                            return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
                         } else {
                             plgState->insert_pt1_type_flag_phs(UniquePeripheral(phaddr, pc), 2);
                             value = plgState->get_pt1_type_ph_it(UniquePeripheral(phaddr, pc));
@@ -1335,7 +1612,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
                                 plgState->insert_cachephs(phaddr, all_peripheral_no - 1, value);
                                 ConcreteArray concolicValue;
                                 SymbHwGetConcolicVector(value, size, concolicValue);
-                                return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+                                return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
                             }
                         }
                     }
@@ -1420,7 +1697,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onLearningMode(S2EExecutionState
                                  << " no = " << all_peripheral_no - 1 << "\n";
                 ConcreteArray concolicValue;
                 SymbHwGetConcolicVector(plgState->get_t3_type_ph_it_back(phaddr), size, concolicValue);
-                return state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+                return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
             }
         }
         default: {
@@ -1435,20 +1712,6 @@ klee::ref<klee::Expr> PeripheralModelLearning::onFuzzingMode(S2EExecutionState *
 
     uint32_t phaddr = address;
     uint32_t pc = state->regs()->getPc();
-    std::stringstream ss;
-    switch (type) {
-        case SYMB_MMIO:
-            ss << "iommuread_";
-            break;
-        case SYMB_DMA:
-            ss << "dmaread_";
-            break;
-        case SYMB_PORT:
-            ss << "portread_";
-            break;
-    }
-
-    ss << hexval(address) << "@" << hexval(pc);
 
     // record all read phs
     DECLARE_PLUGINSTATE(PeripheralModelLearningState, state);
@@ -1464,7 +1727,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onFuzzingMode(S2EExecutionState *
             onInvalidPHs.emit(state, phaddr);
             return klee::ConstantExpr::create(0x0, size * 8);
         }
-        return switchModefromFtoL(state, ss.str(), phaddr, size, concreteValue);
+        return switchModefromFtoL(state, type, phaddr, size, concreteValue);
     }
 
     bool fuzzOk = false;
@@ -1583,7 +1846,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onFuzzingMode(S2EExecutionState *
                                             << " cr value = " << hexval(plgState->get_writeph(cache_tirqc_phs.first))
                                             << " irq no = " << state->regs()->getExceptionIndex() << "\n";
                                         concreteValue = sr_value & (LSB - 1);
-                                        return switchModefromFtoL(state, ss.str(), phaddr, size, concreteValue);
+                                        return switchModefromFtoL(state, type, phaddr, size, concreteValue);
                                     }
                                 }
                             }
@@ -1594,7 +1857,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onFuzzingMode(S2EExecutionState *
                                 << " cr value = " << hexval(plgState->get_writeph(cache_tirqc_phs.first))
                                 << " irq no = " << state->regs()->getExceptionIndex() << "\n";
                                 concreteValue = 0x0 & (LSB - 1);
-                            return switchModefromFtoL(state, ss.str(), phaddr, size, concreteValue);
+                            return switchModefromFtoL(state, type, phaddr, size, concreteValue);
                         }
                     }
                 } else if (cache_t1_type_flag_phs[UniquePeripheral(phaddr, pc)] == 2) {
@@ -1606,7 +1869,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onFuzzingMode(S2EExecutionState *
                     getInfoStream() << " New periperal in IRQ change mode ph addr = " << hexval(phaddr) << " pc = " << hexval(pc)
                                         << " size =" << hexval(size) << "\n";
                     concreteValue = 0x0 & (LSB - 1);
-                    return switchModefromFtoL(state, ss.str(), phaddr, size, concreteValue);
+                    return switchModefromFtoL(state, type, phaddr, size, concreteValue);
                 }
             } else { // normal mode
                 if (cache_t2_type_flag_phs[UniquePeripheral(phaddr, pc)] == T2) {
@@ -1618,7 +1881,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onFuzzingMode(S2EExecutionState *
                                          << " size =" << hexval(size) << "\n";
                         return klee::ConstantExpr::create(value, size * 8);
                     } else {
-                        return switchModefromFtoL(state, ss.str(), phaddr, size, concreteValue);
+                        return switchModefromFtoL(state, type, phaddr, size, concreteValue);
                     }
                 } else {
                     T1PeripheralMap::iterator itt1s = cache_t1_type_flag_phs.find(UniquePeripheral(phaddr, pc));
@@ -1635,7 +1898,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onFuzzingMode(S2EExecutionState *
                                          << " value = " << hexval(value) << " size =" << hexval(size) << "\n";
                         return klee::ConstantExpr::create(value, size * 8);
                     } else {
-                        return switchModefromFtoL(state, ss.str(), phaddr, size, concreteValue);
+                        return switchModefromFtoL(state, type, phaddr, size, concreteValue);
                     }
                 }
             }
@@ -1660,7 +1923,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::onFuzzingMode(S2EExecutionState *
                                  << " value = " << hexval(value) << " size = " << hexval(size) << "\n";
                 return klee::ConstantExpr::create(value, size * 8);
             } else {
-                return switchModefromFtoL(state, ss.str(), phaddr, size, concreteValue);
+                return switchModefromFtoL(state, type, phaddr, size, concreteValue);
             }
         }
         default: {
@@ -1734,9 +1997,8 @@ void PeripheralModelLearning::onWritePeripheral(S2EExecutionState *state, uint64
         getDebugStream() << "writing mmio " << hexval(phaddr) << " value: " << hexval(writeConcreteValue) << "\n";
         plgState->update_writeph((uint32_t) phaddr, writeConcreteValue);
 
-        TypeFlagPeripheralMap type_flag_phs = plgState->get_type_flag_phs();
-        TypeFlagPeripheralMap::iterator itf = type_flag_phs.find(phaddr);
-        if (itf != type_flag_phs.end()) {
+        const TypeFlagPeripheralMap &type_flag_phs = plgState->get_type_flag_phs();
+        if (type_flag_phs.find(phaddr) != type_flag_phs.end()) {
             if (plgState->get_type_flag_ph_it(phaddr) == T1 && plgState->get_lock_t1_type_flag(phaddr) != 1) {
                 if (!state->regs()->getInterruptFlag()) {
                     getInfoStream() << " mmio " << hexval(phaddr) << " change to T0\n";
@@ -1778,10 +2040,95 @@ void SplitString(const std::string &s, std::vector<std::string> &v, const std::s
         v.push_back(s.substr(pos1));
 }
 
-bool PeripheralModelLearning::getPeripheralExecutionState(std::string variablePeripheralName, uint32_t *phaddr,
-                                                          uint32_t *pc, uint64_t *ch_value, uint64_t *no) {
+uint32_t PeripheralModelLearning::internAccessSite(uint32_t phaddr, uint32_t pc, uint64_t regs_hash) {
+    T2Tuple key = std::make_tuple(phaddr, pc, regs_hash);
+    auto it = access_site_ids.find(key);
+    if (it != access_site_ids.end()) {
+        return it->second;
+    }
+
+    uint32_t site = access_sites.size();
+    access_sites.push_back(key);
+    access_site_ids[key] = site;
+    return site;
+}
+
+// The name is only needed by the solver and the test case generator, all lookups in this
+// plugin go through the interned site of the symbolic variable.
+klee::ref<klee::Expr> PeripheralModelLearning::createPeripheralSymbolicValue(S2EExecutionState *state,
+                                                                           SymbolicHardwareAccessType type,
+                                                                           uint32_t site, unsigned size,
+                                                                           const ConcreteArray &concolicValue) {
+    const T2Tuple &key = access_sites[site];
+    std::stringstream ss;
+    switch (type) {
+        case SYMB_MMIO:
+            ss << "iommuread_";
+            break;
+        case SYMB_DMA:
+            ss << "dmaread_";
+            break;
+        case SYMB_PORT:
+            ss << "portread_";
+            break;
+    }
+
+    ss << hexval(std::get<0>(key)) << "@" << hexval(std::get<1>(key)) << "_" << hexval(std::get<2>(key));
+
+    klee::ref<klee::Expr> ret = state->createSymbolicValue(ss.str(), size * 8, concolicValue);
+
+    // createSymbolicValue appends the unique number of the variable to its name
+    uint64_t no;
+    getSymbolicVariableNo(state->symbolics.back()->getName(), &no);
+    symbolic_access_sites[no] = site;
+
+    if (symbolic_access_sites.size() > symbolic_access_sites_limit) {
+        pruneSymbolicAccessSites();
+    }
+
+    return ret;
+}
+
+// Forget the variables that no live state refers to anymore. The variables of states kept
+// aside by this plugin may be dropped too, their lookups then fall back to the name.
+void PeripheralModelLearning::pruneSymbolicAccessSites() {
+    SymbolicAccessSiteMap live;
+    for (auto es : s2e()->getExecutor()->getStates()) {
+        for (const auto &arr : es->symbolics) {
+            uint64_t no;
+            if (!getSymbolicVariableNo(arr->getName(), &no)) {
+                continue;
+            }
+            auto it = symbolic_access_sites.find(no);
+            if (it != symbolic_access_sites.end()) {
+                live.insert(*it);
+            }
+        }
+    }
+
+    getDebugStream() << "prune symbolic access sites " << symbolic_access_sites.size() << " -> " << live.size()
+                     << "\n";
+    symbolic_access_sites.swap(live);
+    symbolic_access_sites_limit = std::max(MIN_SYMBOLIC_ACCESS_SITES, 2 * symbolic_access_sites.size());
+}
+
+bool PeripheralModelLearning::getPeripheralExecutionState(const klee::ArrayPtr &arr, uint32_t *phaddr, uint32_t *pc,
+                                                          uint64_t *ch_value, uint64_t *no) {
+    // unique numbers are never reused, unlike the addresses of freed arrays
+    if (getSymbolicVariableNo(arr->getName(), no)) {
+        auto it = symbolic_access_sites.find(*no);
+        if (it != symbolic_access_sites.end()) {
+            const T2Tuple &key = access_sites[it->second];
+            *phaddr = std::get<0>(key);
+            *pc = std::get<1>(key);
+            *ch_value = std::get<2>(key);
+            return true;
+        }
+    }
+
+    // not created by this plugin, fall back to the variable name
     boost::smatch what;
-    if (!boost::regex_match(variablePeripheralName, what, PeripheralModelLearningRegEx)) {
+    if (!boost::regex_match(arr->getName(), what, PeripheralModelLearningRegEx)) {
         getWarningsStream() << "match false"
                             << "\n";
         exit(0);
@@ -1808,6 +2155,21 @@ bool PeripheralModelLearning::getPeripheralExecutionState(std::string variablePe
     return true;
 }
 
+void PeripheralModelLearning::writeKBRecord(std::ostream &fPHKB, const PeripheralKBRecord &rec) {
+    if (binary_kb) {
+        kb_records.push_back(rec);
+    } else {
+        fPHKB << formatKBRecord(rec) << std::endl;
+    }
+}
+
+// sections are implied by the record kinds in the binary KB
+void PeripheralModelLearning::writeKBSection(std::ostream &fPHKB, const char *name) {
+    if (!binary_kb) {
+        fPHKB << name << std::endl;
+    }
+}
+
 void PeripheralModelLearning::saveKBtoFile(S2EExecutionState *state, uint64_t tb_num) {
     DECLARE_PLUGINSTATE(PeripheralModelLearningState, state);
 
@@ -1815,12 +2177,12 @@ void PeripheralModelLearning::saveKBtoFile(S2EExecutionState *state, uint64_t tb
     durationtime = durationtime + (end - start);
     getInfoStream(state) << "Learning time = " << durationtime << "s\n";
 
-    T1BNPeripheralMap t1_type_phs = plgState->get_t1_type_phs();
-    T1BNPeripheralMap pt1_type_phs = plgState->get_pt1_type_phs();
-    T2PeripheralMap t2_type_phs = plgState->get_t2_type_phs();
-    TypeFlagPeripheralMap type_flag_phs = plgState->get_type_flag_phs();
-    T1PeripheralMap pdata_type_phs = plgState->get_pdata_type_phs();
-    T1PeripheralMap pt1_type_flag_all_phs = plgState->get_pt1_type_flag_all_phs();
+    const T1BNPeripheralMap &t1_type_phs = plgState->get_t1_type_phs();
+    const T1BNPeripheralMap &pt1_type_phs = plgState->get_pt1_type_phs();
+    const T2PeripheralMap &t2_type_phs = plgState->get_t2_type_phs();
+    const TypeFlagPeripheralMap &type_flag_phs = plgState->get_type_flag_phs();
+    const T1PeripheralMap &pdata_type_phs = plgState->get_pdata_type_phs();
+    const T1PeripheralMap &pt1_type_flag_all_phs = plgState->get_pt1_type_flag_all_phs();
     TypeFlagPeripheralMap All_rphs;
     TypeFlagPeripheralMap T0_phs;
     TypeFlagPeripheralMap T1_phs;
@@ -1833,36 +2195,39 @@ void PeripheralModelLearning::saveKBtoFile(S2EExecutionState *state, uint64_t tb
     fileName = s2e()->getOutputDirectory() + "/" + firmwareName.substr(index + 1) +
                "-round" + std::to_string(round_count) + "-state" +
                std::to_string(state->getID()) + "-tbnum" + std::to_string(tb_num) + "_KB.dat";
-    std::ofstream fPHKB;
-    fPHKB.open(fileName, std::ios::out | std::ios::trunc);
+    // the binary KB keeps all rounds in one file, each round is appended to it
+    std::ofstream fTextKB;
+    std::stringstream fStatistic;
+    if (binary_kb) {
+        fileName = s2e()->getOutputDirectory() + "/" + firmwareName.substr(index + 1) + "_KB.bin";
+        kb_records.clear();
+    } else {
+        fTextKB.open(fileName, std::ios::out | std::ios::trunc);
+    }
+    std::ostream &fPHKB = binary_kb ? static_cast<std::ostream &>(fStatistic) : fTextKB;
 
-    for (auto itflag : type_flag_phs) {
+    for (const auto &itflag : type_flag_phs) {
         if (plgState->get_t0_type_flag_ph_it(itflag.first) == 1) {
             All_rphs[itflag.first] = 1;
             if (itflag.second == T0) {
                 T0_phs[itflag.first] = 1;
-                fPHKB << "t0_" << hexval(itflag.first) << "_"
-                      << "0x0"
-                      << "_"
-                      << "0x0"
-                      << "_"
-                      << "0x0" << std::endl;
+                writeKBRecord(fPHKB, makeKBRecord(KB_T0, itflag.first, 0, 0, 0));
             }
         }
     }
 
-    for (auto itt1 : t1_type_phs) {
+    for (const auto &itt1 : t1_type_phs) {
         if (plgState->get_type_flag_ph_it(itt1.first.first) == T1) {
             if (plgState->get_t2_type_flag_ph_it(itt1.first) != T2) {
                 All_rphs[itt1.first.first] = 1;
                 T1_phs[itt1.first.first] = 1;
-                fPHKB << "t1_" << hexval(itt1.first.first) << "_" << hexval(itt1.first.second) << "_"
-                      << hexval(itt1.second.first) << "_" << hexval(itt1.second.second.second) << std::endl;
+                writeKBRecord(fPHKB, makeKBRecord(KB_T1, itt1.first.first, itt1.first.second, itt1.second.first,
+                                                  itt1.second.second.second));
             }
         }
     }
 
-    for (auto itpt1 : pt1_type_phs) {
+    for (const auto &itpt1 : pt1_type_phs) {
         if (plgState->get_type_flag_ph_it(itpt1.first.first) == T1) {
             All_rphs[itpt1.first.first] = 1;
             if (plgState->get_pt1_type_flag_ph_it(itpt1.first) == 2) {
@@ -1877,47 +2242,43 @@ void PeripheralModelLearning::saveKBtoFile(S2EExecutionState *state, uint64_t tb
                 if (T1_phs[itpt1.first.first] != 1) {
                     PT1_phs[itpt1.first.first] = 1;
                 }
-                fPHKB << "pt1_" << hexval(itpt1.first.first) << "_" << hexval(itpt1.first.second) << "_"
-                      << hexval(itpt1.second.first) << "_" << hexval(itpt1.second.second.second) << std::endl;
+                writeKBRecord(fPHKB, makeKBRecord(KB_PT1, itpt1.first.first, itpt1.first.second, itpt1.second.first,
+                                                  itpt1.second.second.second));
             }
         } else if (plgState->get_type_flag_ph_it(itpt1.first.first) == T3) {
             getInfoStream() << "dt1 type change to temp t3 during fuzzing phase!\n";
-            fPHKB << "dt1_" << hexval(itpt1.first.first) << "_" << hexval(itpt1.first.second) << "_"
-                  << hexval(itpt1.second.first) << "_" << hexval(itpt1.second.second.second) << std::endl;
+            writeKBRecord(fPHKB, makeKBRecord(KB_DT1, itpt1.first.first, itpt1.first.second, itpt1.second.first,
+                                              itpt1.second.second.second));
         }
     }
 
-    for (auto itd : pt1_type_flag_all_phs) {
+    for (const auto &itd : pt1_type_flag_all_phs) {
         if (plgState->get_type_flag_ph_it(itd.first.first) == T1) {
             if (plgState->get_pt1_type_flag_ph_it(itd.first) == 1) {
                 if (plgState->get_dt1_type_flag_ph_it(itd.first.first) != 2) {
                     plgState->insert_dt1_type_flag_phs(itd.first.first, 1);
                 }
                 if (pdata_type_phs.count(itd.first) == 0) {
-                    fPHKB << "dt1_" << hexval(itd.first.first) << "_" << hexval(itd.first.second) << "_"
-                          << "0x0"
-                          << "_"
-                          << "0x0" << std::endl;
+                    writeKBRecord(fPHKB, makeKBRecord(KB_DT1, itd.first.first, itd.first.second, 0, 0));
                 } else {
-                    fPHKB << "dt1_" << hexval(itd.first.first) << "_" << hexval(itd.first.second) << "_"
-                          << "0x0"
-                          << "_" << hexval(pdata_type_phs[itd.first]) << std::endl;
+                    writeKBRecord(fPHKB, makeKBRecord(KB_DT1, itd.first.first, itd.first.second, 0,
+                                                      lookup(pdata_type_phs, itd.first)));
                 }
             }
         }
     }
 
-    for (auto itt2 : t2_type_phs) {
+    for (const auto &itt2 : t2_type_phs) {
         All_rphs[itt2.first.first] = 1;
         T2_phs[itt2.first.first] = 1;
-        for (auto itt2it : itt2.second) {
-            fPHKB << "t2_" << hexval(itt2.first.first) << "_" << hexval(itt2.first.second) << "_"
-                  << hexval(itt2it.first) << "_" << hexval(itt2it.second) << std::endl;
+        for (const auto &itt2it : itt2.second) {
+            writeKBRecord(fPHKB,
+                          makeKBRecord(KB_T2, itt2.first.first, itt2.first.second, itt2it.first, itt2it.second));
         }
     }
 
-    for (auto ituncaches : plgState->get_all_cache_phs()) {
-        if (type_flag_phs[ituncaches.first] == T3) {
+    for (const auto &ituncaches : plgState->get_all_cache_phs()) {
+        if (lookup(type_flag_phs, ituncaches.first) == T3) {
             std::vector<std::pair<uint64_t, uint32_t>> ituncaches_vec;
             ituncaches_vec.clear();
             for (auto &itun : ituncaches.second) {
@@ -1949,20 +2310,23 @@ void PeripheralModelLearning::saveKBtoFile(S2EExecutionState *state, uint64_t tb
                 for (uint32_t T3_value : unique_T3_values) {
                     if (unique_T3_values.size() > 2 && irq_data_phs[ituncaches.first] == 2) {
                         for (uint32_t k = 0; k < max_t3_size/unique_T3_values.size(); k++) {
-                            fPHKB << "t3_" << hexval(ituncaches.first) << "_" << hexval(plgState->get_readphs_size(ituncaches.first))
-                                  << "_" << j++ << "_" << hexval(T3_value) << std::endl;
+                            writeKBRecord(fPHKB, makeKBRecord(KB_T3, ituncaches.first,
+                                                              plgState->get_readphs_size(ituncaches.first), j++,
+                                                              T3_value));
                         }
                     } else {
-                        fPHKB << "t3_" << hexval(ituncaches.first) << "_" << hexval(plgState->get_readphs_size(ituncaches.first))
-                              << "_" << j++ << "_" << hexval(T3_value) << std::endl;
+                        writeKBRecord(fPHKB, makeKBRecord(KB_T3, ituncaches.first,
+                                                          plgState->get_readphs_size(ituncaches.first), j++,
+                                                          T3_value));
                     }
                 }
             } else {
                 int j = 1;
                 for (auto ituncache_vec : ituncaches_vec) {
                     if (j <= max_t3_size) {
-                        fPHKB << "t3_" << hexval(ituncaches.first) << "_" << hexval(plgState->get_readphs_size(ituncaches.first))
-                              << "_" << j++ << "_" << hexval(ituncache_vec.second) << std::endl;
+                        writeKBRecord(fPHKB, makeKBRecord(KB_T3, ituncaches.first,
+                                                          plgState->get_readphs_size(ituncaches.first), j++,
+                                                          ituncache_vec.second));
                     }
                 }
             }
@@ -1979,14 +2343,14 @@ void PeripheralModelLearning::saveKBtoFile(S2EExecutionState *state, uint64_t tb
           << " T2 num = " << T2_phs.size() << " T3 num = " << T3_phs.size() << std::endl;
     fPHKB << " All read peripheral regs num = " << All_rphs.size() << std::endl;
 
-    TypeFlagPeripheralMap All_Cond_phs = plgState->get_condition_phs();
+    const TypeFlagPeripheralMap &All_Cond_phs = plgState->get_condition_phs();
     uint32_t CT0 = 0, CT1 = 0, CT2 = 0, CT3 = 0;
     std::vector<uint32_t> cond_phs_vec;
-    for (auto ph : plgState->get_all_rw_phs()) {
+    for (const auto &ph : plgState->get_all_rw_phs()) {
         cond_phs_vec.push_back(ph.first);
     }
 
-    for (auto c_ph : All_Cond_phs) {
+    for (const auto &c_ph : All_Cond_phs) {
         if (T0_phs[c_ph.first] == 1) {
             CT0++;
             fPHKB << "CT0 " << hexval(c_ph.first) << std::endl;
@@ -2020,7 +2384,28 @@ void PeripheralModelLearning::saveKBtoFile(S2EExecutionState *state, uint64_t tb
 
     fPHKB << "Learning time: " << durationtime << "s" << std::endl;
 
-    fPHKB.close();
+    if (binary_kb) {
+        sortKBRecords(kb_records);
+        bool snapshot = kb_delta_rounds >= kb_snapshot_interval;
+        bool written;
+        if (snapshot) {
+            written = writeKBSnapshot(fileName, round_count, state->getID(), tb_num, kb_records);
+        } else {
+            written = appendKBRound(fileName, round_count, state->getID(), tb_num, kb_records, kb_previous_records);
+        }
+
+        if (written) {
+            kb_delta_rounds = snapshot ? 0 : kb_delta_rounds + 1;
+            kb_previous_records.swap(kb_records);
+        } else {
+            // a torn delta hides the rounds appended after it, start over from a snapshot
+            getWarningsStream(state) << "Could not append round " << round_count << " to " << fileName << "\n";
+            kb_delta_rounds = kb_snapshot_interval;
+        }
+        getInfoStream(state) << fStatistic.str();
+    } else {
+        fTextKB.close();
+    }
 
     getInfoStream(state) << "=========KB Extraction Phase Finish===========\n";
 }
@@ -2137,10 +2522,10 @@ void PeripheralModelLearning::onInvalidStatesDetection(S2EExecutionState *state,
 
     // TODO: Do not erase value in T3
     if (!no_new_branch_flag && (!state->regs()->getInterruptFlag())) {
-        TypeFlagPeripheralMap type_flag_phs = plgState->get_type_flag_phs();
+        const TypeFlagPeripheralMap &type_flag_phs = plgState->get_type_flag_phs();
         for (auto &it : plgState->getlastfork_phs()) {
             for (auto &itch : it.second) {
-                if (type_flag_phs[it.first.first] == T3) {
+                if (lookup(type_flag_phs, it.first.first) == T3) {
                     getDebugStream() << " t3 loop phs = " << hexval(it.first.first)
                                      << " pc = " << hexval(it.first.second) << " value = " << hexval(itch.second.second)
                                      << " maybe is incorrect\n";
@@ -2153,15 +2538,15 @@ void PeripheralModelLearning::onInvalidStatesDetection(S2EExecutionState *state,
 
     // remove wrong value in external interrupt value pool
     if (!irq_no_new_branch_flag && state->regs()->getInterruptFlag()) {
-        TypeFlagPeripheralMap type_flag_phs = plgState->get_type_flag_phs();
+        const TypeFlagPeripheralMap &type_flag_phs = plgState->get_type_flag_phs();
         for (auto &it : plgState->irq_getlastfork_phs(state->regs()->getExceptionIndex())) {
             for (auto &itch : it.second) {
-                if (type_flag_phs[it.first.first] == T3) {
+                if (lookup(type_flag_phs, it.first.first) == T3) {
                     getDebugStream() << " t3 loop phs = " << hexval(it.first.first)
                                      << " pc = " << hexval(it.first.second) << " value = " << hexval(itch.second.second)
                                      << "\n";
                     break;
-                } else if (type_flag_phs[it.first.first] == T1 && state->regs()->getExceptionIndex() > 15) {
+                } else if (lookup(type_flag_phs, it.first.first) == T1 && state->regs()->getExceptionIndex() > 15) {
                     IRQPhTuple uniqueirqsphs =
                         std::make_tuple(state->regs()->getExceptionIndex(), it.first.first, it.first.second);
                     std::deque<uint32_t>::iterator itirq =
@@ -2288,7 +2673,7 @@ void PeripheralModelLearning::onStateForkDecide(S2EExecutionState *state, bool *
         uint64_t no;
         auto &arr = results[i];
 
-        getPeripheralExecutionState(arr->getName(), &phaddr, &pc, &ch_value, &no);
+        getPeripheralExecutionState(arr, &phaddr, &pc, &ch_value, &no);
         if (symbolic_address_count[curPc] > 0) {
             getDebugStream(state) << "can not fork at Symbolic Address: " << hexval(curPc) << "\n";
             plgState->insert_symbolicpc_ph_it(std::make_pair(phaddr, pc));
@@ -2385,7 +2770,7 @@ void PeripheralModelLearning::onFork(S2EExecutionState *state, const std::vector
 
     for (int k = newStates.size() - 1; k >= 0; --k) {
         DECLARE_PLUGINSTATE(PeripheralModelLearningState, newStates[k]);
-        ReadPeripheralMap read_size_phs = plgState->get_readphs();
+        const ReadPeripheralMap &read_size_phs = plgState->get_readphs();
         ArrayVec results;
 
         findSymbolicObjects(newConditions[0], results);
@@ -2397,7 +2782,7 @@ void PeripheralModelLearning::onFork(S2EExecutionState *state, const std::vector
             auto &arr = results[i];
             std::vector<unsigned char> data;
 
-            getPeripheralExecutionState(arr->getName(), &phaddr, &pc, &ch_value, &no);
+            getPeripheralExecutionState(arr, &phaddr, &pc, &ch_value, &no);
 
             // getDebugStream() << "The symbol name of value is " << arr->getName() << "\n";
             for (unsigned s = 0; s < arr->getSize(); ++s) {
@@ -2415,7 +2800,7 @@ void PeripheralModelLearning::onFork(S2EExecutionState *state, const std::vector
                 data[0] | ((uint32_t) data[1] << 8) | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
 
             UniquePeripheral uniquePeripheral = std::make_pair(phaddr, pc);
-            uint64_t LSB = ((uint64_t) 1 << (read_size_phs[phaddr].first * 8));
+            uint64_t LSB = ((uint64_t) 1 << (lookup(read_size_phs, phaddr).first * 8));
             uint32_t value = condConcreteValue & (LSB - 1);
             fork_states_values.push_back(value);
 
@@ -2496,7 +2881,7 @@ void PeripheralModelLearning::onFork(S2EExecutionState *state, const std::vector
             plgState->insert_condition_ph_it(phaddr);
             getInfoStream(newStates[k]) << " all cache phaddr = " << hexval(phaddr) << " pc = " << hexval(pc)
                                             << " value = " << hexval(value) << " no = " << no
-                                            << " width = " << hexval(read_size_phs[phaddr].first) << "\n";
+                                            << " width = " << hexval(lookup(read_size_phs, phaddr).first) << "\n";
 
             if (plgState->get_type_flag_ph_it(phaddr) == T3) {
                 plgState->insert_t3_type_ph_back(phaddr, value);
@@ -2801,30 +3186,34 @@ void PeripheralModelLearning::updateIRQKB(S2EExecutionState *state, uint32_t irq
 void PeripheralModelLearning::updateGeneralKB(S2EExecutionState *state, uint32_t irq_num, uint32_t reason_flag) {
     DECLARE_PLUGINSTATE(PeripheralModelLearningState, state);
 
-    AllKnowledgeBaseMap last_fork_phs;
+    static const AllKnowledgeBaseMap no_fork_phs;
+    const AllKnowledgeBaseMap *last_fork_phs = &no_fork_phs;
     if (irq_num > 15) {
         getWarningsStream() << "do store phs in external irqs\n";
     } else if (irq_num == 0) {
-        last_fork_phs = plgState->getlastfork_phs();
+        last_fork_phs = &plgState->getlastfork_phs();
     } else {
-        last_fork_phs = plgState->irq_getlastfork_phs(state->regs()->getExceptionIndex());
+        last_fork_phs = &plgState->irq_getlastfork_phs(state->regs()->getExceptionIndex());
     }
 
+    // types updated below only apply to the next update
+    auto type_flag_snapshot = plgState->snapshot_type_flag_phs();
+    const TypeFlagPeripheralMap &type_flag_phs = *type_flag_snapshot;
+
     if (reason_flag == Valid) {
-        TypeFlagPeripheralMap type_flag_phs = plgState->get_type_flag_phs();
-        for (auto &it : last_fork_phs) {
+        for (auto &it : *last_fork_phs) {
             for (auto &itch : it.second) {
-                if (type_flag_phs[it.first.first] == T0) {
+                if (lookup(type_flag_phs, it.first.first) == T0) {
                     if (itch.second.second == plgState->get_writeph(it.first.first)) {
                         getDebugStream() << " t0 phs = " << hexval(it.first.first) << " write = " << hexval(itch.first)
                                          << " value = " << hexval(itch.second.second) << "\n";
                         // plgState->insert_t0_type_flag_phs(it.first.first, 1);
                         break;
                     }
-                } else if (type_flag_phs[it.first.first] == T1) {
+                } else if (lookup(type_flag_phs, it.first.first) == T1) {
                     if (plgState->get_t2_type_flag_ph_it(it.first) != T2) {
-                        T1BNPeripheralMap t1_type_phs = plgState->get_t1_type_phs();
-                        T1BNPeripheralMap::iterator itt1 = t1_type_phs.find(it.first);
+                        const T1BNPeripheralMap &t1_type_phs = plgState->get_t1_type_phs();
+                        T1BNPeripheralMap::const_iterator itt1 = t1_type_phs.find(it.first);
                         if (itt1 != t1_type_phs.end()) { // deal with t1
                             if (itt1->second.second.second != itch.second.second
                                 && itt1->second.second.first != itch.second.first) {
@@ -2864,8 +3253,8 @@ void PeripheralModelLearning::updateGeneralKB(S2EExecutionState *state, uint32_t
                                                  << " value = " << hexval(itch.second.second) << "\n";
                             }
                         } else { // deal with possible t1
-                            T1BNPeripheralMap pt1_type_phs = plgState->get_pt1_type_phs();
-                            T1BNPeripheralMap::iterator itpt1 = pt1_type_phs.find(it.first);
+                            const T1BNPeripheralMap &pt1_type_phs = plgState->get_pt1_type_phs();
+                            T1BNPeripheralMap::const_iterator itpt1 = pt1_type_phs.find(it.first);
                             if (itpt1 != pt1_type_phs.end()) {
                                 if (itpt1->second.second.second != itch.second.second) {
                                     if (plgState->get_pt1_type_flag_ph_it(it.first) != 1 ||
@@ -2974,7 +3363,7 @@ void PeripheralModelLearning::updateGeneralKB(S2EExecutionState *state, uint32_t
                             }
                         }
                     }
-                } else if (type_flag_phs[it.first.first] == T3) {
+                } else if (lookup(type_flag_phs, it.first.first) == T3) {
                     plgState->insert_cachephs(it.first.first, itch.second.first, itch.second.second);
                     getInfoStream() << " Add t3 loop phs = " << hexval(it.first.first)
                                      << " no = " << hexval(itch.second.first)
@@ -2989,10 +3378,9 @@ void PeripheralModelLearning::updateGeneralKB(S2EExecutionState *state, uint32_t
     }
 
     if (reason_flag == Invlid) {
-        TypeFlagPeripheralMap type_flag_phs = plgState->get_type_flag_phs();
-        for (auto &it : last_fork_phs) {
+        for (auto &it : *last_fork_phs) {
             for (auto &itch : it.second) {
-                if (type_flag_phs[it.first.first] == T0) {
+                if (lookup(type_flag_phs, it.first.first) == T0) {
                     getWarningsStream() << "Return back to T1 ph = " << hexval(it.first.first) << "\n";
                     plgState->insert_type_flag_phs(it.first.first, T1);
                     plgState->insert_lock_t1_type_flag(it.first.first, 1);
@@ -3010,7 +3398,7 @@ void PeripheralModelLearning::updateGeneralKB(S2EExecutionState *state, uint32_t
                                              << " value = " << hexval(t0_ph.second.second.second) << "\n";
                         }
                     }
-                } else if (type_flag_phs[it.first.first] == T1) {
+                } else if (lookup(type_flag_phs, it.first.first) == T1) {
                     if (plgState->get_t2_type_flag_ph_it(it.first) == T2) {
                         CWMap itt2s = plgState->get_t2_type_samepc_phs(it.first);
                         CWMap::iterator itt2 = itt2s.find(itch.first);
@@ -3071,8 +3459,8 @@ void PeripheralModelLearning::updateGeneralKB(S2EExecutionState *state, uint32_t
                             }
                         }
                     } else {
-                        T1BNPeripheralMap t1_type_phs = plgState->get_t1_type_phs();
-                        T1BNPeripheralMap::iterator itt1 = t1_type_phs.find(it.first);
+                        const T1BNPeripheralMap &t1_type_phs = plgState->get_t1_type_phs();
+                        T1BNPeripheralMap::const_iterator itt1 = t1_type_phs.find(it.first);
                         if (itt1 != t1_type_phs.end()) { // deal with t1
                             if (itt1->second.second.second != itch.second.second &&
                                 itt1->second.second.first != itch.second.first) { // different value and no
@@ -3112,8 +3500,8 @@ void PeripheralModelLearning::updateGeneralKB(S2EExecutionState *state, uint32_t
                                                  << " value = " << hexval(itch.second.second) << "\n";
                             }
                         } else {
-                            T1BNPeripheralMap pt1_type_phs = plgState->get_pt1_type_phs();
-                            T1BNPeripheralMap::iterator itpt1 = pt1_type_phs.find(it.first);
+                            const T1BNPeripheralMap &pt1_type_phs = plgState->get_pt1_type_phs();
+                            T1BNPeripheralMap::const_iterator itpt1 = pt1_type_phs.find(it.first);
                             if (itpt1 != pt1_type_phs.end()) {
                                 plgState->erase_pt1_type_ph_it(it.first);
                             }
@@ -3124,7 +3512,7 @@ void PeripheralModelLearning::updateGeneralKB(S2EExecutionState *state, uint32_t
                                              << " value = " << hexval(itch.second.second) << "\n";
                         }
                     }
-                } else if (type_flag_phs[it.first.first] == T3) {
+                } else if (lookup(type_flag_phs, it.first.first) == T3) {
                     plgState->insert_cachephs(it.first.first, itch.second.first, itch.second.second);
                     getInfoStream() << " Add t3 loop phs = " << hexval(it.first.first)
                                      << " no = " << hexval(itch.second.first)
@@ -3202,9 +3590,9 @@ void PeripheralModelLearning::onSymbolicAddress(S2EExecutionState *state, ref<Ex
     symbolic_address_count[curPc]++;
 }
 
-klee::ref<klee::Expr> PeripheralModelLearning::switchModefromFtoL(S2EExecutionState *state, std::string ss,
-                                                                  uint32_t phaddr, unsigned size,
-                                                                  uint64_t concreteValue) {
+klee::ref<klee::Expr> PeripheralModelLearning::switchModefromFtoL(S2EExecutionState *state,
+                                                                  SymbolicHardwareAccessType type, uint32_t phaddr,
+                                                                  unsigned size, uint64_t concreteValue) {
     DECLARE_PLUGINSTATE(PeripheralModelLearningState, state);
     uint32_t pc = state->regs()->getPc();
     getInfoStream() << "New peripheral has found, ph addr = " << hexval(phaddr) << " pc = " << hexval(pc) << "\n";
@@ -3216,10 +3604,9 @@ klee::ref<klee::Expr> PeripheralModelLearning::switchModefromFtoL(S2EExecutionSt
         sum_hash = plgState->get_current_hash(0);
     }
 
-    std::stringstream sum_hashStream;
-    sum_hashStream << hexval(sum_hash);
-    ss = ss + "_" + sum_hashStream.str();
-    getDebugStream(state) << ss << " size " << hexval(size) << "\n";
+    uint32_t site = internAccessSite(phaddr, pc, sum_hash);
+    getDebugStream(state) << "read ph addr = " << hexval(phaddr) << " pc = " << hexval(pc)
+                          << " sum_hash = " << hexval(sum_hash) << " size " << hexval(size) << "\n";
 
     bool fork_point_flag = true;
     onModeSwitch.emit(state, true, &fork_point_flag);
@@ -3312,7 +3699,7 @@ klee::ref<klee::Expr> PeripheralModelLearning::switchModefromFtoL(S2EExecutionSt
                          << " value = " << hexval(concreteValue) << "\n";
         ConcreteArray concolicValue;
         SymbHwGetConcolicVector(plgState->get_writeph(phaddr), size, concolicValue);
-        return state->createSymbolicValue(ss, size * 8, concolicValue);
+        return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
     } else {
         getDebugStream() << " T1 type ph addr = " << hexval(phaddr) << " pc = " << hexval(pc)
                          << " value = " << hexval(concreteValue) << "\n";
@@ -3330,23 +3717,12 @@ klee::ref<klee::Expr> PeripheralModelLearning::switchModefromFtoL(S2EExecutionSt
         } else {
             SymbHwGetConcolicVector(0x0, size, concolicValue);
         }
-        return state->createSymbolicValue(ss, size * 8, concolicValue);
+        return createPeripheralSymbolicValue(state, type, site, size, concolicValue);
     }
 }
 
 void PeripheralModelLearning::switchModefromLtoF(S2EExecutionState *state) {
-    cache_t2_type_phs.clear();
-    cache_pt1_type_phs.clear();
-    cache_t3_type_phs.clear();
-    cache_tirqc_type_phs.clear();
-    cache_tirqs_type_phs.clear();
-    cache_type_irqc_flag.clear();
-    cache_type_irqs_flag.clear();
-    cache_type_flag_phs.clear();
-    cache_t1_type_flag_phs.clear();
-    cache_t2_type_flag_phs.clear();
-    cache_all_cache_phs.clear();
-    possible_irq_values.clear();
+    clearKBCache();
 
     onStateForkConnection.disconnect();
     onStateForkDecideConnection.disconnect();
@@ -3360,6 +3736,7 @@ void PeripheralModelLearning::switchModefromLtoF(S2EExecutionState *state) {
         getWarningsStream() << "Could not read peripheral regs from cache file" << fileName << "\n";
         exit(-1);
     }
+    publishSharedKB();
     bool fork_point_flag = true;
     onModeSwitch.emit(state, false, &fork_point_flag);
     false_type_phs_fork_states.clear();
@@ -10,12 +10,15 @@
 
 #include <deque>
 #include <inttypes.h>
+#include <unordered_map>
 #include <s2e/CorePlugin.h>
 #include <s2e/Plugin.h>
 #include <s2e/Plugins/uEmu/ARMFunctionMonitor.h>
 #include <s2e/Plugins/uEmu/InvalidStatesDetection.h>
+#include <s2e/Plugins/uEmu/PeripheralKB.h>
 #include <s2e/S2EExecutionState.h>
 #include <s2e/SymbolicHardwareHook.h>
+#include <s2e/Synchronization.h>
 #include <vector>
 
 #include <llvm/ADT/SmallVector.h>
@@ -66,6 +69,8 @@ typedef std::map<uint32_t /* peripheraladdress */, std::pair<uint32_t /* size */
 typedef std::pair<uint32_t /* peripheraladdress */, std::pair<uint32_t /* size */, uint32_t /* count */>> ReadTUPLE;
 typedef std::tuple<uint32_t /* phaddr */, uint32_t /* pc */, uint64_t /* caller pc&function regs hash value */> T2Tuple;
 typedef std::vector<std::vector<S2EExecutionState *>> ForkStateStack;
+typedef std::map<T2Tuple, uint32_t /* site id */> AccessSiteIdMap;
+typedef std::unordered_map<uint64_t /* unique no */, uint32_t /* site id */> SymbolicAccessSiteMap;
 
 class PeripheralModelLearning : public Plugin {
     S2E_PLUGIN
@@ -130,11 +135,24 @@ private:
     std::vector<S2EExecutionState *> false_type_phs_fork_states;
     std::map<uint32_t, uint32_t> symbolic_address_count; // record symbolic address
 
+    // interned (phaddr, pc, caller pc&function regs hash value) of each symbolic peripheral read
+    std::vector<T2Tuple> access_sites;
+    AccessSiteIdMap access_site_ids;
+    SymbolicAccessSiteMap symbolic_access_sites; // unique no of symbolic variable -> access site
+    size_t symbolic_access_sites_limit;          // prune the variables of dead states above this size
+
     std::string fileName;
     std::string firmwareName;
     bool enable_extended_irq_mode;
     bool enable_fuzzing;
     bool allow_new_phs;
+    bool binary_kb;
+    std::vector<PeripheralKBRecord> kb_records;          // current round of the binary KB
+    std::vector<PeripheralKBRecord> kb_previous_records; // last round written to the binary KB
+    uint32_t kb_delta_rounds;                            // deltas appended since the last snapshot
+    uint32_t kb_snapshot_interval;                       // deltas appended between two snapshots
+    S2ESynchronizedObject<PeripheralSharedKB> *shared_kb; // KB shared with the other fuzzing workers
+    uint32_t kb_generation;                               // generation of the shared KB currently loaded
     std::vector<uint32_t> valid_phs;
 
     time_t start, end;
@@ -147,9 +165,20 @@ private:
     bool ConcreteT3Regs(S2EExecutionState *state);
     void updateIRQKB(S2EExecutionState *state, uint32_t irq_no, uint32_t flag);
     void updateGeneralKB(S2EExecutionState *state, uint32_t irq_num, uint32_t reason_flag);
-    bool getPeripheralExecutionState(std::string variablePeripheralName, uint32_t *phaddr, uint32_t *pc,
-                                     uint64_t *regs_hash, uint64_t *no);
+    uint32_t internAccessSite(uint32_t phaddr, uint32_t pc, uint64_t regs_hash);
+    klee::ref<klee::Expr> createPeripheralSymbolicValue(S2EExecutionState *state, SymbolicHardwareAccessType type,
+                                                        uint32_t site, unsigned size, const ConcreteArray &concolicValue);
+    void pruneSymbolicAccessSites();
+    bool getPeripheralExecutionState(const klee::ArrayPtr &arr, uint32_t *phaddr, uint32_t *pc, uint64_t *regs_hash,
+                                     uint64_t *no);
     bool readKBfromFile(std::string fileName);
+    void clearKBCache();
+    bool mergeSharedKB(const std::string &path);
+    void publishSharedKB();
+    bool readBinaryKBfromFile(std::string fileName);
+    void loadGeneralKBEntry(uint32_t type, uint32_t phaddr, uint32_t pc, uint32_t value, uint64_t cwirq_value);
+    void loadIRQKBEntry(uint32_t irq_no, uint32_t phaddr, uint32_t cr_phaddr, uint32_t value, uint32_t cr_value);
+    void loadDRKBEntry(uint32_t phaddr, uint32_t size);
     bool getGeneralEntryfromKB(std::string variablePeripheralName, uint32_t *type, uint32_t *phaddr, uint32_t *pc,
                                uint32_t *value, uint64_t *cw_value);
     bool getIRQEntryfromKB(std::string variablePeripheralName, uint32_t *irq_no, uint32_t *type, uint32_t *phaddr,
@@ -157,8 +186,10 @@ private:
     bool getDREntryfromKB(std::string variablePeripheralName, uint32_t *type,
                            uint32_t *phaddr, uint32_t *size);
     void saveKBtoFile(S2EExecutionState *state, uint64_t tb_num);
-    void writeTIRQPeripheralstoKB(S2EExecutionState *state, std::ofstream &fPHKB);
-    void identifyDataPeripheralRegs(S2EExecutionState *state, std::ofstream &fPHKB);
+    void writeKBRecord(std::ostream &fPHKB, const PeripheralKBRecord &rec);
+    void writeKBSection(std::ostream &fPHKB, const char *name);
+    void writeTIRQPeripheralstoKB(S2EExecutionState *state, std::ostream &fPHKB);
+    void identifyDataPeripheralRegs(S2EExecutionState *state, std::ostream &fPHKB);
 
 public:
     sigc::signal<void, S2EExecutionState *, PeripheralRegisterType /* type */, uint32_t /* physicalAddress */,
@@ -177,9 +208,10 @@ public:
 
     bool isMmioSymbolic(uint64_t physAddr);
 
-    klee::ref<klee::Expr> switchModefromFtoL(S2EExecutionState *state, std::string ss, uint32_t phaddr, unsigned size,
-                                             uint64_t concreteValue);
+    klee::ref<klee::Expr> switchModefromFtoL(S2EExecutionState *state, SymbolicHardwareAccessType type, uint32_t phaddr,
+                                             unsigned size, uint64_t concreteValue);
     void switchModefromLtoF(S2EExecutionState *state);
+    bool syncSharedKB();
 
     klee::ref<klee::Expr> onLearningMode(S2EExecutionState *state, SymbolicHardwareAccessType type, uint64_t address,
                                          unsigned size, uint64_t concreteValue);
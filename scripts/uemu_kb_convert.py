@@ -0,0 +1,206 @@
+#!/usr/bin/env python
+
+# Copyright (c) 2017 Dependable Systems Laboratory, EPFL
+# Copyright (c) 2017 Cyberhaven
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+Convert uEmu peripheral knowledge bases between the text format and the
+binary format written when PeripheralModelLearning.binaryKB is enabled.
+See libs2eplugins/src/s2e/Plugins/uEmu/PeripheralKB.h for the layout. The
+rounds of a binary KB are replayed up to the requested one.
+
+    uemu_kb_convert.py bin2text [--round N] firmware_KB.bin firmware_KB.txt
+    uemu_kb_convert.py text2bin firmware_KB.txt firmware_KB.bin
+"""
+
+import argparse
+import struct
+import sys
+from collections import Counter
+
+KB_MAGIC = 0x424b4575
+KB_ROUND_MAGIC = 0x444e5252
+KB_DELTA_MAGIC = 0x544c4452
+KB_VERSION = 2
+KB_REMOVED = 0x80000000
+
+FILE_HEADER = struct.Struct('<IIII')
+ROUND_HEADER = struct.Struct('<IIIIQ')
+RECORD = struct.Struct('<IIIIQII')
+
+KINDS = ['t0', 't1', 'pt1', 'dt1', 't2', 't3', 'tirqs', 'tirqc', 'fuzz', 'fuzzc']
+KB_T3 = KINDS.index('t3')
+KB_TIRQC = KINDS.index('tirqc')
+KB_FUZZ = KINDS.index('fuzz')
+KB_FUZZC = KINDS.index('fuzzc')
+
+# Section markers of the text format, written before the first record of the given kind
+SECTIONS = [(KB_TIRQC, 'IRQCR'), (KB_FUZZ, 'DefaultDataRegs'), (KB_FUZZC, 'CandidateDataRegs')]
+
+
+def read_rounds(data):
+    magic, version, record_size, _ = FILE_HEADER.unpack_from(data, 0)
+    if magic != KB_MAGIC or version not in (1, KB_VERSION) or record_size != RECORD.size:
+        raise ValueError('not a binary KB (version %d)' % KB_VERSION)
+
+    rounds = []
+    offset = FILE_HEADER.size
+    while len(data) - offset >= ROUND_HEADER.size:
+        magic, rnd, count, state_id, tb_num = ROUND_HEADER.unpack_from(data, offset)
+        size = ROUND_HEADER.size + count * RECORD.size
+        if magic not in (KB_ROUND_MAGIC, KB_DELTA_MAGIC) or len(data) - offset < size:
+            sys.stderr.write('ignoring truncated round at offset %d\n' % offset)
+            break
+
+        records = [RECORD.unpack_from(data, offset + ROUND_HEADER.size + i * RECORD.size) for i in range(count)]
+        rounds.append((rnd, state_id, tb_num, magic == KB_DELTA_MAGIC, records))
+        offset += size
+
+    return rounds
+
+
+def replay_rounds(rounds):
+    """\
+    Yield each round with the whole KB obtained by applying it on top of the previous ones.
+    The KB counts the copies of each record, duplicated tirqc records weight the value picked
+    by uEmu.
+    """
+    kb = Counter()
+    for rnd, state_id, tb_num, delta, records in rounds:
+        if not delta:
+            kb = Counter()
+        for rec in records:
+            if rec[0] & KB_REMOVED:
+                rec = (rec[0] & ~KB_REMOVED,) + rec[1:]
+                if kb[rec] > 1:
+                    kb[rec] -= 1
+                else:
+                    kb.pop(rec, None)
+            else:
+                kb[rec] += 1
+        yield rnd, state_id, tb_num, kb
+
+
+def record_key(rec):
+    # same order as KBRecordLess
+    kind, phaddr, pc, value, cw_value, cr_phaddr, cr_value = rec
+    return (kind, phaddr, pc, cw_value, cr_phaddr, cr_value, value)
+
+
+def format_record(rec):
+    kind, phaddr, pc, value, cw_value, cr_phaddr, cr_value = rec
+    if kind == KB_TIRQC:
+        fields = [hex(cw_value), hex(phaddr), hex(cr_phaddr), hex(cr_value), hex(value)]
+    elif kind in (KB_FUZZ, KB_FUZZC):
+        fields = [hex(phaddr), hex(pc), hex(value)]
+    elif kind == KB_T3:
+        fields = [hex(phaddr), hex(pc), str(cw_value), hex(value)]
+    else:
+        fields = [hex(phaddr), hex(pc), hex(cw_value), hex(value)]
+    return '_'.join([KINDS[kind]] + fields)
+
+
+def parse_record(line):
+    fields = line.split('_')
+    if fields[0] not in KINDS:
+        raise ValueError('unrecognized KB entry: %s' % line)
+
+    kind = KINDS.index(fields[0])
+    if kind == KB_TIRQC:
+        irq, phaddr, cr_phaddr, cr_value, value = [int(f, 16) for f in fields[1:]]
+        return (kind, phaddr, 0, value, irq, cr_phaddr, cr_value)
+    if kind in (KB_FUZZ, KB_FUZZC):
+        phaddr, size, count = [int(f, 16) for f in fields[1:]]
+        return (kind, phaddr, size, count, 0, 0, 0)
+
+    phaddr, pc, cw_value, value = fields[1:]
+    cw_value = int(cw_value, 10 if kind == KB_T3 else 16)
+    return (kind, int(phaddr, 16), int(pc, 16), int(value, 16), cw_value, 0, 0)
+
+
+def bin2text(args):
+    with open(args.input, 'rb') as fp:
+        rounds = read_rounds(fp.read())
+
+    if not rounds:
+        raise ValueError('no complete round in %s' % args.input)
+
+    selected = None
+    for rnd, state_id, tb_num, kb in replay_rounds(rounds):
+        if args.round is None or rnd == args.round:
+            selected = (rnd, state_id, tb_num, sorted(kb.elements(), key=record_key))
+    if selected is None:
+        raise ValueError('round %d not found' % args.round)
+
+    rnd, state_id, tb_num, records = selected
+    sys.stderr.write('round %d state %d tb_num %d: %d records\n' % (rnd, state_id, tb_num, len(records)))
+
+    pending = list(SECTIONS)
+    with open(args.output, 'w') as fp:
+        for rec in records:
+            while pending and rec[0] >= pending[0][0]:
+                fp.write(pending.pop(0)[1] + '\n')
+            fp.write(format_record(rec) + '\n')
+        for _, name in pending:
+            fp.write(name + '\n')
+
+
+def text2bin(args):
+    records = []
+    with open(args.input, 'r') as fp:
+        for line in fp:
+            line = line.strip()
+            if not line or line == 'Statistic:':
+                break
+            if line in [name for _, name in SECTIONS]:
+                continue
+            records.append(parse_record(line))
+    records = sorted(records, key=record_key)
+
+    with open(args.output, 'wb') as fp:
+        fp.write(FILE_HEADER.pack(KB_MAGIC, KB_VERSION, RECORD.size, 0))
+        fp.write(ROUND_HEADER.pack(KB_ROUND_MAGIC, args.round or 0, len(records), 0, 0))
+        for rec in records:
+            fp.write(RECORD.pack(*rec))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert uEmu peripheral knowledge bases')
+    parser.add_argument('mode', choices=['bin2text', 'text2bin'])
+    parser.add_argument('--round', type=int, help='round to extract (bin2text) or to record (text2bin)')
+    parser.add_argument('input')
+    parser.add_argument('output')
+    args = parser.parse_args()
+
+    try:
+        if args.mode == 'bin2text':
+            bin2text(args)
+        else:
+            text2bin(args)
+    except (IOError, ValueError, struct.error) as e:
+        sys.stderr.write('%s\n' % e)
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
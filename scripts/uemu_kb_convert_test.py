@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+
+# Copyright (c) 2017 Dependable Systems Laboratory, EPFL
+# Copyright (c) 2017 Cyberhaven
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+import argparse
+import os
+import shutil
+import tempfile
+import unittest
+from collections import Counter
+
+import uemu_kb_convert as kbc
+
+
+# writeTIRQPeripheralstoKB writes the nonzero tirqc records twice
+TEXT_KB = """\
+t0_0x40021000_0x8000130_0x0_0x1
+t1_0x40021004_0x8000140_0x0_0x2
+t3_0x40021008_0x8000150_2_0x10
+t3_0x40021008_0x8000150_2_0x20
+IRQCR
+tirqc_0x25_0x40013800_0x4001381c_0x1_0x0
+tirqc_0x25_0x40013800_0x4001381c_0x1_0x80
+tirqc_0x25_0x40013800_0x4001381c_0x1_0x80
+DefaultDataRegs
+fuzz_0x40013804_0x4_0x1
+CandidateDataRegs
+fuzzc_0x40013804_0x4_0x3
+
+Statistic:
+"""
+
+
+class KBConvertTest(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def path(self, name):
+        return os.path.join(self.dir, name)
+
+    def convert(self, mode, src, dst, rnd=None):
+        getattr(kbc, mode)(argparse.Namespace(input=self.path(src), output=self.path(dst), round=rnd))
+
+    def read_entries(self, name):
+        sections = [section for _, section in kbc.SECTIONS]
+        with open(self.path(name)) as fp:
+            lines = [line.strip() for line in fp]
+        return Counter(line for line in lines if line and line not in sections and line != 'Statistic:')
+
+    def test_round_trip_keeps_duplicates(self):
+        with open(self.path('KB.txt'), 'w') as fp:
+            fp.write(TEXT_KB)
+
+        self.convert('text2bin', 'KB.txt', 'KB.bin')
+        self.convert('bin2text', 'KB.bin', 'KB2.txt')
+
+        entries = self.read_entries('KB2.txt')
+        self.assertEqual(entries, self.read_entries('KB.txt'))
+        self.assertEqual(entries['tirqc_0x25_0x40013800_0x4001381c_0x1_0x80'], 2)
+
+    def test_delta_removes_one_copy(self):
+        with open(self.path('KB.txt'), 'w') as fp:
+            fp.write(TEXT_KB)
+        self.convert('text2bin', 'KB.txt', 'KB.bin')
+
+        dup = kbc.parse_record('tirqc_0x25_0x40013800_0x4001381c_0x1_0x80')
+        removed = (dup[0] | kbc.KB_REMOVED,) + dup[1:]
+        with open(self.path('KB.bin'), 'ab') as fp:
+            fp.write(kbc.ROUND_HEADER.pack(kbc.KB_DELTA_MAGIC, 1, 1, 0, 0))
+            fp.write(kbc.RECORD.pack(*removed))
+
+        self.convert('bin2text', 'KB.bin', 'KB1.txt', 1)
+        self.assertEqual(self.read_entries('KB1.txt')['tirqc_0x25_0x40013800_0x4001381c_0x1_0x80'], 1)
+
+        self.convert('bin2text', 'KB.bin', 'KB0.txt', 0)
+        self.assertEqual(self.read_entries('KB0.txt'), self.read_entries('KB.txt'))
+
+
+if __name__ == '__main__':
+    unittest.main()